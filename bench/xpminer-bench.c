@@ -0,0 +1,608 @@
+/**
+ * Microbenchmarks for the hot kernels of XPMiner.
+ *
+ * Each kernel runs over a range of realistic parameters, every
+ * measurement is repeated --reps times (after --warmup untimed runs)
+ * and the cycles per element are printed as csv, so that the results
+ * can be tracked across versions.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <gmp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define EXTERN
+#include "../src/main.h"
+#undef EXTERN
+
+/**
+ * default number of untimed and timed runs per measurement
+ */
+#define DEFAULT_WARMUP 3
+#define DEFAULT_REPS   20
+
+/**
+ * number of numbers per prime test and hashes per header hash run
+ */
+#define TEST_NUMBERS 64
+#define HASH_COUNT   4096
+
+/**
+ * the parameter ranges
+ */
+static const uint32_t sieve_primes_range[] = { 5000, 28000, 50000, 0 };
+static const uint32_t cache_bits_range[]   = { 32000, 224000, 1024000, 0 };
+static const uint32_t test_bits_range[]    = { 256, 320, 384, 512, 0 };
+static const uint32_t table_size_range[]   = { 100000, 1000000, 10000000, 0 };
+static const uint32_t table_threads_range[] = { 1, 4, 0 };
+
+/**
+ * the benchmark options
+ */
+static uint32_t warmup = DEFAULT_WARMUP;
+static uint32_t reps   = DEFAULT_REPS;
+static char *kernel    = NULL;
+static char *features  = "auto";
+
+/**
+ * a benchmarked kernel
+ * prepare is called (untimed) before each run
+ */
+typedef struct {
+  const char *name;
+  void (*prepare)(void *ctx);
+  void (*run)(void *ctx);
+  void *ctx;
+} Kernel;
+
+/**
+ * returns the current cycle count
+ * (nanoseconds on non x86 platforms)
+ */
+static inline uint64_t cycles() {
+
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000LU + time.tv_nsec;
+#endif
+}
+
+/**
+ * compare function for qsort
+ */
+static int cmp_uint64(const void *a, const void *b) {
+
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * runs the given kernel warmup + reps times and prints
+ * one csv line with the cycles per element
+ */
+static void measure(Kernel *k, const char *param, uint64_t elements) {
+
+  uint64_t *samples = malloc(sizeof(uint64_t) * reps);
+  uint64_t usec     = 0;
+  uint32_t i;
+
+  for (i = 0; i < warmup; i++) {
+    if (k->prepare != NULL) k->prepare(k->ctx);
+    k->run(k->ctx);
+  }
+
+  for (i = 0; i < reps; i++) {
+
+    if (k->prepare != NULL) k->prepare(k->ctx);
+
+    uint64_t start_time = gettime_usec();
+    uint64_t start      = cycles();
+
+    k->run(k->ctx);
+
+    samples[i] = cycles() - start;
+    usec      += gettime_usec() - start_time;
+  }
+
+  qsort(samples, reps, sizeof(uint64_t), cmp_uint64);
+
+  printf("%s,%s,%" PRIu64 ",%" PRIu32 ",%.2f,%.2f,%.2f\n",
+         k->name,
+         param,
+         elements,
+         reps,
+         samples[0] / (double) elements,
+         samples[reps / 2] / (double) elements,
+         usec / (double) reps);
+
+  fflush(stdout);
+  free(samples);
+}
+
+/**
+ * returns whether the given kernel should run
+ */
+static char selected(const char *name) {
+  return kernel == NULL || strstr(name, kernel) != NULL;
+}
+
+/**
+ * (re)initializes the program wide options and sieve globals
+ */
+static void init_bench_opts(uint32_t sieve_primes, uint32_t cache_bits) {
+
+  static char initialized = 0;
+
+  char primes_str[16], cache_str[16];
+  sprintf(primes_str, "%" PRIu32, sieve_primes);
+  sprintf(cache_str,  "%" PRIu32, cache_bits);
+
+  char *argv[] = {
+    "xpminer-bench",
+    "--benchmark",
+    "--quiet",
+    "--no-prime-cache",
+    "--cpu-features", features,
+    "--sieve-primes", primes_str,
+    "--cache-bits",   cache_str,
+    NULL
+  };
+
+  if (initialized)
+    free_opts();
+
+  /* restart option parsing */
+  optind = 0;
+  init_opts(sizeof(argv) / sizeof(char *) - 1, argv);
+  initialized = 1;
+}
+
+/**
+ * a sieve with a random primorial for the sieve kernels
+ */
+typedef struct {
+  Sieve sieve;
+  mpz_t mpz_primorial;
+  uint32_t *multipliers;
+  uint32_t start;
+  uint32_t end;
+} SieveCtx;
+
+static void init_sieve_ctx(SieveCtx *ctx, gmp_randstate_t rand) {
+
+  memset(ctx, 0, sizeof(SieveCtx));
+  init_sieve(&ctx->sieve);
+  reinit_sieve(&ctx->sieve);
+
+  /* primorial = hash * hash primorial * fixed multiplier */
+  mpz_init(ctx->mpz_primorial);
+  mpz_urandomb(ctx->mpz_primorial, rand, 256);
+  mpz_setbit(ctx->mpz_primorial, 255);
+  mpz_mul(ctx->mpz_primorial, ctx->mpz_primorial, opts.mpz_hash_primorial);
+  mpz_mul(ctx->mpz_primorial,
+          ctx->mpz_primorial,
+          opts.mpz_fixed_hash_multiplier);
+
+  kernel_calc_multipliers(&ctx->sieve, ctx->mpz_primorial);
+
+  uint32_t size = sizeof(uint32_t) * opts.max_prime_index *
+                  (opts.chain_length + opts.sieve_extensions);
+
+  ctx->multipliers = malloc(size);
+  ctx->start       = opts.sieve_size / 2;
+  ctx->end         = ctx->start + opts.cache_bits;
+}
+
+static void free_sieve_ctx(SieveCtx *ctx) {
+
+  free_sieve(&ctx->sieve);
+  mpz_clear(ctx->mpz_primorial);
+  free(ctx->multipliers);
+}
+
+static void run_calc_multipliers(void *ctx) {
+  SieveCtx *c = ctx;
+  kernel_calc_multipliers(&c->sieve, c->mpz_primorial);
+}
+
+/* the factors are advanced while sieving, so restore them */
+static void prepare_sieve_from_to(void *ctx) {
+  SieveCtx *c = ctx;
+  memcpy(c->multipliers,
+         c->sieve.cc1_muls,
+         sizeof(uint32_t) * opts.max_prime_index *
+         (opts.chain_length + opts.sieve_extensions));
+}
+
+static void run_sieve_from_to(void *ctx) {
+  SieveCtx *c = ctx;
+  kernel_sieve_from_to(c->sieve.cc1_layer, c->multipliers, c->start, c->end, 0);
+}
+
+static void run_merge_layers(void *ctx) {
+  SieveCtx *c = ctx;
+  kernel_merge_layers(c->sieve.cc2, 
+                      c->sieve.cc1, 
+                      c->sieve.cc2_layer, 
+                      c->sieve.cc1_layer,
+                      word_index(c->start),
+                      word_index(c->end));
+}
+
+/**
+ * inverse calculation for all sieve primes
+ */
+typedef struct {
+  uint32_t *numbers;
+  uint32_t n;
+  uint32_t sum;
+} InvertCtx;
+
+static void run_invert(void *ctx) {
+
+  InvertCtx *c = ctx;
+  uint32_t i;
+
+  for (i = 1; i < c->n; i++)
+    c->sum += kernel_invert(c->numbers[i], opts.primes->ptr[i]);
+}
+
+/**
+ * prime tests on random numbers of a given size
+ */
+typedef struct {
+  mpz_t mpz_numbers[TEST_NUMBERS];
+  TestParams params;
+  uint32_t passed;
+} TestCtx;
+
+static void run_fermat_test(void *ctx) {
+
+  TestCtx *c = ctx;
+  uint32_t i;
+
+  for (i = 0; i < TEST_NUMBERS; i++)
+    c->passed += fermat_test(c->mpz_numbers[i], &c->params);
+}
+
+static void run_euler_lagrange_lifchitz_test(void *ctx) {
+
+  TestCtx *c = ctx;
+  uint32_t i;
+
+  for (i = 0; i < TEST_NUMBERS; i++)
+    c->passed += euler_lagrange_lifchitz_test(c->mpz_numbers[i],
+                                              1,
+                                              &c->params);
+}
+
+/**
+ * header hashing
+ */
+typedef struct {
+  BlockHeader header;
+  SHA256_CTX midstate;
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+} HashCtx;
+
+static void run_get_header_hash(void *ctx) {
+
+  HashCtx *c = ctx;
+  uint32_t i;
+
+  for (i = 0; i < HASH_COUNT; i++) {
+    c->header.nonce++;
+    get_header_hash(&c->header, c->hash);
+  }
+}
+
+static void run_get_header_hash_midstate(void *ctx) {
+
+  HashCtx *c = ctx;
+  uint32_t i;
+
+  for (i = 0; i < HASH_COUNT; i++) {
+    c->header.nonce++;
+    get_header_hash_midstate(&c->header, &c->midstate, c->hash);
+  }
+}
+
+/**
+ * prime table generation
+ */
+typedef struct {
+  uint32_t size;
+  uint32_t threads;
+} TableCtx;
+
+static void run_gen_prime_table(void *ctx) {
+
+  TableCtx *c = ctx;
+  PrimeTable *table = gen_prime_table(c->size, c->threads);
+
+  free(table->ptr);
+  free(table->two_inverses);
+  free(table);
+}
+
+/**
+ * the sieve kernels (depending on sieve-primes and cache-bits)
+ */
+static void bench_sieve_kernels(gmp_randstate_t rand) {
+
+  char param[64];
+  uint32_t p, c;
+
+  for (p = 0; sieve_primes_range[p] != 0; p++) {
+    for (c = 0; cache_bits_range[c] != 0; c++) {
+
+      /* calc_multipliers and invert don't depend on the cache bits */
+      if (c > 0 &&
+          !selected("sieve_from_to") &&
+          !selected("merge_layers"))
+        continue;
+
+      init_bench_opts(sieve_primes_range[p], cache_bits_range[c]);
+
+      SieveCtx sieve_ctx;
+      init_sieve_ctx(&sieve_ctx, rand);
+
+      uint64_t n_primes = opts.max_prime_index - opts.primes_in_primorial;
+      sprintf(param, "sieve_primes=%" PRIu32 ";cache_bits=%" PRIu32,
+              sieve_primes_range[p], opts.cache_bits);
+
+      Kernel from_to = {
+        "sieve_from_to",
+        prepare_sieve_from_to,
+        run_sieve_from_to,
+        &sieve_ctx
+      };
+
+      /* elements: sieved primes */
+      if (selected(from_to.name))
+        measure(&from_to, param, n_primes);
+
+      Kernel merge = { "merge_layers", NULL, run_merge_layers, &sieve_ctx };
+
+      /* elements: merged words */
+      if (selected(merge.name))
+        measure(&merge, param, word_index(opts.cache_bits));
+
+      if (c == 0) {
+
+        sprintf(param, "sieve_primes=%" PRIu32, sieve_primes_range[p]);
+
+        Kernel muls = {
+          "calc_multipliers",
+          NULL,
+          run_calc_multipliers,
+          &sieve_ctx
+        };
+
+        if (selected(muls.name))
+          measure(&muls, param, n_primes);
+
+        /* random numbers to invert */
+        InvertCtx invert_ctx;
+        invert_ctx.n       = opts.max_prime_index;
+        invert_ctx.sum     = 0;
+        invert_ctx.numbers = malloc(sizeof(uint32_t) * invert_ctx.n);
+
+        uint32_t i;
+        for (i = 0; i < invert_ctx.n; i++)
+          invert_ctx.numbers[i] = 1 + gmp_urandomm_ui(rand,
+                                                      opts.primes->ptr[i] - 1);
+
+        Kernel invert = { "invert", NULL, run_invert, &invert_ctx };
+
+        if (selected(invert.name))
+          measure(&invert, param, invert_ctx.n - 1);
+
+        free(invert_ctx.numbers);
+      }
+
+      free_sieve_ctx(&sieve_ctx);
+    }
+  }
+}
+
+/**
+ * the prime tests (depending on the number size)
+ */
+static void bench_prime_tests(gmp_randstate_t rand) {
+
+  char param[64];
+  uint32_t b, i;
+
+  for (b = 0; test_bits_range[b] != 0; b++) {
+
+    TestCtx test_ctx;
+    init_test_params(&test_ctx.params);
+    test_ctx.passed = 0;
+
+    /* odd numbers with n % 8 == 7 (valid for both tests) */
+    for (i = 0; i < TEST_NUMBERS; i++) {
+      mpz_init(test_ctx.mpz_numbers[i]);
+      mpz_urandomb(test_ctx.mpz_numbers[i], rand, test_bits_range[b]);
+      mpz_setbit(test_ctx.mpz_numbers[i], test_bits_range[b] - 1);
+      mpz_setbit(test_ctx.mpz_numbers[i], 0);
+      mpz_setbit(test_ctx.mpz_numbers[i], 1);
+      mpz_setbit(test_ctx.mpz_numbers[i], 2);
+    }
+
+    sprintf(param, "bits=%" PRIu32 ";limbs=%zu",
+            test_bits_range[b],
+            mpz_size(test_ctx.mpz_numbers[0]));
+
+    Kernel fermat = { "fermat_test", NULL, run_fermat_test, &test_ctx };
+    Kernel euler  = {
+      "euler_lagrange_lifchitz_test",
+      NULL,
+      run_euler_lagrange_lifchitz_test,
+      &test_ctx
+    };
+
+    if (selected(fermat.name))
+      measure(&fermat, param, TEST_NUMBERS);
+
+    if (selected(euler.name))
+      measure(&euler, param, TEST_NUMBERS);
+
+    for (i = 0; i < TEST_NUMBERS; i++)
+      mpz_clear(test_ctx.mpz_numbers[i]);
+
+    clear_test_params(&test_ctx.params);
+  }
+}
+
+/**
+ * the header hashing
+ */
+static void bench_header_hash() {
+
+  HashCtx hash_ctx;
+  bench_header(&hash_ctx.header, 0);
+  header_hash_midstate(&hash_ctx.header, &hash_ctx.midstate);
+
+  Kernel hash = {
+    "get_header_hash",
+    NULL,
+    run_get_header_hash,
+    &hash_ctx
+  };
+
+  Kernel midstate = {
+    "get_header_hash_midstate",
+    NULL,
+    run_get_header_hash_midstate,
+    &hash_ctx
+  };
+
+  if (selected(hash.name))
+    measure(&hash, "-", HASH_COUNT);
+
+  if (selected(midstate.name))
+    measure(&midstate, "-", HASH_COUNT);
+}
+
+/**
+ * the prime table generation (depending on the table size)
+ */
+static void bench_prime_table() {
+
+  char param[64];
+  uint32_t s, t;
+
+  for (s = 0; table_size_range[s] != 0; s++) {
+    for (t = 0; table_threads_range[t] != 0; t++) {
+
+      TableCtx table_ctx = { table_size_range[s], table_threads_range[t] };
+      Kernel table = { 
+        "gen_prime_table", 
+        NULL, 
+        run_gen_prime_table, 
+        &table_ctx 
+      };
+
+      sprintf(param, "sieve_size=%" PRIu32 ";threads=%" PRIu32, 
+              table_size_range[s], 
+              table_threads_range[t]);
+
+      /* elements: numbers in the sieve range */
+      if (selected(table.name))
+        measure(&table, param, table_size_range[s]);
+    }
+  }
+}
+
+/**
+ * the available command line options
+ */
+static struct option long_options[] = {
+  { "warmup",       required_argument, 0, 'w' },
+  { "reps",         required_argument, 0, 'r' },
+  { "kernel",       required_argument, 0, 'k' },
+  { "cpu-features", required_argument, 0, 'c' },
+  { "help",         no_argument,       0, 'h' },
+  { 0,              0,                 0, 0   }
+};
+
+int main(int argc, char *argv[]) {
+
+  int opt;
+  while ((opt = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
+
+    switch (opt) {
+      case 'w': warmup = atoi(optarg); break;
+      case 'r': reps   = atoi(optarg); break;
+      case 'k': kernel = optarg;       break;
+      case 'c': features = optarg;     break;
+      default:
+        printf("usage: %s [--warmup NUM] [--reps NUM] [--kernel NAME] "
+               "[--cpu-features NAME]\n"
+               "  prints csv: kernel,params,elements,reps,"
+               "min_cycles_per_element,median_cycles_per_element,"
+               "usec_per_run\n",
+               argv[0]);
+        return EXIT_SUCCESS;
+    }
+  }
+
+  if (reps == 0) reps = 1;
+
+  running = 1;
+
+  /* fixed seed for comparable inputs across versions */
+  gmp_randstate_t rand;
+  gmp_randinit_default(rand);
+  gmp_randseed_ui(rand, 42);
+
+  printf("# %s\n", PROG_NAME);
+
+  /* the selected (or lowered) --cpu-features */
+  init_bench_opts(DEFAULT_SIEVE_PRIMES, DEFAULT_CACHE_BITS);
+  printf("# cpu-features: %s\n", cpu_level_name(opts.cpu_level));
+
+  printf("kernel,params,elements,reps,min_cycles_per_element,"
+         "median_cycles_per_element,usec_per_run\n");
+
+  bench_sieve_kernels(rand);
+
+  /* the remaining kernels only need the default options */
+  init_bench_opts(DEFAULT_SIEVE_PRIMES, DEFAULT_CACHE_BITS);
+
+  bench_prime_tests(rand);
+  bench_header_hash();
+  bench_prime_table();
+
+  free_opts();
+  gmp_randclear(rand);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,467 @@
+/**
+ * A local mock pool for end to end load tests of XPMiner.
+ *
+ * It speaks the xolominer protocol, pushes random work in a fixed
+ * interval, verifies every submitted share like check_share() does
+ * and answers it after an optional delay. Valid shares can be answered
+ * as stale or rejected with a given ratio, to exercise the error paths
+ * of the miner.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXTERN
+#include "../src/main.h"
+#undef EXTERN
+
+/**
+ * the default mock pool options
+ */
+#define DEFAULT_PORT           1337
+#define DEFAULT_WORK_INTERVAL  60
+#define DEFAULT_DIFFICULTY     10.0
+#define DEFAULT_MIN_SHARE      DEFAULT_POOL_SHARE
+#define DEFAULT_POOL_STATS     10
+
+/**
+ * maximum number of unanswered shares per client
+ * (the miner waits for the results of at most SHARE_QUEUE_SIZE shares)
+ */
+#define MAX_PENDING_ACKS 256
+
+/**
+ * the mock pool options
+ */
+static uint16_t port           = DEFAULT_PORT;
+static uint32_t work_interval  = DEFAULT_WORK_INTERVAL;
+static double   difficulty     = DEFAULT_DIFFICULTY;
+static uint32_t min_share      = DEFAULT_MIN_SHARE;
+static double   reject_ratio   = 0;
+static double   stale_ratio    = 0;
+static uint32_t latency        = 0;
+static uint32_t stats_interval = DEFAULT_POOL_STATS;
+
+/**
+ * a share result waiting for its delayed answer
+ */
+typedef struct {
+  uint64_t received;
+  int32_t result;
+} PendingAck;
+
+/**
+ * the per client state (in submission order)
+ */
+typedef struct {
+  PendingAck acks[MAX_PENDING_ACKS];
+  uint64_t acks_head;
+  uint64_t acks_tail;
+} MockClient;
+
+/**
+ * the share statistics
+ */
+static struct {
+  uint64_t received;
+  uint64_t accepted;
+  uint64_t blocks;
+  uint64_t stale;
+  uint64_t forced_stale;
+  uint64_t forced_rejected;
+  uint64_t below_min;
+  uint64_t invalid;
+  uint64_t acked;
+  uint64_t ack_time;
+  uint64_t ack_time_max;
+  uint64_t verified;
+  uint64_t verify_time;
+} stats;
+
+/**
+ * the current work
+ */
+static BlockHeader work;
+
+/**
+ * parameters for the share verification
+ */
+static TestParams test_params;
+
+/**
+ * signal handler to shutdown the mock pool
+ */
+static void shutdown_pool(int signum) {
+
+  (void) signum;
+  running = 0;
+}
+
+/**
+ * returns a random number in [0, 1)
+ */
+static inline double random_ratio() {
+  return rand() / (RAND_MAX + 1.0);
+}
+
+/**
+ * creates new random work for a new block
+ */
+static void new_work() {
+
+  uint32_t i;
+
+  header_set_null(&work);
+  work.version = BLOCK_HEADER_VERSION;
+
+  for (i = 0; i < HASH_LENGTH; i++) {
+    work.hash_prev_block[i]  = rand();
+    work.hash_merkle_root[i] = rand();
+  }
+
+  work.time       = time(NULL);
+  work.difficulty = difficulty * (1 << FRACTIONAL_BITS);
+  work.nonce      = 0;
+}
+
+/**
+ * verifies the given share like check_share() does
+ * (the share doesn't contain its chain type, so all types are tested)
+ * returns the share result for the client
+ */
+static int32_t verify_share(BlockHeader *share) {
+
+  /* share for an old block */
+  if (memcmp(share->hash_prev_block, work.hash_prev_block, HASH_LENGTH)) {
+
+    stats.stale++;
+    return -1;
+  }
+
+  uint64_t start_time = gettime_usec();
+  uint32_t share_difficulty = 0;
+
+  static const char types[] = { 
+    FIRST_CUNNINGHAM_CHAIN, 
+    SECOND_CUNNINGHAM_CHAIN, 
+    BI_TWIN_CHAIN 
+  };
+
+  uint32_t i;
+  for (i = 0; i < sizeof(types); i++) {
+
+    uint32_t type_difficulty = get_share_difficulty(share, 
+                                                    types[i], 
+                                                    &test_params);
+
+    if (type_difficulty > share_difficulty)
+      share_difficulty = type_difficulty;
+  }
+
+  stats.verified++;
+  stats.verify_time += gettime_usec() - start_time;
+
+  if (share_difficulty == 0) {
+    stats.invalid++;
+    return 0;
+  }
+
+  if (chain_length(share_difficulty) < min_share) {
+    stats.below_min++;
+    return 0;
+  }
+
+  if (share_difficulty >= work.difficulty) {
+    stats.blocks++;
+    return share_difficulty;
+  }
+
+  /* simulate pool side errors for valid shares */
+  double ratio = random_ratio();
+
+  if (ratio < stale_ratio) {
+    stats.forced_stale++;
+    return -1;
+  }
+
+  if (ratio < stale_ratio + reject_ratio) {
+    stats.forced_rejected++;
+    return 0;
+  }
+
+  stats.accepted++;
+  return chain_length(share_difficulty);
+}
+
+/**
+ * sends the share result to the client and updates the ack latency
+ */
+static void send_ack(ServerClient *client, PendingAck *ack) {
+
+  uint64_t ack_time = gettime_usec() - ack->received;
+
+  stats.acked++;
+  stats.ack_time += ack_time;
+
+  if (ack_time > stats.ack_time_max)
+    stats.ack_time_max = ack_time;
+
+  server_send_share_info(client, ack->result);
+}
+
+/**
+ * sends the current work to new clients
+ */
+static void client_hello(ServerClient *client) {
+
+  client->data = calloc(1, sizeof(MockClient));
+
+  info_msg("client %s connected: version %d.%d, %d threads, "
+           "miner id %" PRIu16 "\n",
+           client->user,
+           client->version_major,
+           client->version_minor,
+           client->num_threads,
+           client->miner_id);
+
+  server_send_work(client, &work);
+}
+
+/**
+ * verifies a submitted share and queues its result
+ */
+static void client_share(ServerClient *client, BlockHeader *share) {
+
+  MockClient *mock = (MockClient *) client->data;
+
+  PendingAck ack;
+  ack.received = gettime_usec();
+  ack.result   = verify_share(share);
+
+  stats.received++;
+
+  /* results have to be send in submission order */
+  if (latency == 0 || mock->acks_tail - mock->acks_head >= MAX_PENDING_ACKS) {
+
+    /* a failed send closes the client (and frees its state) */
+    while (!client->closed && mock->acks_head < mock->acks_tail)
+      send_ack(client, &mock->acks[mock->acks_head++ % MAX_PENDING_ACKS]);
+
+    send_ack(client, &ack);
+    return;
+  }
+
+  mock->acks[mock->acks_tail++ % MAX_PENDING_ACKS] = ack;
+}
+
+/**
+ * frees the client state
+ */
+static void client_closed(ServerClient *client) {
+
+  if (client->hello_received)
+    info_msg("client %s disconnected\n", client->user);
+
+  free(client->data);
+  client->data = NULL;
+}
+
+/**
+ * answers all shares of the given client whose delay is over
+ * returns the time (in microseconds) until the next answer is due
+ */
+static uint64_t send_due_acks(ServerClient *client, uint64_t now) {
+
+  MockClient *mock = (MockClient *) client->data;
+
+  while (mock != NULL && !client->closed &&
+         mock->acks_head < mock->acks_tail) {
+
+    PendingAck *ack = &mock->acks[mock->acks_head % MAX_PENDING_ACKS];
+    uint64_t due    = ack->received + latency * 1000LU;
+
+    if (due > now)
+      return due - now;
+
+    mock->acks_head++;
+    send_ack(client, ack);
+  }
+
+  return UINT64_MAX;
+}
+
+/**
+ * prints the share statistics
+ */
+static void print_pool_stats() {
+
+  info_msg("clients: %" PRIu32 "  shares: %" PRIu64 "  accepted: %" PRIu64
+           "  blocks: %" PRIu64 "  stale: %" PRIu64 " (%" PRIu64 " forced)"
+           "  rejected: %" PRIu64 " (%" PRIu64 " forced, %" PRIu64
+           " below min)  invalid: %" PRIu64 "\n",
+           server_clients(),
+           stats.received,
+           stats.accepted,
+           stats.blocks,
+           stats.stale + stats.forced_stale,
+           stats.forced_stale,
+           stats.forced_rejected + stats.below_min + stats.invalid,
+           stats.forced_rejected,
+           stats.below_min,
+           stats.invalid);
+
+  if (stats.acked > 0)
+    info_msg("submit to ack: avg %.3fms  max %.3fms  "
+             "verify: avg %.3fms\n",
+             stats.ack_time / (1000.0 * stats.acked),
+             stats.ack_time_max / 1000.0,
+             stats.verified > 0 ? 
+               stats.verify_time / (1000.0 * stats.verified) : 0);
+}
+
+/**
+ * the mock pool options
+ */
+static struct option long_options[] = {
+  { "port",           required_argument, 0, 'p' },
+  { "work-interval",  required_argument, 0, 'w' },
+  { "difficulty",     required_argument, 0, 'd' },
+  { "min-share",      required_argument, 0, 'm' },
+  { "reject-ratio",   required_argument, 0, 'r' },
+  { "stale-ratio",    required_argument, 0, 's' },
+  { "latency",        required_argument, 0, 'l' },
+  { "stats-interval", required_argument, 0, 'i' },
+  { "help",           no_argument,       0, 'h' },
+  { 0,                0,                 0, 0   }
+};
+
+/**
+ * prints the usage of the mock pool
+ */
+static void print_usage(char *prog) {
+
+  printf("usage: %s [options]\n"
+         "  --port NUM            port to listen on (default %d)\n"
+         "  --work-interval SEC   seconds between new work (default %d)\n"
+         "  --difficulty NUM      network difficulty (default %.1f)\n"
+         "  --min-share NUM       minimum share chain length (default %d)\n"
+         "  --reject-ratio NUM    ratio of valid shares answered as rejected\n"
+         "  --stale-ratio NUM     ratio of valid shares answered as stale\n"
+         "  --latency MSEC        delay before a share gets answered\n"
+         "  --stats-interval SEC  seconds between statistics (default %d)\n",
+         prog,
+         DEFAULT_PORT,
+         DEFAULT_WORK_INTERVAL,
+         DEFAULT_DIFFICULTY,
+         DEFAULT_MIN_SHARE,
+         DEFAULT_POOL_STATS);
+}
+
+int main(int argc, char *argv[]) {
+
+  int opt;
+  while ((opt = getopt_long_only(argc, argv, "", long_options, NULL)) != -1) {
+
+    switch (opt) {
+      case 'p': port           = atoi(optarg); break;
+      case 'w': work_interval  = atoi(optarg); break;
+      case 'd': difficulty     = atof(optarg); break;
+      case 'm': min_share      = atoi(optarg); break;
+      case 'r': reject_ratio   = atof(optarg); break;
+      case 's': stale_ratio    = atof(optarg); break;
+      case 'l': latency        = atoi(optarg); break;
+      case 'i': stats_interval = atoi(optarg); break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+    }
+  }
+
+  if (work_interval == 0)  work_interval  = 1;
+  if (stats_interval == 0) stats_interval = 1;
+
+  running = 1;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(struct sigaction));
+  action.sa_handler = shutdown_pool;
+  sigaction(SIGINT,  &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  srand(time(NULL) ^ getpid());
+  init_test_params(&test_params);
+
+  ServerHandlers handlers = { client_hello, client_share, client_closed };
+
+  if (server_init(port, &handlers) != 0)
+    return EXIT_FAILURE;
+
+  info_msg("mock pool listening on port %" PRIu16 ", difficulty %.2f\n",
+           port,
+           difficulty);
+
+  new_work();
+
+  uint64_t next_work  = gettime_usec() + work_interval  * 1000000LU;
+  uint64_t next_stats = gettime_usec() + stats_interval * 1000000LU;
+
+  while (running) {
+
+    uint64_t now = gettime_usec();
+
+    if (now >= next_work) {
+      new_work();
+      server_broadcast_work(&work);
+      next_work += work_interval * 1000000LU;
+    }
+
+    if (now >= next_stats) {
+      print_pool_stats();
+      next_stats += stats_interval * 1000000LU;
+    }
+
+    /* wait until the next event is due */
+    uint64_t wait = (next_work < next_stats ? next_work : next_stats) - now;
+
+    if (latency > 0) {
+
+      uint32_t i;
+      for (i = 0; i < server_clients(); i++) {
+
+        uint64_t due = send_due_acks(server_client(i), now);
+        if (due < wait) wait = due;
+      }
+    }
+
+    if (server_poll(wait / 1000 + 1) < 0) {
+      errno_msg("failed to wait for clients");
+      break;
+    }
+  }
+
+  print_pool_stats();
+
+  server_shutdown();
+  clear_test_params(&test_params);
+
+  return EXIT_SUCCESS;
+}
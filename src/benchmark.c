@@ -0,0 +1,378 @@
+/**
+ * Implementation of the offline benchmark mode.
+ * 
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "main.h"
+
+/**
+ * the next round to run (shared by all benchmark threads)
+ */
+static uint32_t next_round = 0;
+
+/**
+ * end of a time limited benchmark (in microseconds, 0 = no limit)
+ */
+static uint64_t bench_end = 0;
+
+/**
+ * the rounds of a --bench-hash-sweep run use a synthetic hash, if
+ * mining the real one would take longer than BENCH_SWEEP_MAX_HASHES
+ */
+#define BENCH_SWEEP_MAX_HASHES (1 << 22)
+
+static char bench_synthetic = 0;
+
+/**
+ * how often the threads are checked for the end of the run
+ * (in microseconds)
+ */
+#define BENCH_POLL_INTERVAL 1000
+
+/**
+ * simple deterministic pseudo random numbers (splitmix64)
+ */
+static uint64_t bench_random(uint64_t *state) {
+
+  uint64_t z = (*state += 0x9E3779B97F4A7C15LU);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9LU;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBLU;
+  return z ^ (z >> 31);
+}
+
+/**
+ * creates the synthetic benchmark header for the given seed
+ */
+void bench_header(BlockHeader *header, uint32_t seed) {
+
+  uint64_t state = seed;
+  uint32_t i;
+
+  header_set_null(header);
+  header->version = BLOCK_HEADER_VERSION;
+
+  for (i = 0; i < HASH_LENGTH; i += sizeof(uint64_t)) {
+
+    uint64_t prev   = bench_random(&state);
+    uint64_t merkle = bench_random(&state);
+
+    memcpy(header->hash_prev_block  + i, &prev,   sizeof(uint64_t));
+    memcpy(header->hash_merkle_root + i, &merkle, sizeof(uint64_t));
+  }
+
+  header->time       = BENCH_HEADER_TIME;
+  header->difficulty = opts.chain_length << FRACTIONAL_BITS;
+  header->nonce      = 0;
+}
+
+/**
+ * sets the hash of the sieve to the next multiple of the hash primorial
+ * not below the header hash (and 2^255), without mining for it
+ */
+static void bench_synthetic_hash(Sieve *sieve) {
+
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  get_header_hash(&sieve->header, hash);
+
+  mpz_set_sha256(sieve->mpz_hash, hash);
+  mpz_setbit(sieve->mpz_hash, 255);
+
+  mpz_cdiv_q(sieve->mpz_hash, sieve->mpz_hash, opts.mpz_hash_primorial);
+  mpz_mul(sieve->mpz_hash, sieve->mpz_hash, opts.mpz_hash_primorial);
+}
+
+/**
+ * runs benchmark rounds until all rounds are done or the time is over
+ */
+static void *bench_thread(void *thread_args) {
+
+  MinerArgs *args    = (MinerArgs *) thread_args;
+  Sieve *const sieve = &args->sieve;
+
+  mpz_t mpz_primorial;
+  mpz_init(mpz_primorial);
+
+  init_sieve(sieve);
+  sieve->group = stats_group(args->id);
+
+  BlockHeader header;
+  uint64_t published;
+
+  sieve->epoch          = read_work(&header, &published);
+  sieve->synthetic_hash = bench_synthetic;
+  sieve_set_header(sieve, &header);
+
+  args->mine = MINING_STARTED;
+
+  while (running) {
+
+    uint32_t round = __atomic_fetch_add(&next_round, 1, __ATOMIC_RELAXED);
+
+    if (round >= opts.bench_rounds ||
+        (bench_end > 0 && gettime_usec() >= bench_end))
+      break;
+
+    /* each round has its own header, independent of the thread */
+    sieve->header.time  = BENCH_HEADER_TIME + round;
+    sieve->header.nonce = 0;
+
+    reinit_sieve(sieve);
+
+    /* generate a hash divisible by the hash primorial */
+    if (bench_synthetic)
+      bench_synthetic_hash(sieve);
+    else if (!mine_header_hash(sieve, 1))
+      break;
+
+    /* calculate the primorial for sieving */
+    mpz_mul(mpz_primorial, sieve->mpz_hash, opts.mpz_fixed_hash_multiplier);
+
+    /* run the sieve and check the candidates */
+    sieve_run(sieve, mpz_primorial);
+  }
+
+  args->mine = MINING_STOPPED;
+  mpz_clear(mpz_primorial);
+
+  free_sieve(sieve);
+
+  return NULL;
+}
+
+/**
+ * prints the benchmark results
+ */
+static void print_bench_results(uint32_t n_threads, uint64_t run_time) {
+
+  /* the stats of all threads (flushed by free_sieve) */
+  SieveStats stats;
+  stats_groups_collect(&stats, NULL);
+
+  uint32_t n;
+
+  double seconds = run_time / 1000000.0;
+  double rounds  = stats.rounds > 0 ? stats.rounds : 1;
+
+  info_msg("Benchmark: seed %" PRIu32 ", %" PRIu32 " threads, %" PRIu64
+           " rounds in %.2fs\n",
+           opts.bench_seed,
+           n_threads,
+           stats.rounds,
+           seconds);
+
+  info_msg("Tests: %" PRIu64 " (%.1f T/s)  Candidates/round: %.1f  "
+           "Hashes/round: %.1f\n",
+           stats.tests,
+           stats.tests / seconds,
+           stats.tests / rounds,
+           stats.hashes / rounds);
+
+  /* cpu time of all threads per round */
+  info_msg("Stage time per round: hash %.1fms  multipliers %.1fms  "
+           "sieve %.1fms  test %.1fms\n",
+           stats.hash_time       / (1000.0 * rounds),
+           stats.multiplier_time / (1000.0 * rounds),
+           stats.sieve_time      / (1000.0 * rounds),
+           stats.test_time       / (1000.0 * rounds));
+
+  info_msg("Chains:      1CC         2CC         TWN      per hour\n");
+
+  for (n = 1; n < MAX_CHAIN_LENGTH; n++) {
+
+    uint64_t chains = stats.cc1[n] + stats.cc2[n] + stats.twn[n];
+
+    if (chains > 0)
+      info_msg("%6" PRIu32 ": %10" PRIu64 "  %10" PRIu64 "  %10" PRIu64
+               "  %12.1f\n",
+               n,
+               stats.cc1[n],
+               stats.cc2[n],
+               stats.twn[n],
+               chains * 3600 / seconds);
+  }
+}
+
+/**
+ * runs the benchmark rounds on all threads, returns the run time
+ * (the stats are left in the stats groups)
+ */
+static uint64_t bench_run(MinerArgs *args, 
+                          pthread_t *threads, 
+                          uint32_t n_threads) {
+
+  memset(args, 0, n_threads * sizeof(MinerArgs));
+  init_stats_groups(n_threads);
+
+  next_round = 0;
+  uint64_t start_time = gettime_usec();
+
+  if (opts.bench_time > 0)
+    bench_end = start_time + opts.bench_time * 1000000LU;
+
+  uint32_t i;
+  for (i = 0; i < n_threads; i++) {
+    args[i].mine      = MINING_WAIT;
+    args[i].n_threads = n_threads;
+    args[i].id        = i;
+
+    pthread_create(&threads[i], NULL, bench_thread, (void *) &args[i]);
+  }
+
+  /* a round can take long, so a shutdown stops the rounds in progress */
+  for (i = 0; i < n_threads; i++) {
+    while (running && 
+           __atomic_load_n(&args[i].mine, __ATOMIC_RELAXED) != MINING_STOPPED)
+      usleep(BENCH_POLL_INTERVAL);
+  }
+
+  uint64_t run_time = gettime_usec() - start_time;
+
+  for (i = 0; i < n_threads; i++) {
+    args[i].sieve.active = 0;
+    pthread_join(threads[i], NULL);
+  }
+
+  return run_time;
+}
+
+/**
+ * runs the benchmark for every --primes-in-hash from 1 to 
+ * --bench-hash-sweep and prints the hashing and sieving time per round
+ * and the resulting chain rates, to show where the trade-off peaks
+ *
+ * the hash time of synthetic rounds is estimated from the hash rate
+ * of the last mined ones (the hash rate hardly depends on the primes),
+ * and added to the run time
+ */
+static void bench_hash_sweep(MinerArgs *args, 
+                             pthread_t *threads, 
+                             uint32_t n_threads) {
+
+  const uint32_t primes_in_primorial = opts.primes_in_primorial;
+
+  double hash_usec = 0;
+  double best_rate = 0;
+  uint32_t best    = 0;
+  uint32_t n;
+
+  info_msg("Hash sweep: seed %" PRIu32 ", %" PRIu32 " threads, hash and "
+           "sieve (multipliers, sieve, test) cpu time per round\n",
+           opts.bench_seed,
+           n_threads);
+
+  for (n = 1; running && n <= opts.bench_hash_sweep; n++) {
+
+    free_sieve_parameters();
+
+    /* the fixed multiplier grows with the hash primorial again */
+    opts.primes_in_hash      = n;
+    opts.primes_in_primorial = primes_in_primorial;
+    init_sieve_parameters();
+
+    double hashes   = 2 * mpz_get_d(opts.mpz_hash_primorial);
+    bench_synthetic = (hashes > BENCH_SWEEP_MAX_HASHES && hash_usec > 0);
+
+    uint64_t run_time = bench_run(args, threads, n_threads);
+
+    SieveStats stats;
+    stats_groups_collect(&stats, NULL);
+    free_stats_groups();
+
+    double rounds = stats.rounds > 0 ? stats.rounds : 1;
+
+    /* the mined rounds measure the hash rate */
+    if (!bench_synthetic && stats.hashes > 0)
+      hash_usec = stats.hash_time / (double) stats.hashes;
+
+    double hash_time  = bench_synthetic ? hashes * hash_usec * rounds :
+                                          stats.hash_time;
+    double sieve_time = stats.multiplier_time + 
+                        stats.sieve_time      + 
+                        stats.test_time;
+
+    /* the threads would have hashed the synthetic rounds in parallel */
+    double seconds = (run_time + (hash_time - stats.hash_time) / n_threads) /
+                     1000000.0;
+
+    uint64_t chains4 = stats.cc1[4] + stats.cc2[4] + stats.twn[4];
+    uint64_t chains5 = stats.cc1[5] + stats.cc2[5] + stats.twn[5];
+    double rate      = chains4 * 3600 / seconds;
+
+    info_msg("%2" PRIu32 " primes: %8.2e hashes  hash %9.3gms  "
+             "sieve %7.1fms  %5.1f%% hashing  T/s %7.1f  4ch/h %8.1f  "
+             "5ch/h %7.1f%s\n",
+             n,
+             hashes,
+             hash_time  / (1000.0 * rounds),
+             sieve_time / (1000.0 * rounds),
+             100 * hash_time / (hash_time + sieve_time),
+             stats.tests / seconds,
+             rate,
+             chains5 * 3600 / seconds,
+             bench_synthetic ? " (synthetic hash)" : "");
+
+    if (rate > best_rate) {
+      best_rate = rate;
+      best      = n;
+    }
+  }
+
+  if (best > 0)
+    info_msg("Most 4-chains per hour with --primes-in-hash %" PRIu32 "\n",
+             best);
+}
+
+/**
+ * runs the whole mining pipeline (header hash, sieve and prime tests)
+ * on a synthetic header without a pool and prints the results
+ */
+void run_benchmark() {
+
+  uint32_t n_threads = opts.num_threads;
+  pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+  MinerArgs *args    = NULL;
+
+  if (posix_memalign((void **) &args,
+                     CACHE_LINE_SIZE,
+                     n_threads * sizeof(MinerArgs)) != 0) {
+
+    error_msg("[EE] failed to allocate benchmark args\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* check the extension pruning if DEBUG is enabled */
+  check_prune();
+
+  /* the benchmark header is the only work */
+  BlockHeader header;
+  bench_header(&header, opts.bench_seed);
+  publish_work(&header);
+
+  if (opts.bench_hash_sweep > 0) {
+    bench_hash_sweep(args, threads, n_threads);
+  } else {
+    print_bench_results(n_threads, bench_run(args, threads, n_threads));
+    free_stats_groups();
+  }
+
+  free(threads);
+  free(args);
+}
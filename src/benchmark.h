@@ -0,0 +1,47 @@
+/**
+ * Header file of the offline benchmark mode.
+ * 
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * the header time of benchmark round 0
+ * (round n uses BENCH_HEADER_TIME + n)
+ */
+#define BENCH_HEADER_TIME 1400000000u
+
+/**
+ * creates the synthetic benchmark header for the given seed
+ */
+void bench_header(BlockHeader *header, uint32_t seed);
+
+/**
+ * runs the whole mining pipeline (header hash, sieve and prime tests)
+ * on a synthetic header without a pool and prints the results
+ * 
+ * each round uses its own header time, so the results only depend on
+ * the seed, the number of rounds and the sieve parameters,
+ * not on the number of threads or the scheduling
+ */
+void run_benchmark();
+
+#endif /* __BENCHMARK_H__ */
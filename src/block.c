@@ -21,10 +21,37 @@
  */
 #include <time.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <gmp.h>
 
 #include "main.h"
 
+/**
+ * The low level sha256 functions of OpenSSL are deprecated since 3.0,
+ * but the EVP interface can only resume from a midstate by copying a
+ * heap allocated context for every header hash. So they are still used,
+ * but only through these wrappers, which silence the warnings on purpose.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+
+static inline void sha256_init(SHA256_CTX *sha256) {
+  SHA256_Init(sha256);
+}
+
+static inline void sha256_update(SHA256_CTX *sha256, 
+                                 const void *data, 
+                                 size_t len) {
+  SHA256_Update(sha256, data, len);
+}
+
+static inline void sha256_final(uint8_t hash[SHA256_DIGEST_LENGTH], 
+                                SHA256_CTX *sha256) {
+  SHA256_Final(hash, sha256);
+}
+
+#pragma GCC diagnostic pop
+
 /**
  * set a block header to zero
  */
@@ -49,34 +76,143 @@ void get_header_hash(BlockHeader *header,
   uint8_t tmp[SHA256_DIGEST_LENGTH];                                   
  
   SHA256_CTX sha256;                                                          
-  SHA256_Init(&sha256);                                                       
-  SHA256_Update(&sha256, &header->version, 4);                                   
-  SHA256_Update(&sha256, header->hash_prev_block, HASH_LENGTH);                                   
-  SHA256_Update(&sha256, header->hash_merkle_root, HASH_LENGTH);                                   
-  SHA256_Update(&sha256, &header->time, 4);                                   
-  SHA256_Update(&sha256, &header->difficulty, 4);                                   
-  SHA256_Update(&sha256, &header->nonce, 4);                                   
-  SHA256_Final(tmp, &sha256); 
+  sha256_init(&sha256);                                                       
+  sha256_update(&sha256, &header->version, 4);                                   
+  sha256_update(&sha256, header->hash_prev_block, HASH_LENGTH);                                   
+  sha256_update(&sha256, header->hash_merkle_root, HASH_LENGTH);                                   
+  sha256_update(&sha256, &header->time, 4);                                   
+  sha256_update(&sha256, &header->difficulty, 4);                                   
+  sha256_update(&sha256, &header->nonce, 4);                                   
+  sha256_final(tmp, &sha256); 
  
   /* hash the result again */
-  SHA256_Init(&sha256);                                                       
-  SHA256_Update(&sha256, tmp, SHA256_DIGEST_LENGTH);  
-  SHA256_Final(hash, &sha256);
+  sha256_init(&sha256);                                                       
+  sha256_update(&sha256, tmp, SHA256_DIGEST_LENGTH);  
+  sha256_final(hash, &sha256);
 }
 
 /**
- * sets the time value for the given block header
- * (each thread gets a different time, so they
- *  don't use the same header hash for mining)
+ * byte length of the hashed part of the block header
+ * (version, hash_prev_block, hash_merkle_root, time, difficulty, nonce)
  */
-void header_set_time(BlockHeader *header, 
-                     uint32_t n_threads, 
-                     uint32_t cur_thread) {
+#define HASHED_HEADER_LENGTH 80
 
-  
-  header->time  = opts.time_offset;
-  header->time += ((time(NULL) + n_threads) / n_threads) * n_threads;
-  header->time += cur_thread;
+/**
+ * sha256 block size
+ */
+#define SHA256_BLOCK_LENGTH 64
+
+/**
+ * calculates the sha256 state after the first 64 byte block of the
+ * block header, this part doesn't contain the time and nonce values
+ * so the state can be reused for each header hash while mining
+ */
+void header_hash_midstate(BlockHeader *header, SHA256_CTX *midstate) {
+
+  sha256_init(midstate);
+  sha256_update(midstate, &header->version, SHA256_BLOCK_LENGTH);
+}
+
+/**
+ * Returns the Block Header sha256 hash using the precalculated midstate
+ */
+void get_header_hash_midstate(BlockHeader *header, 
+                              const SHA256_CTX *midstate,
+                              uint8_t hash[SHA256_DIGEST_LENGTH]) {
+
+  uint8_t tmp[SHA256_DIGEST_LENGTH];                                   
+
+  /* continue with the second block (merkle root end, time, bits, nonce) */
+  SHA256_CTX sha256 = *midstate;
+  sha256_update(&sha256, 
+                ((uint8_t *) &header->version) + SHA256_BLOCK_LENGTH, 
+                HASHED_HEADER_LENGTH - SHA256_BLOCK_LENGTH);
+  sha256_final(tmp, &sha256); 
+ 
+  /* hash the result again */
+  sha256_init(&sha256);                                                       
+  sha256_update(&sha256, tmp, SHA256_DIGEST_LENGTH);  
+  sha256_final(hash, &sha256);
+}
+
+/**
+ * returns hash % modulo, where hash is the 256 bit header hash
+ * (least significant byte first, like mpz_set_sha256 reads it)
+ *
+ * this avoids importing every mined hash into an mpz value
+ */
+static inline uint64_t hash_mod(const uint8_t hash[SHA256_DIGEST_LENGTH],
+                                const uint64_t modulo) {
+
+  unsigned __int128 reminder = 0;
+  uint64_t word;
+
+  int i;
+  for (i = SHA256_DIGEST_LENGTH - sizeof(uint64_t); i >= 0; i -= 8) {
+
+    memcpy(&word, hash + i, sizeof(uint64_t));
+    reminder = ((reminder << 64) | word) % modulo;
+  }
+
+  return (uint64_t) reminder;
+}
+
+/**
+ * sets the time and nonce of the given header to the start of the 
+ * partition of the given thread of this process
+ * (so no two threads mine the same header hash, see block.h)
+ */
+void header_set_partition(BlockHeader *header, 
+                          uint32_t n_threads, 
+                          uint32_t cur_thread) {
+
+  header_set_worker(header, 
+                    time(NULL) + opts.time_offset,
+                    opts.host_index,
+                    opts.process_index,
+                    n_threads,
+                    cur_thread);
+}
+
+/**
+ * moves the header time forward to the clock, if it passed it
+ * (called every round, so the header time doesn't fall behind)
+ */
+void header_rebase_partition(BlockHeader *header, uint32_t n_threads) {
+
+  header_rebase_time(header, 
+                     time(NULL) + opts.time_offset, 
+                     partition_stride(n_threads));
+}
+
+/**
+ * returns whether the header time is more than MAX_HEADER_DRIFT 
+ * seconds ahead of the clock (the pool would reject the shares)
+ */
+static inline char header_too_far_ahead(BlockHeader *header) {
+  return header->time > time(NULL) + opts.time_offset + MAX_HEADER_DRIFT;
+}
+
+/**
+ * waits while the header time is more than MAX_HEADER_DRIFT seconds 
+ * ahead of the clock (must not hold the round lock, or a pending 
+ * config reload would block all other threads meanwhile)
+ * returns 0 if the sieve got inactive meanwhile
+ */
+char wait_for_header_time(Sieve *sieve) {
+
+  if (!header_too_far_ahead(&sieve->header))
+    return 1;
+
+  error_msg("[EE] header time %" PRIu32 " seconds ahead, pausing "
+            "(lower --num-threads, --processes, --hosts or "
+            "--primes-in-hash)\n",
+            sieve->header.time - (uint32_t) (time(NULL) + opts.time_offset));
+
+  while (sieve_active(sieve) && header_too_far_ahead(&sieve->header))
+    usleep(100000);
+
+  return sieve_active(sieve);
 }
 
 /**
@@ -88,34 +224,115 @@ void header_set_time(BlockHeader *header,
  * (searching for a specific sha256 hash)
  * on the other side a highly composite hash improves
  * searching for prime chains
+ *
+ * returns 0 if the search was stopped (new work, shutdown or
+ * the thread got parked), so the caller has to skip the round
  */
-void mine_header_hash(Sieve *sieve, uint32_t n_threads) {
+char mine_header_hash(Sieve *sieve, uint32_t n_threads) {
 
   uint8_t hash[SHA256_DIGEST_LENGTH];
-  uint_fast8_t reminder = 1;
+  uint64_t hashes     = 0;
+  uint64_t start_time = gettime_usec();
+  uint64_t cycles     = hist_cycles();
+  char divisible      = 0;
+  uint32_t stride     = partition_stride(n_threads);
+
+  const uint64_t *const hash_primorials = opts.hash_primorials;
+  const uint32_t n_hash_primorials      = opts.n_hash_primorials;
 
   /* mine for a hash */
   do {
 
-    /* all nonce values used ? */
-    if (sieve->header.nonce == UINT32_MAX) {
+    /* change the hash (a new time must not be too far ahead) */
+    if (header_next_nonce(&sieve->header, stride) && 
+        header_too_far_ahead(&sieve->header))
+      break;
 
-      /* adjust time */
-      sieve->header.time += n_threads;
-    }
-    
-    /* change the hash */
-    sieve->header.nonce++;
+    hashes++;
 
-    get_header_hash(&sieve->header, hash);
+    get_header_hash_midstate(&sieve->header, &sieve->midstate, hash);
     
-    /* skip check if hash is smaller than 2^255 */
-    if (hash[SHA256_DIGEST_LENGTH - 1] & 0x80) {
+    /**
+     * skip check if hash is smaller than 2^255 or odd
+     * (2 is always part of the hash primorial)
+     */
+    if ((hash[SHA256_DIGEST_LENGTH - 1] & 0x80) && !(hash[0] & 1)) {
 
-      mpz_set_sha256(sieve->mpz_hash, hash);
- 
-      /* reminder = hash % hash_primorial */
-      reminder = mpz_tdiv_ui(sieve->mpz_hash, opts.hash_primorial);
+      /* check hash % hash_primorial == 0, one 64 bit factor at a time */
+      uint32_t i;
+      for (i = 0, divisible = 1; divisible && i < n_hash_primorials; i++)
+        divisible = (hash_mod(hash, hash_primorials[i]) == 0);
     }
-  } while (running && reminder);
+  } while (sieve_active(sieve) && !divisible);
+
+  stats_add(sieve->stats.hashes,    hashes);
+  stats_add(sieve->stats.hash_time, gettime_usec() - start_time);
+  hist_record(&sieve->hist[HIST_HASH], hist_cycles() - cycles);
+
+  if (!divisible)
+    return 0;
+
+  mpz_set_sha256(sieve->mpz_hash, hash);
+  return 1;
+}
+
+/**
+ * returns the difficulty (chain length and fractional length) of the
+ * given share for the given chain type (0 if the origin is no chain)
+ */
+uint32_t get_share_difficulty(BlockHeader *share, 
+                              char type, 
+                              TestParams *params) {
+
+  uint8_t hash[SHA256_DIGEST_LENGTH];
+  get_header_hash(share, hash);
+
+  /* the share could come from anywhere (hash has to be >= 2^255) */
+  if (share->multiplier_length > MULTIPLIER_LENGTH ||
+      !(hash[SHA256_DIGEST_LENGTH - 1] & 0x80))
+    return 0;
+
+  mpz_t mpz_multiplier, mpz_origin, mpz_hash;
+
+  mpz_init(mpz_multiplier);
+  mpz_init(mpz_origin);
+  mpz_init(mpz_hash);
+
+  mpz_set_sha256(mpz_hash, hash);
+
+  mpz_import(mpz_multiplier, 
+             share->multiplier_length, 
+             -1, 
+             sizeof(share->primemultiplier[0]), 
+             -1, 
+             0, 
+             share->primemultiplier);
+
+  /* prime origin = hash * multiplier */
+  mpz_mul(mpz_origin, mpz_hash, mpz_multiplier);
+
+  uint32_t chain_length;
+ 
+  if (type == BI_TWIN_CHAIN)
+    chain_length = twn_chain_test(mpz_origin, params);
+  else if (type == FIRST_CUNNINGHAM_CHAIN)
+    chain_length = cc1_chain_test(mpz_origin, params);
+  else
+    chain_length = cc2_chain_test(mpz_origin, params);
+
+  uint32_t difficulty = 0;
+
+  if (chain_length > 0) {
+    difficulty  = chain_length << FRACTIONAL_BITS;
+    difficulty += get_fractional_length(mpz_origin,
+                                        type,
+                                        chain_length,
+                                        params);
+  }
+
+  mpz_clear(mpz_multiplier);
+  mpz_clear(mpz_origin);
+  mpz_clear(mpz_hash);
+
+  return difficulty;
 }
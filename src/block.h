@@ -79,6 +79,20 @@ void header_set_null(BlockHeader *header);
  */
 void get_header_hash(BlockHeader *header, uint8_t hash[SHA256_DIGEST_LENGTH]);
 
+/**
+ * calculates the sha256 state after the first 64 byte block of the
+ * block header, this part doesn't contain the time and nonce values
+ * so the state can be reused for each header hash while mining
+ */
+void header_hash_midstate(BlockHeader *header, SHA256_CTX *midstate);
+
+/**
+ * Returns the Block Header sha256 hash using the precalculated midstate
+ */
+void get_header_hash_midstate(BlockHeader *header, 
+                              const SHA256_CTX *midstate,
+                              uint8_t hash[SHA256_DIGEST_LENGTH]);
+
 /**
  * converts an sha256 hast to an mpz value
  * 
@@ -97,11 +111,125 @@ void get_header_hash(BlockHeader *header, uint8_t hash[SHA256_DIGEST_LENGTH]);
 
 
 /**
- * sets the time value for the given block header
+ * The header space (time and nonce) is partitioned, so that all threads
+ * of all processes on all hosts mining for the same work search
+ * different headers:
+ *
+ *   nonce = --host-index << (32 - host bits) | counter
+ *   time  = k * stride + --process-index * threads + thread
+ *
+ * with stride = --processes * threads and host bits = log2(--hosts)
+ * (rounded up). Hosts differ in the nonce, the threads of a host in
+ * the time modulo stride, which a thread keeps when its counter is
+ * used up (time += stride), or when its time gets rebased to the clock
+ * every round. So the partitions are disjoint no matter when the
+ * threads (re)start, as long as every host has its own --host-index,
+ * and its processes the same --num-threads.
+ *
+ * A round needs about twice the hash primorial of hashes (4.5e8 at
+ * 9 --primes-in-hash), so the more hosts share the nonce, the more 
+ * often the time moves on within a round (see check_partition).
+ */
+#define MAX_HOSTS (1U << 16)
+
+/**
+ * returns the width and the mask of the nonce counter
+ */
+#define nonce_counter_bits() (32 - opts.host_bits)
+#define nonce_counter_mask() \
+  ((uint32_t) ((UINT64_C(1) << nonce_counter_bits()) - 1))
+
+/**
+ * the header time must stay valid (less than 2 hours in the future),
+ * a thread starts at most stride - 1 seconds ahead of the clock, and 
+ * pauses between two rounds while it is more than MAX_HEADER_DRIFT 
+ * seconds ahead
  */
-void header_set_time(BlockHeader *header, 
-                     uint32_t n_threads, 
-                     uint32_t cur_thread);
+#define MAX_PARTITION_STRIDE 1800
+#define MAX_HEADER_DRIFT     3600
+
+/**
+ * returns the time stride of the header partitions
+ */
+#define partition_stride(n_threads) (opts.processes * (n_threads))
+
+/**
+ * returns the first time not before now with the given slot
+ * (time modulo stride)
+ */
+static inline uint32_t partition_time(uint32_t now, 
+                                      uint32_t slot, 
+                                      uint32_t stride) {
+
+  return now + (stride + slot - now % stride) % stride;
+}
+
+/**
+ * sets the time and nonce of the given header to the start of the
+ * partition of the given worker
+ */
+static inline void header_set_worker(BlockHeader *header,
+                                     uint32_t now,
+                                     uint32_t host_index,
+                                     uint32_t process_index,
+                                     uint32_t n_threads,
+                                     uint32_t cur_thread) {
+
+  uint32_t stride = opts.processes * n_threads;
+  uint32_t slot   = process_index * n_threads + cur_thread;
+
+  header->time  = partition_time(now, slot, stride);
+  header->nonce = (uint32_t) ((uint64_t) host_index << nonce_counter_bits());
+}
+
+/**
+ * moves the header time of a partition forward to the clock (now),
+ * with a new counter, if the clock passed it
+ */
+static inline void header_rebase_time(BlockHeader *header, 
+                                      uint32_t now,
+                                      uint32_t stride) {
+
+  uint32_t time = partition_time(now, header->time % stride, stride);
+
+  if (time > header->time) {
+    header->time   = time;
+    header->nonce &= ~nonce_counter_mask();
+  }
+}
+
+/**
+ * moves on to the next header of the partition
+ * returns 1 if the counter was used up and the time moved on
+ */
+static inline char header_next_nonce(BlockHeader *header, uint32_t stride) {
+
+  /* counter used up: continue at the next time of the partition */
+  const uint32_t mask = nonce_counter_mask();
+
+  if ((header->nonce & mask) == mask) {
+    header->time  += stride;
+    header->nonce &= ~mask;
+    return 1;
+  }
+
+  header->nonce++;
+  return 0;
+}
+
+/**
+ * sets the time and nonce of the given header to the start of the 
+ * partition of the given thread of this process
+ */
+void header_set_partition(BlockHeader *header, 
+                          uint32_t n_threads, 
+                          uint32_t cur_thread);
+
+/**
+ * moves the header time forward to the clock, if it passed it
+ * (called every round, so the header time doesn't fall behind)
+ */
+void header_rebase_partition(BlockHeader *header, uint32_t n_threads);
 
 /**
  * modify the block header (by increasing the nonce value) 
@@ -112,8 +240,28 @@ void header_set_time(BlockHeader *header,
  * (searching for a specific sha256 hash)
  * on the other side a highly composite hash improves
  * searching for prime chains
+ *
+ * returns 0 if the search was stopped (new work, shutdown, the
+ * thread got parked or the header time got too far ahead), so the
+ * caller has to skip the round
+ */
+char mine_header_hash(Sieve *sieve, uint32_t n_threads);
+
+/**
+ * waits while the header time is more than MAX_HEADER_DRIFT seconds 
+ * ahead of the clock (must not hold the round lock)
+ * returns 0 if the sieve got inactive meanwhile
+ */
+char wait_for_header_time(Sieve *sieve);
+
+/**
+ * returns the difficulty (chain length and fractional length) of the
+ * given share for the given chain type (0 if the origin is no chain)
+ * (used to verify shares)
  */
-void mine_header_hash(Sieve *sieve, uint32_t n_threads);
+uint32_t get_share_difficulty(BlockHeader *share, 
+                              char type, 
+                              TestParams *params);
  
 
 
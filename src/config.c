@@ -0,0 +1,255 @@
+/**
+ * Implementation of reloading the sieve options while mining.
+ *
+ * The miners hold a read lock on the sieve options for each round,
+ * a reload takes the write lock, so the sieve globals and the prime
+ * table are only rebuild between two rounds. Afterwards each miner
+ * reallocates its sieve when it notices the new config epoch. The
+ * pool connection is not affected.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "main.h"
+
+/**
+ * the reloadable sieve options
+ */
+typedef struct {
+  uint32_t sieve_primes;
+  uint32_t sieve_extensions;
+  uint32_t sieve_size;
+  uint32_t cache_bits;
+  uint32_t pool_share;
+} SieveConfig;
+
+/**
+ * protects the sieve options (miners read, reload writes)
+ */
+static pthread_rwlock_t config_lock;
+
+/**
+ * current config epoch
+ */
+static uint32_t epoch = 0;
+
+/**
+ * modification time of the last loaded --config file
+ */
+static struct timespec config_mtime;
+
+/**
+ * the options of the last loaded --config file
+ */
+static SieveConfig loaded;
+
+/**
+ * set by request_config_reload
+ */
+static volatile sig_atomic_t reload_requested = 0;
+
+/**
+ * initializes the config reloading
+ * (must be called before the miners start)
+ */
+void init_config() {
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+
+  /* otherwise the miners could delay a reload forever */
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+  pthread_rwlock_init(&config_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  /* the command line options are the current config */
+  loaded.sieve_primes     = opts.sieve_primes;
+  loaded.sieve_extensions = opts.sieve_extensions;
+  loaded.sieve_size       = opts.sieve_size;
+  loaded.cache_bits       = opts.cache_bits;
+  loaded.pool_share       = opts.pool_share;
+}
+
+/**
+ * returns the current config epoch
+ * (incremented each time the sieve options changed)
+ */
+uint32_t config_epoch() {
+  return __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * the miners hold the sieve options while running one round
+ * (a reload waits until all rounds in progress are finished)
+ */
+void config_lock_round() {
+
+  if (opts.config_file != NULL)
+    pthread_rwlock_rdlock(&config_lock);
+}
+
+void config_unlock_round() {
+
+  if (opts.config_file != NULL)
+    pthread_rwlock_unlock(&config_lock);
+}
+
+/**
+ * forces a reload with the next check
+ * (async signal safe)
+ */
+void request_config_reload() {
+  reload_requested = 1;
+}
+
+/**
+ * parses the --config file into config
+ * (options not in the file keep their value)
+ * returns 0 on failure
+ */
+static char parse_config(SieveConfig *config) {
+
+  FILE *file = fopen(opts.config_file, "r");
+
+  if (file == NULL) {
+    errno_msg("failed to open config file");
+    return 0;
+  }
+
+  char line[256];
+  uint32_t line_nr = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+
+    line_nr++;
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    char *name  = strtok(line, " \t=\r\n");
+    char *value = strtok(NULL, " \t=\r\n");
+
+    if (name == NULL)
+      continue;
+
+    /* the command line spelling is fine too */
+    while (*name == '-')
+      name++;
+
+    int32_t number = (value != NULL) ? atoi(value) : 0;
+
+    uint32_t *option =
+      !strcmp(name, "sieve-primes")     ? &config->sieve_primes     :
+      !strcmp(name, "sieve-extensions") ? &config->sieve_extensions :
+      !strcmp(name, "sieve-size")       ? &config->sieve_size       :
+      !strcmp(name, "cache-bits")       ? &config->cache_bits       :
+      !strcmp(name, "pool-share")       ? &config->pool_share       : NULL;
+
+    if (option == NULL || number <= 0) {
+      error_msg("[EE] %s:%" PRIu32 ": ignoring invalid option %s\n",
+                opts.config_file,
+                line_nr,
+                name);
+      continue;
+    }
+
+    *option = number;
+  }
+
+  fclose(file);
+  return 1;
+}
+
+/**
+ * rebuilds all sieve parameters with the given options
+ * (waits for all rounds in progress)
+ */
+static void apply_config(SieveConfig *config) {
+
+  pthread_rwlock_wrlock(&config_lock);
+
+  free_sieve_parameters();
+
+  opts.sieve_primes     = config->sieve_primes;
+  opts.sieve_extensions = config->sieve_extensions;
+  opts.sieve_size       = config->sieve_size;
+  opts.cache_bits       = config->cache_bits;
+  opts.pool_share       = config->pool_share;
+
+  init_sieve_parameters();
+
+  /* the miners reallocate their sieves with the next round */
+  __atomic_add_fetch(&epoch, 1, __ATOMIC_RELEASE);
+
+  pthread_rwlock_unlock(&config_lock);
+
+  if (!opts.quiet)
+    info_msg("reloaded %s: sieve-primes %" PRIu32 " sieve-extensions %"
+             PRIu32 " sieve-size %" PRIu32 " cache-bits %" PRIu32
+             " pool-share %" PRIu32 "\n",
+             opts.config_file,
+             opts.sieve_primes,
+             opts.sieve_extensions,
+             opts.sieve_size,
+             opts.cache_bits,
+             opts.pool_share);
+}
+
+/**
+ * reloads the --config file if it changed (or a reload was requested)
+ * and applies the new sieve options between two rounds
+ */
+void check_config() {
+
+  struct stat st;
+
+  if (stat(opts.config_file, &st) < 0) {
+
+    if (reload_requested)
+      errno_msg("failed to reload config file");
+
+    reload_requested = 0;
+    return;
+  }
+
+  if (st.st_mtim.tv_sec  == config_mtime.tv_sec  &&
+      st.st_mtim.tv_nsec == config_mtime.tv_nsec && 
+      !reload_requested)
+    return;
+
+  config_mtime     = st.st_mtim;
+  reload_requested = 0;
+
+  SieveConfig config = loaded;
+
+  if (!parse_config(&config) ||
+      memcmp(&config, &loaded, sizeof(SieveConfig)) == 0)
+    return;
+
+  loaded = config;
+  apply_config(&config);
+}
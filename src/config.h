@@ -0,0 +1,73 @@
+/**
+ * Header file for reloading the sieve options while mining.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * seconds between two checks of the --config file
+ */
+#define CONFIG_POLL_INTERVAL 1
+
+/**
+ * The --config file contains one option per line, like:
+ *
+ *   # comment
+ *   sieve-primes 30000
+ *   sieve-size = 6000000
+ *
+ * reloadable are: sieve-primes, sieve-extensions, sieve-size,
+ * cache-bits and pool-share
+ */
+
+/**
+ * initializes the config reloading
+ * (must be called before the miners start)
+ */
+void init_config();
+
+/**
+ * returns the current config epoch
+ * (incremented each time the sieve options changed)
+ */
+uint32_t config_epoch();
+
+/**
+ * the miners hold the sieve options while running one round
+ * (a reload waits until all rounds in progress are finished)
+ */
+void config_lock_round();
+void config_unlock_round();
+
+/**
+ * forces a reload with the next check
+ * (async signal safe)
+ */
+void request_config_reload();
+
+/**
+ * reloads the --config file if it changed (or a reload was requested)
+ * and applies the new sieve options between two rounds
+ */
+void check_config();
+
+#endif /* __CONFIG_H__ */
@@ -0,0 +1,109 @@
+/**
+ * Implementation of the runtime cpu feature detection.
+ *
+ * The binary is build for plain x86-64, the hot kernels are additionally
+ * compiled for the higher instruction set levels (see sieve-kernels.h),
+ * and the best supported variants are selected at startup.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <inttypes.h>
+#include <string.h>
+
+#include "main.h"
+
+/**
+ * the names of the levels (as used by --cpu-features)
+ */
+static const char *level_names[CPU_LEVELS] = { "baseline", "avx2", "avx512" };
+
+/**
+ * returns the highest level supported by this cpu
+ */
+uint32_t cpu_detect_level() {
+
+#if CPU_DISPATCH
+  __builtin_cpu_init();
+
+  /* also checks that the os saves the extended registers */
+  if (__builtin_cpu_supports("avx512f")  &&
+      __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vl"))
+    return CPU_AVX512;
+
+  if (__builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("bmi2"))
+    return CPU_AVX2;
+#endif
+
+  return CPU_BASELINE;
+}
+
+/**
+ * returns the name of the given level
+ */
+const char *cpu_level_name(uint32_t level) {
+
+  if (level >= CPU_LEVELS)
+    return "auto";
+
+  return level_names[level];
+}
+
+/**
+ * parses a --cpu-features name (auto, baseline, avx2, avx512)
+ * returns 0 for unknown names
+ */
+char cpu_parse_level(const char *name, uint32_t *level) {
+
+  if (!strcmp(name, "auto")) {
+    *level = CPU_AUTO;
+    return 1;
+  }
+
+  uint32_t i;
+  for (i = 0; i < CPU_LEVELS; i++) {
+    if (!strcmp(name, level_names[i])) {
+      *level = i;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * returns the level to use for the given --cpu-features
+ * (unsupported levels are lowered to the highest supported one)
+ */
+uint32_t cpu_select_level(uint32_t requested) {
+
+  uint32_t detected = cpu_detect_level();
+
+  if (requested == CPU_AUTO)
+    return detected;
+
+  /* the variant would crash with an illegal instruction */
+  if (requested > detected) {
+    error_msg("[EE] this cpu does not support %s, using %s\n",
+              cpu_level_name(requested),
+              cpu_level_name(detected));
+
+    return detected;
+  }
+
+  return requested;
+}
@@ -0,0 +1,76 @@
+/**
+ * Header file of the runtime cpu feature detection, which selects
+ * the instruction set variants of the hot kernels at startup.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * the instruction set levels the kernels are compiled for
+ * (each level includes all lower ones)
+ *
+ * baseline: plain x86-64 (SSE2), the only level on other architectures
+ * avx2:     AVX2 and BMI2 (Haswell and newer)
+ * avx512:   AVX-512 F, BW, VL (Skylake-X and newer)
+ */
+#define CPU_BASELINE 0
+#define CPU_AVX2     1
+#define CPU_AVX512   2
+#define CPU_LEVELS   3
+
+/**
+ * --cpu-features auto (use the highest supported level)
+ */
+#define CPU_AUTO UINT32_MAX
+
+/**
+ * whether the kernels are compiled for the higher levels
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_DISPATCH 1
+#else
+#define CPU_DISPATCH 0
+#endif
+
+/**
+ * returns the highest level supported by this cpu
+ */
+uint32_t cpu_detect_level();
+
+/**
+ * returns the name of the given level
+ */
+const char *cpu_level_name(uint32_t level);
+
+/**
+ * parses a --cpu-features name (auto, baseline, avx2, avx512)
+ * returns 0 for unknown names
+ */
+char cpu_parse_level(const char *name, uint32_t *level);
+
+/**
+ * returns the level to use for the given --cpu-features
+ * (unsupported levels are lowered to the highest supported one)
+ */
+uint32_t cpu_select_level(uint32_t requested);
+
+#endif /* __CPU_H__ */
@@ -0,0 +1,122 @@
+/**
+ * Implementation of the per thread latency histograms of the mining stages.
+ *
+ * Recording costs one rdtsc pair and a relaxed increment, so the
+ * histograms are always on, the stats thread merges the threads
+ * histograms and converts the cycles to microseconds.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "main.h"
+
+/**
+ * time to measure the cycle counter frequency
+ */
+#define CALIBRATION_USEC 10000
+
+/**
+ * cycles per microsecond (0 = not calibrated)
+ */
+static double cycles_per_usec = 0;
+
+/**
+ * calibrates the cycle counter
+ * (only the first call takes some milliseconds)
+ */
+void init_histograms() {
+
+  if (cycles_per_usec > 0)
+    return;
+
+  uint64_t start_time   = gettime_usec();
+  uint64_t start_cycles = hist_cycles();
+
+  usleep(CALIBRATION_USEC);
+
+  uint64_t usec   = gettime_usec() - start_time;
+  uint64_t cycles = hist_cycles() - start_cycles;
+
+  cycles_per_usec = (usec > 0 && cycles > 0) ? cycles / (double) usec : 1000;
+}
+
+/**
+ * adds the counts of a (running) thread to dst
+ */
+void hist_merge(Histogram *dst, const Histogram *src) {
+
+  uint32_t i;
+  for (i = 0; i < HIST_BUCKETS; i++)
+    dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * returns the number of counted values
+ */
+uint64_t hist_count(const Histogram *hist) {
+
+  uint64_t count = 0;
+  uint32_t i;
+
+  for (i = 0; i < HIST_BUCKETS; i++)
+    count += hist->counts[i];
+
+  return count;
+}
+
+/**
+ * returns the middle of the given bucket in cycles
+ */
+static double bucket_value(uint32_t bucket) {
+
+  if (bucket < 2 * HIST_SUB_BUCKETS)
+    return bucket;
+
+  uint32_t shift    = bucket / HIST_SUB_BUCKETS - 1;
+  uint64_t mantissa = bucket % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+
+  return (mantissa << shift) + ((1LU << shift) - 1) / 2.0;
+}
+
+/**
+ * returns the value below which the given percentage of the counted
+ * values are, in microseconds (0 if nothing was counted)
+ */
+double hist_percentile(const Histogram *hist, double percentile) {
+
+  uint64_t count = hist_count(hist);
+  if (count == 0)
+    return 0;
+
+  /* rank of the wanted value (1 based) */
+  uint64_t rank = (uint64_t) (count * percentile / 100.0 + 0.5);
+  if (rank == 0)     rank = 1;
+  if (rank > count)  rank = count;
+
+  uint64_t seen = 0;
+  uint32_t i;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+
+    if (seen >= rank)
+      break;
+  }
+
+  return bucket_value(i) / cycles_per_usec;
+}
@@ -0,0 +1,132 @@
+/**
+ * Header file of the per thread latency histograms of the mining stages.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <inttypes.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "main.h"
+
+/**
+ * The histograms count cycles in log-linear buckets (like HdrHistogram):
+ * values below 2 * HIST_SUB_BUCKETS get one bucket each, above that
+ * each power of two is split into HIST_SUB_BUCKETS buckets, so the
+ * relative error is at most 1 / HIST_SUB_BUCKETS (6.25%) over the
+ * whole 64 bit range.
+ */
+#define HIST_SUB_BITS    4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS     ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/**
+ * the recorded stages
+ */
+#define HIST_HASH         0 /* mine_header_hash                          */
+#define HIST_MULTIPLIERS  1 /* calc_multipliers                          */
+#define HIST_SEGMENT      2 /* all layers of one cache-bits segment      */
+#define HIST_EXTRACT      3 /* creating the final sets of candidates     */
+#define HIST_TEST_CC1     4 /* chain test of one cc1 candidate           */
+#define HIST_TEST_CC2     5 /* chain test of one cc2 candidate           */
+#define HIST_TEST_TWN     6 /* chain test of one bi-twin candidate       */
+#define HIST_SUBMIT       7 /* handing a share to the network thread     */
+#define HIST_EXTENSION    8 /* + n: chain test of one extension n test   */
+
+/**
+ * extensions above get counted as the last one
+ */
+#define HIST_EXTENSIONS  16
+
+#define HIST_STAGES      (HIST_EXTENSION + HIST_EXTENSIONS)
+
+/**
+ * a latency histogram
+ * (only written by the owning thread, see hist_record())
+ */
+struct Histogram {
+  uint64_t counts[HIST_BUCKETS];
+};
+
+/**
+ * returns the current cycle count
+ * (nanoseconds on non x86 platforms)
+ */
+static inline uint64_t hist_cycles() {
+
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000LU + time.tv_nsec;
+#endif
+}
+
+/**
+ * returns the bucket of the given value
+ */
+static inline uint32_t hist_bucket(uint64_t value) {
+
+  if (value < 2 * HIST_SUB_BUCKETS)
+    return (uint32_t) value;
+
+  /* value = mantissa << shift with HIST_SUB_BITS + 1 mantissa bits */
+  uint32_t shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+
+  return shift * HIST_SUB_BUCKETS + (uint32_t) (value >> shift);
+}
+
+/**
+ * counts one value (single writer, relaxed like stats_add)
+ */
+static inline void hist_record(Histogram *hist, uint64_t cycles) {
+
+  uint64_t *count = &hist->counts[hist_bucket(cycles)];
+  __atomic_store_n(count,
+                   __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+/**
+ * calibrates the cycle counter
+ * (only the first call takes some milliseconds)
+ */
+void init_histograms();
+
+/**
+ * adds the counts of a (running) thread to dst
+ */
+void hist_merge(Histogram *dst, const Histogram *src);
+
+/**
+ * returns the number of counted values
+ */
+uint64_t hist_count(const Histogram *hist);
+
+/**
+ * returns the value below which the given percentage of the counted
+ * values are, in microseconds (0 if nothing was counted)
+ */
+double hist_percentile(const Histogram *hist, double percentile);
+
+#endif /* __HISTOGRAM_H__ */
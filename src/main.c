@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
 
 #define __USE_GNU
 #include <pthread.h>
@@ -31,6 +32,31 @@
 #include "main.h"
 #undef EXTERN
 
+/**
+ * to wake up the stats thread on shutdown
+ */
+static pthread_mutex_t shutdown_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  shutdown_cond  = PTHREAD_COND_INITIALIZER;
+
+/**
+ * sleeps the given number of seconds or until shutdown
+ */
+static void sleep_until_shutdown(uint32_t seconds) {
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += seconds;
+
+  pthread_mutex_lock(&shutdown_mutex);
+
+  while (running && 
+         pthread_cond_timedwait(&shutdown_cond, 
+                                &shutdown_mutex, 
+                                &deadline) == 0);
+
+  pthread_mutex_unlock(&shutdown_mutex);
+}
+
 /**
  * thread to output status informations
  */
@@ -40,21 +66,60 @@ void *stats_thread(void *thread_args) {
   uint64_t n_threads = stats[0].n_threads;
 
   /* wait until mining started */
-  uint64_t i;
-  for (i = 0; i < n_threads; i++) 
-    while (running && stats[i].mine != MINING_STARTED)
-      pthread_yield();
+  wait_for_work();
 
   /* loop until shutdown */
   while (running) {
 
-    sleep(opts.stats_interval);
-    print_stats(stats, n_threads);
+    sleep_until_shutdown(opts.stats_interval);
+    print_stats(n_threads);
   }
 
   return NULL;
 }
 
+/**
+ * thread to reload the --config file
+ */
+void *config_thread(void *thread_args) {
+
+  (void) thread_args;
+
+  while (running) {
+    check_config();
+    sleep_until_shutdown(CONFIG_POLL_INTERVAL);
+  }
+
+  return NULL;
+}
+
+/**
+ * thread to answer metric requests
+ */
+void *metrics_thread(void *thread_args) {
+
+  MinerArgs *args    = (MinerArgs *) thread_args;
+  uint32_t n_threads = args[0].n_threads;
+
+  while (running)
+    serve_metrics(n_threads, METRICS_POLL_INTERVAL);
+
+  return NULL;
+}
+
+/**
+ * thread to park and unpark the miners (--background, --cpu-budget)
+ */
+void *throttle_thread(void *thread_args) {
+
+  (void) thread_args;
+
+  while (running)
+    update_throttle(THROTTLE_INTERVAL);
+
+  return NULL;
+}
+
 /**
  * the actual Primecoin miner which starts the sieve and so on
  */
@@ -71,48 +136,97 @@ void *primcoin_miner(void *thread_args) {
 
   /* initialize the sieve */
   init_sieve(sieve);
+  sieve->group = stats_group(id);
+  sieve->id    = id;
 
-  /* waiting to get started */
-  while (running && args->mine == MINING_WAIT)
-    pthread_yield();
-
-  args->mine = MINING_STARTED;
+  /* leave the cpu to everything else */
+  if (opts.background)
+    background_priority();
 
   /* start mining */
   while (running) {
 
-    /* reset nonce if new work arrived */
-    if (args->new_work) {
+    /* give the core back until the load allows it again */
+    if (thread_throttled(id)) {
+
+      if (opts.verbose)
+        info_msg("[Thread-%" PRIu32 "] throttled, parking\n", id);
+
+      args->mine = MINING_PARKED;
+      wait_while_throttled(id);
+      args->mine = MINING_STARTED;
+      continue;
+    }
+
+    /* reset nonce if new work arrived (epoch 0: no work yet) */
+    if (sieve->epoch == 0 || sieve->epoch != work_epoch()) {
+
+      BlockHeader header;
+      uint64_t published;
+      uint32_t epoch;
 
-      pthread_mutex_lock(&args->mutex); 
+      /* park until there is valid work */
+      while (running && (epoch = read_work(&header, &published)) == 0) {
+        
+        if (opts.verbose && args->mine == MINING_STARTED)
+          info_msg("[Thread-%" PRIu32 "] no valid work, parking\n", args->id);
+
+        args->mine = MINING_PARKED;
+        wait_for_work();
+      }
+
+      if (!running) break;
+
+      sieve->epoch = epoch;
+      args->mine   = MINING_STARTED;
+
+      /* work switch latency */
+      uint64_t latency = gettime_usec() - published;
+      stats_add(sieve->stats.work_switches, 1);
+      stats_add(sieve->stats.switch_time, latency);
+      if (latency > sieve->stats.switch_time_max)
+        stats_set(sieve->stats.switch_time_max, latency);
 
       if (opts.verbose)
         info_msg("[Thread-%" PRIu32 "] got new work\n", args->id);
 
-      args->new_work = 0;
-
       /* reinit sieve */
-      sieve_set_header(sieve, opts.header);
+      sieve_set_header(sieve, &header);
 
-      pthread_mutex_unlock(&args->mutex);
+      /* init time (server - client offset) and nonce of this thread */
+      header_set_partition(&sieve->header, n_threads, id);
+    }
 
-      /* init time (server - client offset)*/
-      header_set_time(&sieve->header, n_threads, id);
+    /* outside of the round lock, the pause can take a while */
+    if (!wait_for_header_time(sieve))
+      continue;
 
-      /* set nonce to zero */
-      sieve->header.nonce = 0;
+    /* the sieve options can only change between two rounds */
+    config_lock_round();
+
+    if (args->config_epoch != config_epoch()) {
+      args->config_epoch = config_epoch();
+      realloc_sieve(sieve);
     }
 
     reinit_sieve(sieve);
 
+    /* the header time follows the clock (see block.h) */
+    header_rebase_partition(&sieve->header, n_threads);
+
     /* generate a hash divisible by the hash primorial */
-    mine_header_hash(sieve, args->n_threads);
+    if (!mine_header_hash(sieve, args->n_threads)) {
+      config_unlock_round();
+      continue;
+    }
 
     /* calculate the primorial for sieving */
     mpz_mul(mpz_primorial, sieve->mpz_hash, opts.mpz_fixed_hash_multiplier);
 
     /* run the sieve and check the candidates */
     sieve_run(sieve, mpz_primorial);
+
+    config_unlock_round();
   }
 
   args->mine = MINING_STOPPED;
@@ -129,32 +243,62 @@ void *primcoin_miner(void *thread_args) {
  */
 void main_thread(MinerArgs *args) {
  
-  pthread_t stats;
+  pthread_t stats, config, metrics, throttle;
   pthread_t *threads = malloc(opts.num_threads * sizeof(pthread_t));
 
   char args_given = (args != NULL);
 
-  if (args == NULL)
-    args = (MinerArgs *) malloc(opts.num_threads * sizeof(MinerArgs));
+  /* cache line aligned, so that the threads stats don't share lines */
+  if (args == NULL && 
+      posix_memalign((void **) &args, 
+                     CACHE_LINE_SIZE, 
+                     opts.num_threads * sizeof(MinerArgs)) != 0) {
+
+    error_msg("[EE] failed to allocate miner args\n");
+    exit(EXIT_FAILURE);
+  }
 
   memset(args, 0, opts.num_threads * sizeof(MinerArgs));
 
-  int i;
+  /* check the header space partitions if DEBUG is enabled */
+  check_partition(opts.num_threads);
+
+  /* check the extension pruning if DEBUG is enabled */
+  check_prune();
+
+  init_config();
+  init_stats_groups(opts.num_threads);
+
+  if (opts.cpu_budget > 0)
+    init_throttle(opts.num_threads);
+
+  uint32_t i;
 
   /* init thread specific part of the args */
   for (i = 0; i < opts.num_threads; i++) {
     args[i].mine      = MINING_WAIT;
     args[i].n_threads = opts.num_threads;
     args[i].id        = i;
-    args[i].new_work  = 1;
 
-    pthread_mutex_init(&args[i].mutex, NULL);
     pthread_create(&threads[i], NULL, primcoin_miner, (void *) &args[i]);
   }
 
   if (!opts.quiet) 
     pthread_create(&stats, NULL, stats_thread, (void *) args);
 
+  if (opts.config_file != NULL)
+    pthread_create(&config, NULL, config_thread, NULL);
+
+  /* mining continues without metrics if the port is in use */
+  char metrics_started = (opts.metrics_port != 0 && 
+                          init_metrics(opts.metrics_port) == 0);
+
+  if (metrics_started)
+    pthread_create(&metrics, NULL, metrics_thread, (void *) args);
+
+  if (opts.cpu_budget > 0)
+    pthread_create(&throttle, NULL, throttle_thread, NULL);
+
   /* connect to pool */
   connect_to_pool();
 
@@ -162,23 +306,10 @@ void main_thread(MinerArgs *args) {
   while (running) {
     
     /* wait for work from pool */
-    switch (recv_work(args)) {
+    switch (recv_work()) {
       
+      /* the miners notice the new work epoch by themselves */
       case WORK_MSG: 
-        for (i = 0; i < opts.num_threads; i++) {
-
-          pthread_mutex_lock(&args[i].mutex);
-
-          args[i].new_work = 1;
-          args[i].sieve.active = 0;
-          
-          if (args[i].mine == MINING_WAIT)
-            args[i].mine = MINING_START;
-
-          pthread_mutex_unlock(&args[i].mutex);
-        }
-        break;
-
       case SHARE_INFO_MSG:
         /* do nothing special */
         break;
@@ -191,23 +322,46 @@ void main_thread(MinerArgs *args) {
     }
   }
 
+  /* finish the --record file */
+  record_close();
+
+  /* disconnect the downstream miners */
+  if (opts.proxy_port != 0)
+    free_proxy();
+
+  /* wake up parked threads */
+  wake_work_waiters();
+  wake_throttled();
+
+  pthread_mutex_lock(&shutdown_mutex);
+  pthread_cond_broadcast(&shutdown_cond);
+  pthread_mutex_unlock(&shutdown_mutex);
+
   /* shutdown stats thread */
-  if (!opts.quiet) {
-    pthread_kill(stats, SIGUSR1);
+  if (!opts.quiet) 
     pthread_join(stats, NULL);
+
+  if (opts.config_file != NULL)
+    pthread_join(config, NULL);
+
+  if (metrics_started) {
+    pthread_join(metrics, NULL);
+    free_metrics();
   }
 
+  if (opts.cpu_budget > 0)
+    pthread_join(throttle, NULL);
+
   /* shutdown miner threads */
-  for (i = 0; i < opts.num_threads; i++) {
-    args[i].new_work = 0;
+  for (i = 0; i < opts.num_threads; i++) 
     args[i].sieve.active = 0;
-  }
 
   /* wait for threads to finish */
   for (i = 0; i < opts.num_threads; i++) 
     pthread_join(threads[i], NULL);
   
   free(threads);
+  free_stats_groups();
 
   if (!args_given)
     free(args);
@@ -218,8 +372,8 @@ void main_thread(MinerArgs *args) {
  */
 void soft_shutdown(int signum) {
   
-  /* stats thread killed */
-  if (signum == SIGUSR1) return;
+  /* same behavior for all signals */
+  (void) signum;
 
   static int shutdown = 0;
   running = 0;
@@ -237,6 +391,15 @@ void soft_shutdown(int signum) {
   shutdown++;
 }
 
+/**
+ * signal handler to reload the --config file
+ */
+void reload_config(int signum) {
+
+  (void) signum;
+  request_config_reload();
+}
+
 /**
  * start everything (main program start)
  */
@@ -255,7 +418,10 @@ int main(int argc, char *argv[]) {
   sigaction(SIGINT,  &action, NULL);
   sigaction(SIGTERM, &action, NULL);
   sigaction(SIGALRM, &action, NULL);
-  sigaction(SIGUSR1, &action, NULL); /* to kill stats thread */
+
+  /* reload the --config file */
+  action.sa_handler = reload_config;
+  sigaction(SIGUSR1, &action, NULL);
 
   /* continue mining if terminal lost connection */
   action.sa_handler = SIG_IGN;
@@ -269,8 +435,14 @@ int main(int argc, char *argv[]) {
   /* print options if --verbose was given */
   print_options();
 
-  /* start mining */
-  main_thread(NULL);
+  /* print which kernel variants are used */
+  print_cpu_features();
+
+  /* start mining (or benchmarking) */
+  if (opts.benchmark)
+    run_benchmark();
+  else
+    main_thread(NULL);
 
   free_opts();
 
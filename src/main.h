@@ -28,14 +28,19 @@
 /**
  * Prototypes for all stuctures
  */
-typedef struct MinerArgs   MinerArgs;
-typedef struct MiningStats MiningStats;
-typedef struct Opts        Opts;
-typedef struct BlockHeader BlockHeader;
-typedef struct TestParams  TestParams;
-typedef struct SieveStats  SieveStats;
-typedef struct Sieve       Sieve;
-typedef struct PrimeTable  PrimeTable;
+typedef struct MinerArgs      MinerArgs;
+typedef struct MiningStats    MiningStats;
+typedef struct Opts           Opts;
+typedef struct BlockHeader    BlockHeader;
+typedef struct TestParams     TestParams;
+typedef struct SieveStats     SieveStats;
+typedef struct Sieve          Sieve;
+typedef struct PrimeTable     PrimeTable;
+typedef struct WorkSlot       WorkSlot;
+typedef struct ServerClient   ServerClient;
+typedef struct ServerHandlers ServerHandlers;
+typedef struct Histogram      Histogram;
+typedef struct StatsGroup     StatsGroup;
 
 /**
  * program versions (for network protocol)
@@ -59,6 +64,12 @@ typedef struct PrimeTable  PrimeTable;
  */ 
 #define DEFAULT_SIEVE_EXTENSIONS 9
 
+/**
+ * maximum number of sieve extensions
+ * (bounds the per extension statistics)
+ */
+#define MAX_SIEVE_EXTENSIONS 32
+
 /**
  * default number of sieve percentage
  */
@@ -69,13 +80,29 @@ typedef struct PrimeTable  PrimeTable;
  */
 #define DEFAULT_SIEVE_SIZE 4050000u
 
+/**
+ * --memory-limit first reduces the extensions and the sieve size down
+ * to these, then the threads, and only then below them
+ */
+#define MEMORY_MIN_EXTENSIONS 4
+#define MEMORY_MIN_SIEVE_SIZE 1000000u
+
 /**
  * the default number of primes the block header hash
  * should be divisible by
  * (beginning with 2)
+ *
+ * the maximum is only bounded by the space for the prime multiplier
+ * in the block header (the fixed hash multiplier has to be greater
+ * than the hash primorial, and both have to fit into MULTIPLIER_LENGTH)
+ *
+ * but a round needs about twice the hash primorial of hashes: 9 primes
+ * already take about 4.5e8, the 10th (29) takes hours per round and
+ * thread, so more get a warning (see --bench-hash-sweep)
  */
-#define DEFAULT_NUM_PRIMES_IN_HASH 4
-#define MAX_NUM_PRIMES_IN_HASH 9
+#define DEFAULT_NUM_PRIMES_IN_HASH  4
+#define MAX_NUM_PRIMES_IN_HASH      32
+#define MAX_MINABLE_PRIMES_IN_HASH  9
 
 /**
  * the default number of primes the primorial
@@ -108,6 +135,21 @@ typedef struct PrimeTable  PrimeTable;
  */
 #define DEFAULT_POOL_SHARE 7
 
+/**
+ * default seconds without any data from the pool until reconnecting
+ */
+#define DEFAULT_POOL_TIMEOUT 300
+
+/**
+ * default number of rounds (sieve runs) for --benchmark
+ */
+#define DEFAULT_BENCH_ROUNDS 64
+
+/**
+ * the cache line size (used to avoid false sharing between threads)
+ */
+#define CACHE_LINE_SIZE 64
+
 /**
  * to define program wide globals
  */
@@ -140,10 +182,22 @@ void main_thread(MinerArgs *args);
 #include "options.h"
 #include "net.h"
 #include "block.h"
+#include "work.h"
 #include "prime-table.h"
 #include "prime-tests.h"
+#include "histogram.h"
 #include "sieve.h"
+#include "stats.h"
+#include "throttle.h"
 #include "tests.h"
+#include "benchmark.h"
+#include "record.h"
+#include "server.h"
+#include "prime-cache.h"
+#include "config.h"
+#include "cpu.h"
+#include "metrics.h"
+#include "proxy.h"
 
 /**
  * args for the mining threads
@@ -152,14 +206,13 @@ struct MinerArgs {
   Sieve    sieve;
   uint32_t id;
   uint32_t n_threads;
-  char     new_work;
+  uint32_t config_epoch;
   char     mine;
-  pthread_mutex_t mutex;
 };
 
 /* the different stats of mining */
 #define MINING_WAIT    0
-#define MINING_START   1
+#define MINING_PARKED  1
 #define MINING_STARTED 2
 #define MINING_STOPPED 3
 
@@ -0,0 +1,436 @@
+/**
+ * Implementation of the local metrics endpoint.
+ *
+ * The metrics thread answers HTTP GET /metrics requests on localhost
+ * with the counters in the Prometheus text format. It only reads the
+ * (relaxed atomic) per thread stats, like the stats thread does, so
+ * the miners are not affected by scraping.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "main.h"
+
+/**
+ * maximum length of a request (the rest gets ignored)
+ */
+#define MAX_REQUEST_LENGTH 1024
+
+/**
+ * the listening socket
+ */
+static int metrics_socket = -1;
+
+/**
+ * the latency histograms exported as summaries
+ */
+static const struct {
+  const char *name;
+  uint32_t stage;
+} latencies[] = {
+  { "hash",        HIST_HASH        },
+  { "multipliers", HIST_MULTIPLIERS },
+  { "segment",     HIST_SEGMENT     },
+  { "extract",     HIST_EXTRACT     },
+  { "test_1cc",    HIST_TEST_CC1    },
+  { "test_2cc",    HIST_TEST_CC2    },
+  { "test_twn",    HIST_TEST_TWN    },
+  { "submit",      HIST_SUBMIT      }
+};
+
+/**
+ * starts listening on localhost:port for metric requests
+ * returns 0 on success
+ */
+int init_metrics(uint16_t port) {
+
+  metrics_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (metrics_socket < 0) {
+    errno_msg("failed to create metrics socket");
+    return -1;
+  }
+
+  int optval = 1;
+  setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+
+  /* the counters are for local monitoring only */
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(metrics_socket,
+           (struct sockaddr *) &addr,
+           sizeof(struct sockaddr_in)) < 0 ||
+      listen(metrics_socket, SOMAXCONN) < 0) {
+
+    errno_msg("failed to listen on metrics port");
+    close(metrics_socket);
+    metrics_socket = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * writes one metric header
+ */
+static void metric_header(FILE *out,
+                          const char *name,
+                          const char *type,
+                          const char *help) {
+
+  fprintf(out, "# HELP xpminer_%s %s\n# TYPE xpminer_%s %s\n",
+          name,
+          help,
+          name,
+          type);
+}
+
+/**
+ * writes a metric with a single value
+ */
+static void metric(FILE *out,
+                   const char *name,
+                   const char *type,
+                   const char *help,
+                   double value) {
+
+  metric_header(out, name, type, help);
+  fprintf(out, "xpminer_%s %.17g\n", name, value);
+}
+
+/**
+ * writes the chain counts of one type
+ */
+static void chain_metrics(FILE *out, const char *type, uint64_t *chains) {
+
+  uint32_t n;
+  for (n = 1; n < MAX_CHAIN_LENGTH; n++)
+    if (chains[n] > 0)
+      fprintf(out,
+              "xpminer_chains_total{type=\"%s\",length=\"%" PRIu32 "\"} %"
+              PRIu64 "\n",
+              type,
+              n,
+              chains[n]);
+}
+
+/**
+ * writes all metrics of the n_threads miner threads
+ */
+static void write_metrics(FILE *out, uint32_t n_threads) {
+
+  SieveStats sieve_stats;
+  uint64_t primes = 0;
+
+  /* only used by the metrics thread */
+  static Histogram hist[HIST_STAGES];
+
+  /* collect the information from the thread groups */
+  stats_groups_collect(&sieve_stats, hist);
+
+  uint32_t extensions = opts.sieve_extensions;
+  uint32_t i, n, e;
+  for (n = 1; n < MAX_CHAIN_LENGTH; n++)
+    primes += sieve_stats.twn[n] + sieve_stats.cc2[n] + sieve_stats.cc1[n];
+
+  metric(out, "threads", "gauge", "number of miner threads", n_threads);
+  metric(out, "throttled_threads", "gauge",
+         "miner threads parked by --background or --cpu-budget",
+         __atomic_load_n(&throttled_threads, __ATOMIC_RELAXED));
+  metric(out, "other_load_cpus", "gauge",
+         "cpu usage of the other processes (with --cpu-budget)",
+         throttle_other_load());
+  metric(out, "uptime_seconds", "gauge", "seconds since the start",
+         (double) (time(NULL) - opts.start_time));
+
+  /* mining */
+  metric(out, "tests_total", "counter", "tested candidates",
+         sieve_stats.tests);
+  metric(out, "primes_total", "counter", "found primes (chains of length 1+)",
+         primes);
+  metric(out, "rounds_total", "counter", "sieve rounds", sieve_stats.rounds);
+  metric(out, "candidates_per_round", "gauge",
+         "average tested candidates per sieve round",
+         sieve_stats.tests / (double) (sieve_stats.rounds ?
+                                       sieve_stats.rounds : 1));
+  metric(out, "hashes_total", "counter", "mined header hashes",
+         sieve_stats.hashes);
+
+  metric_header(out, "chains_total", "counter",
+                "found chains by type and length");
+  chain_metrics(out, "1CC", sieve_stats.cc1);
+  chain_metrics(out, "2CC", sieve_stats.cc2);
+  chain_metrics(out, "TWN", sieve_stats.twn);
+
+  /* where the mining time goes */
+  metric_header(out, "stage_seconds_total", "counter",
+                "time spent in the mining stages (over all threads)");
+  fprintf(out,
+          "xpminer_stage_seconds_total{stage=\"hash\"} %.6f\n"
+          "xpminer_stage_seconds_total{stage=\"multipliers\"} %.6f\n"
+          "xpminer_stage_seconds_total{stage=\"sieve\"} %.6f\n"
+          "xpminer_stage_seconds_total{stage=\"test\"} %.6f\n",
+          sieve_stats.hash_time       / 1000000.0,
+          sieve_stats.multiplier_time / 1000000.0,
+          sieve_stats.sieve_time      / 1000000.0,
+          sieve_stats.test_time       / 1000000.0);
+
+  metric_header(out, "stage_latency_seconds", "summary",
+                "latency of the mining stages (since the start)");
+
+  for (i = 0; i < sizeof(latencies) / sizeof(latencies[0]); i++) {
+
+    Histogram *stage_hist = &hist[latencies[i].stage];
+    const char *name      = latencies[i].name;
+
+    fprintf(out,
+            "xpminer_stage_latency_seconds{stage=\"%s\",quantile=\"0.5\"} "
+            "%.9f\n"
+            "xpminer_stage_latency_seconds{stage=\"%s\",quantile=\"0.99\"} "
+            "%.9f\n"
+            "xpminer_stage_latency_seconds_count{stage=\"%s\"} %" PRIu64 "\n",
+            name,
+            hist_percentile(stage_hist, 50) / 1000000.0,
+            name,
+            hist_percentile(stage_hist, 99) / 1000000.0,
+            name,
+            hist_count(stage_hist));
+  }
+
+  /* yield of the sieve extensions (0 is the normal sieve) */
+  metric_header(out, "extension_tests_total", "counter",
+                "tested candidates by sieve extension");
+  for (e = 0; e <= extensions; e++)
+    fprintf(out, "xpminer_extension_tests_total{extension=\"%" PRIu32 "\"} %"
+            PRIu64 "\n",
+            e,
+            sieve_stats.ext_tests[e]);
+
+  metric_header(out, "extension_share_chains_total", "counter",
+                "found chains of at least pool-share length by extension");
+  for (e = 0; e <= extensions; e++) {
+
+    uint64_t chains = 0;
+    for (n = opts.pool_share; n < MAX_CHAIN_LENGTH; n++)
+      chains += sieve_stats.ext_chains[e][n];
+
+    fprintf(out, "xpminer_extension_share_chains_total{extension=\"%" PRIu32 
+            "\"} %" PRIu64 "\n",
+            e,
+            chains);
+  }
+
+  metric_header(out, "extension_seconds_total", "counter",
+                "sieve and test time by extension (over all threads)");
+  for (e = 0; e <= extensions; e++)
+    fprintf(out, "xpminer_extension_seconds_total{extension=\"%" PRIu32 
+            "\"} %.6f\n",
+            e,
+            sieve_stats.ext_time[e] / 1000000.0);
+
+  metric(out, "active_extensions", "gauge",
+         "sieve extensions not pruned by --prune-extensions",
+         sieve_active_extensions());
+
+  /* pool */
+  metric_header(out, "shares_total", "counter", "share results by the pool");
+  fprintf(out,
+          "xpminer_shares_total{result=\"accepted\"} %" PRIu64 "\n"
+          "xpminer_shares_total{result=\"rejected\"} %" PRIu64 "\n"
+          "xpminer_shares_total{result=\"stale\"} %" PRIu64 "\n"
+          "xpminer_shares_total{result=\"block\"} %" PRIu64 "\n",
+          opts.stats.share,
+          opts.stats.rejected,
+          opts.stats.stale,
+          opts.stats.block);
+
+  metric(out, "shares_submitted_total", "counter",
+         "shares send to the pool", opts.stats.submitted);
+  metric(out, "shares_dropped_total", "counter",
+         "shares lost because of a full share queue",
+         __atomic_load_n(&opts.stats.dropped, __ATOMIC_RELAXED));
+  metric(out, "shares_stale_dropped_total", "counter",
+         "shares not send because their work got replaced",
+         __atomic_load_n(&opts.stats.stale_dropped, __ATOMIC_RELAXED));
+  metric(out, "share_submit_seconds_total", "counter",
+         "time from queuing till sending (over all shares)",
+         opts.stats.submit_time / 1000000.0);
+  metric(out, "share_ack_seconds_total", "counter",
+         "time from queuing till the pool result (over all shares)",
+         opts.stats.ack_time / 1000000.0);
+  metric(out, "share_queue_depth", "gauge", "currently queued shares",
+         share_queue_depth());
+  metric(out, "share_queue_depth_max", "gauge", "maximum queued shares",
+         opts.stats.queue_depth_max);
+  metric(out, "proxy_miners", "gauge", 
+         "connected downstream miners (--proxy)", 
+         __atomic_load_n(&opts.stats.proxy_miners, __ATOMIC_RELAXED));
+  metric(out, "proxy_shares_total", "counter",
+         "shares received from downstream miners", 
+         __atomic_load_n(&opts.stats.proxy_shares, __ATOMIC_RELAXED));
+  metric(out, "proxy_invalid_shares_total", "counter",
+         "invalid downstream shares (not forwarded)", 
+         __atomic_load_n(&opts.stats.proxy_invalid, __ATOMIC_RELAXED));
+  metric(out, "reconnects_total", "counter", "reconnects to the pool",
+         opts.stats.reconnects);
+  metric(out, "disconnected_seconds_total", "counter",
+         "time without a pool connection",
+         get_disconnected_time() / 1000000.0);
+  metric(out, "work_switches_total", "counter",
+         "switches of the miner threads to new work",
+         sieve_stats.work_switches);
+  metric(out, "work_switch_seconds_total", "counter",
+         "time from receiving new work till the threads switched to it",
+         sieve_stats.switch_time / 1000000.0);
+  metric(out, "work_switch_max_seconds", "gauge",
+         "longest work switch",
+         sieve_stats.switch_time_max / 1000000.0);
+}
+
+/**
+ * sends the whole buffer
+ * returns 0 on failure
+ */
+static char send_all(int sock, const char *buffer, size_t len) {
+
+  while (len > 0) {
+
+    ssize_t sent = send(sock, buffer, len, MSG_NOSIGNAL);
+    if (sent <= 0)
+      return 0;
+
+    buffer += sent;
+    len    -= sent;
+  }
+
+  return 1;
+}
+
+/**
+ * reads the request and sends the response
+ */
+static void answer_request(int sock, uint32_t n_threads) {
+
+  struct timeval timeout = { METRICS_TIMEOUT, 0 };
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  /* read till the end of the request header */
+  char request[MAX_REQUEST_LENGTH + 1];
+  size_t len = 0;
+
+  while (len < MAX_REQUEST_LENGTH) {
+
+    ssize_t received = recv(sock, request + len, MAX_REQUEST_LENGTH - len, 0);
+    if (received <= 0)
+      break;
+
+    len += received;
+    request[len] = '\0';
+
+    if (strstr(request, "\r\n\r\n") != NULL ||
+        strstr(request, "\n\n")     != NULL)
+      break;
+  }
+  request[len] = '\0';
+
+  if (strncmp(request, "GET /metrics ", 13) != 0 &&
+      strncmp(request, "GET / ", 6) != 0) {
+
+    const char *not_found =
+      "HTTP/1.0 404 Not Found\r\n"
+      "Content-Type: text/plain\r\n"
+      "Content-Length: 10\r\n"
+      "Connection: close\r\n\r\n"
+      "not found\n";
+
+    send_all(sock, not_found, strlen(not_found));
+    return;
+  }
+
+  char  *body     = NULL;
+  size_t body_len = 0;
+  FILE  *out      = open_memstream(&body, &body_len);
+
+  if (out == NULL)
+    return;
+
+  write_metrics(out, n_threads);
+  fclose(out);
+
+  char header[256];
+  int header_len = snprintf(header,
+                            sizeof(header),
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: close\r\n\r\n",
+                            body_len);
+
+  if (send_all(sock, header, header_len))
+    send_all(sock, body, body_len);
+
+  free(body);
+}
+
+/**
+ * waits at most timeout milliseconds for a request, and answers it
+ * with the current metrics of the n_threads miner threads
+ */
+void serve_metrics(uint32_t n_threads, int timeout) {
+
+  struct pollfd pfd;
+  pfd.fd      = metrics_socket;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+
+  if (poll(&pfd, 1, timeout) <= 0)
+    return;
+
+  int sock = accept(metrics_socket, NULL, NULL);
+  if (sock < 0)
+    return;
+
+  answer_request(sock, n_threads);
+  close(sock);
+}
+
+/**
+ * closes the metrics socket
+ */
+void free_metrics() {
+
+  if (metrics_socket >= 0)
+    close(metrics_socket);
+
+  metrics_socket = -1;
+}
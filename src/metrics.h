@@ -0,0 +1,55 @@
+/**
+ * Header file of the local metrics endpoint (Prometheus text format).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * milliseconds the metrics thread waits for a request
+ * before checking for shutdown
+ */
+#define METRICS_POLL_INTERVAL 1000
+
+/**
+ * seconds to receive a request or send a response
+ * (so a stuck scraper can't block the endpoint)
+ */
+#define METRICS_TIMEOUT 2
+
+/**
+ * starts listening on localhost:port for metric requests
+ * returns 0 on success
+ */
+int init_metrics(uint16_t port);
+
+/**
+ * waits at most timeout milliseconds for a request, and answers it
+ * with the current metrics of the n_threads miner threads
+ */
+void serve_metrics(uint32_t n_threads, int timeout);
+
+/**
+ * closes the metrics socket
+ */
+void free_metrics();
+
+#endif /* __METRICS_H__ */
@@ -19,6 +19,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -28,25 +30,59 @@
 #include <errno.h>
 #include <pthread.h>
 #include <math.h>
+#include <time.h>
 
 #include "main.h"
 
 /**
- * seconds to wait until trying to reconnect
+ * seconds to wait until trying to reconnect the first time
+ * (doubled with each failed attempt up to RECONNECT_TIME_MAX)
  */
-#define RECONNECT_TIME 15
+#define RECONNECT_TIME_MIN 1
+#define RECONNECT_TIME_MAX 64
 
 /**
- * mutex to avoid mutual exclusion by submitting shares
+ * seconds to wait for a tcp connect to finish
  */
-static pthread_mutex_t connect_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t send_mutex    = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t fifo_mutex    = PTHREAD_MUTEX_INITIALIZER;
+#define CONNECT_TIMEOUT 10
+
+/**
+ * maximum milliseconds to wait for events, before checking
+ * whether the program should shutdown
+ */
+#define POLL_INTERVAL 1000
+
+/**
+ * the byte length of the message type
+ */
+#define MSG_TYPE_LENGTH 1
+
+/**
+ * the byte length of the share info message payload
+ */
+#define SHARE_INFO_LENGTH 4
+
+/**
+ * size of the receive buffer (holds several messages)
+ */
+#define RECV_BUFFER_SIZE 4096
+
+/**
+ * number of shares which can be queued for submission
+ * (and the number of shares waiting for the pool result)
+ * needs to be a power of two
+ */
+#define SHARE_QUEUE_SIZE 64
 
 /**
  * the tcp socket
  */
-static int tcp_socket = 0;
+static int tcp_socket = -1;
+
+/**
+ * the epoll instance waiting for pool events
+ */
+static int epoll_fd = -1;
 
 /**
  * length of the hello message
@@ -54,108 +90,496 @@ static int tcp_socket = 0;
 static int hello_len = 0;
 
 /**
- * a fifo element to store a
- * pending share
+ * buffer for partial received messages
  */
-typedef struct FifoE FifoE;
-struct FifoE {
-  char str[64];
-  FifoE *next;
-};
+static uint8_t recv_buffer[RECV_BUFFER_SIZE];
+static uint32_t recv_len = 0;
+
+/**
+ * time of the last received data (for the read deadline)
+ */
+static uint64_t last_recv = 0;
+
+/**
+ * the time since we are disconnected (0 if connected)
+ */
+static uint64_t disconnected_since = 0;
 
 /**
- * fifo queue for pending shares
+ * a share waiting for submission
  */
 typedef struct {
-  FifoE *start;
-  FifoE *end;
-} ShareFiFo;
+  BlockHeader header;
+  char        type;
+  uint32_t    difficulty;
+  uint64_t    queued;     /* time the share was queued (usec)      */
+  uint32_t    epoch;      /* work epoch the share was found for    */
+  uint32_t    client;     /* downstream miner (--proxy), 0 = own   */
+  uint64_t    seq;        /* sequence number for lock free access  */
+} QueuedShare;
 
 /**
- * the pending shares fifo queue
+ * bounded lock free multi producer single consumer queue
+ * (the miner threads add shares, the network thread sends them)
+ *
+ * each slot has a sequence number which tells whether the slot
+ * is free for position pos (seq == pos) or contains the share
+ * for position pos (seq == pos + 1)
  */
-static ShareFiFo pending_shares;
+static struct {
+  QueuedShare shares[SHARE_QUEUE_SIZE];
+
+  /* next position to add (miner threads) */
+  uint64_t tail __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+  /* next position to send (network thread) */
+  uint64_t head __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+  /* bytes of the share at head already send */
+  uint32_t sent;
+} share_queue;
 
 /**
- * add a new element (share) to a fifo queue
+ * event file descriptor to wake up the network thread on new shares
  */
-static inline void fifo_add(ShareFiFo *fifo, FifoE *e) {
+static int share_event = -1;
 
-  pthread_mutex_lock(&fifo_mutex);   
-  if (fifo->start == NULL)       
-    fifo->start = e;             
-                                
-  if (fifo->end != NULL)         
-    fifo->end->next = e;         
-                                
-  fifo->end = e;                 
-  pthread_mutex_unlock(&fifo_mutex); 
-                                
-} 
+/**
+ * gets readable on downstream miner events (--proxy)
+ */
+static int proxy_event = -1;
 
 /**
- * remove a element (pending share) from a fifo queue
+ * a submitted share waiting for the pool result
  */
-static inline FifoE *fifo_rem(ShareFiFo *fifo) {
+typedef struct {
+  char     type;
+  uint32_t difficulty;
+  uint64_t queued;
+  uint32_t client;
+} PendingShare;
 
-  pthread_mutex_lock(&fifo_mutex);         
-  FifoE *e = fifo->start;                     
-                                      
-  if (fifo->start == fifo->end)         
-    fifo->end = NULL;                  
-                                      
-  if (fifo->start != NULL)             
-    fifo->start = fifo->start->next;    
-  pthread_mutex_unlock(&fifo_mutex);       
-  
-  return e;
-} 
+/**
+ * ring of shares waiting for the pool result
+ * (the pool answers in submission order, so the n-th result 
+ *  belongs to the n-th submitted share)
+ */
+static PendingShare pending_shares[SHARE_QUEUE_SIZE];
+static uint64_t     pending_sent  = 0;
+static uint64_t     pending_acked = 0;
 
 /**
- * (re)start an keep alive tcp connection
+ * indicates whether the socket is also watched for writability
  */
-static void create_socket() {
-  
-  int ret = -1;
+static char want_write = 0;
 
-  do {
-    if (running && tcp_socket > 0) {
-      close(tcp_socket);
-      tcp_socket = -1;
-    }
+/**
+ * start of the replay (in microseconds, 0 if not started)
+ */
+static uint64_t replay_start = 0;
 
-    if (running) {
-      
-      tcp_socket = socket(AF_INET, SOCK_STREAM, 0); 
-      
-      /* socket successfully created ? */
-      if (running && tcp_socket >= 0) {
-      
-        /* set keep alive option */
-        int optval = 1;
-        ret = setsockopt(tcp_socket,                                                 
-                         SOL_SOCKET,                                                 
-                         SO_KEEPALIVE,                                               
-                         &optval,                                                    
-                         sizeof(int));
-      } 
-      
-      /* recreate on error */
-      if (running && (tcp_socket < 0 || ret < 0)) {
-      
-        errno_msg("failed to create tcp socket");
-        info_msg("retrying after %ds...\n", RECONNECT_TIME);
-        sleep(RECONNECT_TIME);
+/**
+ * the share results of the recorded session (replay mode)
+ */
+static uint64_t recorded_results[3]; /* accepted, stale, rejected */
+
+/**
+ * initializes the sequence numbers of the share queue
+ */
+static void init_share_queue() {
+
+  uint64_t i;
+  for (i = 0; i < SHARE_QUEUE_SIZE; i++)
+    share_queue.shares[i].seq = i;
+}
+
+/**
+ * adds a share to the share queue (called by the miner threads)
+ * returns 0 if the queue is full
+ */
+static char share_queue_add(BlockHeader *share, 
+                            char type, 
+                            uint32_t difficulty,
+                            uint32_t epoch,
+                            uint32_t client) {
+
+  uint64_t pos = __atomic_load_n(&share_queue.tail, __ATOMIC_RELAXED);
+  QueuedShare *slot;
+
+  for (;;) {
+
+    slot = &share_queue.shares[pos & (SHARE_QUEUE_SIZE - 1)];
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    int64_t diff = (int64_t) (seq - pos);
+
+    /* slot is free: try to reserve it */
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&share_queue.tail, 
+                                      &pos, 
+                                      pos + 1, 
+                                      1, 
+                                      __ATOMIC_RELAXED, 
+                                      __ATOMIC_RELAXED)) {
+        break;
       }
+
+    /* slot still in use: queue full */
+    } else if (diff < 0) {
+      return 0;
+
+    /* an other thread reserved the slot */
+    } else {
+      pos = __atomic_load_n(&share_queue.tail, __ATOMIC_RELAXED);
+    }
+  }
+
+  memcpy(&slot->header, share, sizeof(BlockHeader));
+  slot->type       = type;
+  slot->difficulty = difficulty;
+  slot->queued     = gettime_usec();
+  slot->epoch      = epoch;
+  slot->client     = client;
+
+  /* publish the share */
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/**
+ * returns the share at the head of the queue or NULL if it is empty
+ * (only called by the network thread)
+ */
+static inline QueuedShare *share_queue_peek() {
+
+  QueuedShare *slot = &share_queue.shares[share_queue.head & 
+                                          (SHARE_QUEUE_SIZE - 1)];
+
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != share_queue.head + 1)
+    return NULL;
+
+  return slot;
+}
+
+/**
+ * removes the share at the head of the queue
+ * (only called by the network thread)
+ */
+static inline void share_queue_remove(QueuedShare *slot) {
+
+  __atomic_store_n(&slot->seq, 
+                   share_queue.head + SHARE_QUEUE_SIZE, 
+                   __ATOMIC_RELEASE);
+
+  share_queue.head++;
+  share_queue.sent = 0;
+}
+
+/**
+ * returns the current number of queued shares
+ */
+uint32_t share_queue_depth() {
+
+  return __atomic_load_n(&share_queue.tail, __ATOMIC_RELAXED) - 
+         __atomic_load_n(&share_queue.head, __ATOMIC_RELAXED);
+}
+
+/**
+ * returns a readable description of a share
+ */
+static inline void share_str(char *str, char type, uint32_t difficulty) {
+
+  char *chain_str = (type == BI_TWIN_CHAIN) ? "TWN" : 
+                    (type == FIRST_CUNNINGHAM_CHAIN) ? "1CC" : "2CC";
+
+  sprintf(str, "Found Chain: %s%02x.%06x =>",  
+          chain_str, 
+          chain_length(difficulty), 
+          fractional_length(difficulty));
+}
+
+/**
+ * (un)watch the socket for writability
+ */
+static inline void set_want_write(char write) {
+
+  if (want_write == write || tcp_socket < 0)
+    return;
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events  = EPOLLIN | EPOLLRDHUP | (write ? EPOLLOUT : 0);
+  event.data.fd = tcp_socket;
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, tcp_socket, &event);
+  want_write = write;
+}
+
+static void process_share_info(int32_t result);
+
+/**
+ * returns whether the work the share was found for got replaced
+ * by a new block (the pool would count it as stale)
+ *
+ * the pool only rejects shares for an old block (like --replay and the
+ * mock pool do), so a new epoch with the same block (new merkle root or
+ * reconnect) or without valid work (disconnected) keeps the share
+ */
+static char share_replaced(const BlockHeader *share, uint32_t epoch) {
+
+  if (epoch == work_epoch())
+    return 0;
+
+  BlockHeader work;
+  uint64_t published;
+
+  if (read_work(&work, &published) == 0)
+    return 0;
+
+  return memcmp(share->hash_prev_block, work.hash_prev_block, HASH_LENGTH);
+}
+
+/**
+ * remembers a submitted share until the pool result arrives
+ */
+static void add_pending_share(QueuedShare *share) {
+
+  PendingShare *pending = &pending_shares[pending_sent & 
+                                          (SHARE_QUEUE_SIZE - 1)];
+  pending->type       = share->type;
+  pending->difficulty = share->difficulty;
+  pending->queued     = share->queued;
+  pending->client     = share->client;
+  pending_sent++;
+
+  opts.stats.submitted++;
+  opts.stats.submit_time += gettime_usec() - share->queued;
+}
+
+/**
+ * counts a share which was not submitted because its work got replaced
+ * (called by the miner threads and the network thread)
+ */
+static void drop_replaced_share(char type, uint32_t difficulty) {
+
+  __atomic_add_fetch(&opts.stats.stale_dropped, 1, __ATOMIC_RELAXED);
+
+  char str[64];
+  share_str(str, type, difficulty);
+  info_msg("%s dropped (work replaced)\n", str);
+}
+
+/**
+ * answers the queued shares like the pool would (replay mode)
+ * a share is stale if it wasn't found for the current block,
+ * otherwise it gets accepted
+ */
+static void replay_shares() {
+
+  QueuedShare *share;
+
+  while ((share = share_queue_peek()) != NULL) {
+
+    /* the work was replaced after queuing */
+    if (share_replaced(&share->header, share->epoch)) {
+      share_queue_remove(share);
+      drop_replaced_share(share->type, share->difficulty);
+      continue;
+    }
+
+    BlockHeader work;
+    uint64_t published;
+    read_work(&work, &published);
+
+    int32_t result = (memcmp(share->header.hash_prev_block, 
+                             work.hash_prev_block, 
+                             HASH_LENGTH) == 0) ? 1 : -1;
+
+    add_pending_share(share);
+    share_queue_remove(share);
+    process_share_info(result);
+  }
+}
+
+/**
+ * sends the queued shares to the pool 
+ * (only called by the network thread)
+ */
+static void send_shares() {
+
+  QueuedShare *share;
+
+  if (opts.replay_file != NULL) {
+    replay_shares();
+    return;
+  }
+
+  while (tcp_socket >= 0 && 
+         pending_sent - pending_acked < SHARE_QUEUE_SIZE &&
+         (share = share_queue_peek()) != NULL) {
+
+    uint32_t depth = share_queue_depth();
+    if (depth > opts.stats.queue_depth_max)
+      opts.stats.queue_depth_max = depth;
+
+    /* the work was replaced after queuing (only if nothing is send yet) */
+    if (share_queue.sent == 0 && 
+        share_replaced(&share->header, share->epoch)) {
+
+      share_queue_remove(share);
+      drop_replaced_share(share->type, share->difficulty);
+      continue;
+    }
+
+    int ret = send(tcp_socket, 
+                   ((uint8_t *) &share->header) + share_queue.sent, 
+                   BLOCK_HEADER_LENGTH - share_queue.sent,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (ret < 0) {
+
+      /* socket buffer full, continue if writable again */
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+
+      errno_msg("failed to submit share!!!");
+
+      /* reconnect (the share stays in the queue) */
+      shutdown(tcp_socket, SHUT_RDWR);
+      break;
+    }
+
+    share_queue.sent += ret;
+
+    /* share completely submitted: wait for the result */
+    if (share_queue.sent == BLOCK_HEADER_LENGTH) {
+      add_pending_share(share);
+      share_queue_remove(share);
+    }
+  }
+
+  /* wait for writability if a share could not be (fully) send */
+  set_want_write(tcp_socket >= 0 && 
+                 pending_sent - pending_acked < SHARE_QUEUE_SIZE &&
+                 share_queue_peek() != NULL);
+}
+
+/**
+ * returns the full length of a message with the given type
+ * (or 0 for an unknown message type)
+ */
+static inline uint32_t msg_length(uint8_t msg_type) {
+
+  switch (msg_type) {
+    case WORK_MSG:       return MSG_TYPE_LENGTH + BLOCK_HEADER_LENGTH;
+    case SHARE_INFO_MSG: return MSG_TYPE_LENGTH + SHARE_INFO_LENGTH;
+  }
+
+  return 0;
+}
+
+/**
+ * waits at most timeout milliseconds for the given events on the socket
+ * (queued shares are send while waiting)
+ * returns the received events, 0 on timeout or -1 on failure
+ */
+static int wait_for(uint32_t events, uint64_t timeout) {
+
+  struct epoll_event event;
+  uint64_t end = gettime_usec() + timeout * 1000;
+  uint64_t now;
+
+  while (running && (now = gettime_usec()) < end) {
+
+    int wait = (end - now) / 1000 + 1;
+    if (wait > POLL_INTERVAL) 
+      wait = POLL_INTERVAL;
+
+    int ret = epoll_wait(epoll_fd, &event, 1, wait);
+
+    if (ret < 0 && errno != EINTR)
+      return -1;
+
+    if (ret <= 0)
+      continue;
+
+    /* new shares from the miner threads */
+    if (event.data.fd == share_event) {
+
+      uint64_t count;
+      if (read(share_event, &count, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+        errno_msg("failed to read share event");
+
+      send_shares();
+      continue;
     }
-  } while (running && (tcp_socket < 0 || ret < 0));
+
+    /* downstream miners (--proxy) */
+    if (event.data.fd == proxy_event) {
+      proxy_poll();
+      continue;
+    }
+
+    /* socket writable again (pending share data) */
+    if ((event.events & EPOLLOUT) && !(events & EPOLLOUT))
+      send_shares();
+
+    if (event.events & (events | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+      return event.events;
+  }
+
+  return 0;
+}
+
+/**
+ * closes the current connection (if any)
+ */
+static void close_socket() {
+  
+  if (tcp_socket >= 0) {
+    
+    /* closing removes the socket from the epoll set */
+    close(tcp_socket);
+    tcp_socket = -1;
+    want_write = 0;
+
+    /* the miners park until the pool sends new work */
+    invalidate_work();
+  }
+
+  /* drop partial messages from the old connection */
+  recv_len = 0;
+
+  if (disconnected_since == 0)
+    disconnected_since = gettime_usec();
+}
+
+/**
+ * create a new non blocking keep alive tcp socket
+ */
+static int create_socket() {
+  
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0); 
+  
+  if (sock < 0) 
+    return -1;
+
+  /* set keep alive option */
+  int optval = 1;
+  if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(int)) < 0) {
+
+    close(sock);
+    return -1;
+  }
+
+  return sock;
 }
 
 /**
  * send hello message to other server
- * (the message format comes from xolominer)
+ * (the message format comes from xolominer, which has only one byte
+ *  for the number of threads, so more than 255 are reported as 255)
  */
-static int send_hello() {
+static int send_hello(int sock) {
 
   uint8_t pool_user_len = strlen(opts.pool_user);
   uint8_t pool_pwd_len  = strlen(opts.pool_pwd);
@@ -170,7 +594,8 @@ static int send_hello() {
   hello[pool_user_len + 1] = 0;
   hello[pool_user_len + 2] = VERSION_MAJOR;
   hello[pool_user_len + 3] = VERSION_MINOR;
-  hello[pool_user_len + 4] = opts.num_threads;
+  hello[pool_user_len + 4] = (opts.num_threads < UINT8_MAX) ? 
+                             opts.num_threads : UINT8_MAX;
   hello[pool_user_len + 5] = opts.pool_fee;
 
   *((uint16_t *) (hello + pool_user_len + 6))  = opts.miner_id;
@@ -182,202 +607,519 @@ static int send_hello() {
 
   *((uint16_t *) (hello + pool_user_len + 21 + pool_pwd_len)) = 0;
 
-  int ret = send(tcp_socket, hello, hello_len, MSG_DONTWAIT);
+  int ret = send(sock, hello, hello_len, MSG_DONTWAIT | MSG_NOSIGNAL);
 
   free(hello);
   return ret;
 }
 
+/**
+ * tries to connect once to the pool (non blocking with a deadline)
+ * returns 0 on success
+ */
+static int try_connect() {
+
+  int sock = create_socket();
+
+  if (sock < 0) {
+    errno_msg("failed to create tcp socket");
+    return -1;
+  }
+
+  /* set the address to connect to */
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(opts.pool_port);
+  addr.sin_addr.s_addr = inet_addr(opts.pool_ip);
+
+  int ret = connect(sock, (struct sockaddr *) &addr, sizeof(struct sockaddr_in));
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events  = EPOLLOUT;
+  event.data.fd = sock;
+
+  if ((ret < 0 && errno != EINPROGRESS) ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+
+    errno_msg("failed to connect to pool");
+    close(sock);
+    return -1;
+  }
+
+  /* wait for the connect to finish */
+  if (ret < 0) {
+
+    int error     = 0;
+    socklen_t len = sizeof(int);
+    int events    = wait_for(EPOLLOUT, CONNECT_TIMEOUT * 1000);
+
+    if (events == 0) {
+
+      if (running)
+        error_msg("failed to connect to pool: timeout after %ds\n", 
+                  CONNECT_TIMEOUT);
+
+      close(sock);
+      return -1;
+    }
+
+    if (events < 0 || 
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 ||
+        error != 0) {
+
+      if (error != 0)
+        errno = error;
+
+      errno_msg("failed to connect to pool");
+      close(sock);
+      return -1;
+    }
+  }
+
+  /* from now on we only wait for incoming messages */
+  event.events = EPOLLIN | EPOLLRDHUP;
+
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sock, &event) < 0 ||
+      send_hello(sock) != hello_len) {
+    
+    errno_msg("failed to send hello to pool");
+    close(sock);
+    return -1;
+  }
+
+  /**
+   * the connection is ready for share submission
+   * (results for shares send over the old connection never arrive,
+   *  and a partial send share has to be send again)
+   */
+  tcp_socket       = sock;
+  pending_acked    = pending_sent;
+  share_queue.sent = 0;
+
+  return 0;
+}
+
 /**
  * (re)connect to a given (pool)ip and (pool)port
+ * (retries with exponential backoff and jitter until connected)
  */
 void connect_to_pool() {
 
-  /* only one thread are allowed to (re)connect */
-  pthread_mutex_lock(&connect_mutex);
+  static char connected_before = 0;
 
-  if (running) {
-    
-    int ret        = -1;
-    int send_bytes = -1;
+  if (epoll_fd < 0) {
 
-    do {
-      /* (re)create socket */
-      create_socket();
-    
-      if (running) {
-   
-        /* set the address to connect to */
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(struct sockaddr_in));
-        addr.sin_family      = AF_INET;
-        addr.sin_port        = htons(opts.pool_port);
-        addr.sin_addr.s_addr = inet_addr(opts.pool_ip);
-        
-        
-        ret = connect(tcp_socket, 
-                      (struct sockaddr *) &addr, 
-                      sizeof(struct sockaddr_in));
-        
-        /* on success send hello */
-        if (running && !ret)
-          send_bytes = send_hello();
-        
-        /* wait and retry on failure */
-        if (running && (ret || send_bytes != hello_len)) {
-        
-          errno_msg("failed to connect to pool");
-          info_msg("retrying after %ds...\n", RECONNECT_TIME);
-          sleep(RECONNECT_TIME);
-        }
+    epoll_fd = epoll_create1(0);
+
+    if (epoll_fd < 0) {
+      errno_msg("failed to create epoll instance");
+      exit(EXIT_FAILURE);
+    }
+
+    /* wake up event for new shares */
+    init_share_queue();
+    share_event = eventfd(0, EFD_NONBLOCK);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events  = EPOLLIN;
+    event.data.fd = share_event;
+
+    if (share_event < 0 || 
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, share_event, &event) < 0) {
+
+      errno_msg("failed to create share event");
+      exit(EXIT_FAILURE);
+    }
+
+    /* downstream miners get served while waiting for the pool */
+    if (opts.proxy_port != 0) {
+
+      proxy_event   = init_proxy(opts.proxy_port);
+      event.data.fd = proxy_event;
+
+      if (proxy_event < 0 || 
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, proxy_event, &event) < 0) {
+
+        error_msg("[EE] failed to start the proxy on port %" PRIu16 "\n",
+                  opts.proxy_port);
+        exit(EXIT_FAILURE);
       }
-    } while (running && (ret || send_bytes != hello_len));
+    }
+
+    srand(time(NULL) ^ getpid());
+
+    if (opts.record_file != NULL && !record_open(opts.record_file))
+      exit(EXIT_FAILURE);
+
+    /* there is no pool to connect to, work comes from the record */
+    if (opts.replay_file != NULL) {
+
+      if (!replay_open(opts.replay_file))
+        exit(EXIT_FAILURE);
+
+      replay_start = gettime_usec();
+    }
+  }
+
+  if (opts.replay_file != NULL)
+    return;
+
+  close_socket();
+
+  uint64_t backoff = RECONNECT_TIME_MIN * 1000;
+
+  while (running && try_connect() != 0) {
+
+    /* wait between backoff / 2 and backoff milliseconds */
+    uint64_t wait = backoff / 2 + rand() % (backoff / 2 + 1);
+
+    if (running && !opts.quiet)
+      info_msg("retrying after %.1fs...\n", wait / 1000.0);
+
+    /* shares and downstream miners get handled meanwhile */
+    wait_for(0, wait);
+
+    if (backoff < RECONNECT_TIME_MAX * 1000)
+      backoff *= 2;
+  }
+
+  if (running) {
+
+    if (connected_before)
+      opts.stats.reconnects++;
+
+    opts.stats.disconnected_time += gettime_usec() - disconnected_since;
+    disconnected_since = 0;
+    connected_before   = 1;
   }
 
-  pthread_mutex_unlock(&connect_mutex);
+  last_recv = gettime_usec();
+
+  /* send the shares found while disconnected */
+  send_shares();
 }
 
 /**
- * receive work from server
- * returns
- *  the message type or
- *  -1 on failure 
+ * processes a share info message
  */
-int recv_work(MinerArgs *args) {
-  
-  uint8_t msg_type         = -1;
-  static int rejected      = 0;
-  const uint32_t n_threads = args->n_threads;
+static void process_share_info(int32_t result) {
 
-  /* get the message type */
-  if (recv(tcp_socket, &msg_type, 1, 0) != 1)
-    return -1;
+  static int rejected = 0;
 
-  /* read the rest of the message depending on the message type */
-  switch (msg_type) {
-    
-    case WORK_MSG: { 
+  /* received share result for non existing share */
+  if (pending_acked == pending_sent)
+    return;
 
-      /* look all mutexes so no sieve copies the header while receiving */
-      uint32_t i;
-      for (i = 0; i < n_threads; i++)
-        pthread_mutex_lock(&args[i].mutex);
+  /* get the next pending share */
+  PendingShare *share = &pending_shares[pending_acked & 
+                                        (SHARE_QUEUE_SIZE - 1)];
+  pending_acked++;
 
+  opts.stats.ack_time += gettime_usec() - share->queued;
 
-      if (recv(tcp_socket, 
-               opts.header, 
-               BLOCK_HEADER_LENGTH, 
-               MSG_DONTWAIT) != BLOCK_HEADER_LENGTH) {
+  char str[64];
+  share_str(str, share->type, share->difficulty);
 
-        if (!opts.quiet)
-          error_msg("[EE] received invalid work\n");
+  /* share rejected */
+  if (result == 0) {
+    opts.stats.rejected++;
+    rejected++;
+    info_msg("%s rejected\n", str);
 
-        /* unlock the mutexes */
-        for (i = 0; i < n_threads; i++)
-          pthread_mutex_unlock(&args[i].mutex);
-      
-        return -1;
-      }
+  /* share stale */
+  } else if (result < 0) {
+    opts.stats.stale++;
+    rejected = 0;
+    info_msg("%s stale\n", str);
+
+  /* share was a new block */  
+  } else if (result > 100000) {
+    opts.stats.block++;
+    rejected = 0;
+    info_msg("%s block!! (%" PRIu32 ")\n", str, result);
+
+  /* share accepted */
+  } else {
+    opts.stats.share++;
+    rejected = 0;
+    info_msg("%s accepted (%" PRIu32 ")\n", str, result);
+  }
+
+  /* route the result to the downstream miner (--proxy) */
+  if (share->client != 0)
+    proxy_share_result(share->client, result);
+
+  /* force reconnect after 3 continuous rejected shares */
+  if (rejected == 3) {
+    rejected = 0;
+    connect_to_pool();
+  }
+}
+
+/**
+ * processes the message at the start of the receive buffer
+ * returns the message type
+ */
+static int process_msg() {
+
+  uint8_t msg_type = recv_buffer[0];
+  uint8_t *payload = recv_buffer + MSG_TYPE_LENGTH;
+
+  switch (msg_type) {
+    
+    case WORK_MSG: { 
+
+      BlockHeader header;
+      memcpy(&header, payload, BLOCK_HEADER_LENGTH);
 
       /* adjust time offset if necessary */
       uint32_t local_time = time(NULL);
-      opts.time_offset    = (local_time > opts.header->time) ? 0 : 
-                            opts.header->time - local_time;
-                        
+      opts.time_offset    = (local_time > header.time) ? 0 : 
+                            header.time - local_time;
+
+      /* the miners will pick it up with the next work epoch */
+      publish_work(&header);
 
-      /* unlock the mutexes */
-      for (i = 0; i < n_threads; i++)
-        pthread_mutex_unlock(&args[i].mutex);
+      if (proxy_event >= 0)
+        proxy_broadcast_work(&header);
 
       if (!opts.quiet)
         info_msg("Work received for Target: %02x.%x\n", 
-                 chain_length(opts.header->difficulty),
-                 fractional_length(opts.header->difficulty));
+                 chain_length(header.difficulty),
+                 fractional_length(header.difficulty));
 
     } break;
 
     case SHARE_INFO_MSG: {
-      const int buffer_size = 4;
-      int32_t   buffer;
+      int32_t result;
+      memcpy(&result, payload, SHARE_INFO_LENGTH);
 
-      if (recv(tcp_socket, &buffer, buffer_size, MSG_DONTWAIT) != buffer_size)
-        return -1;
+      /* recorded results belong to the shares of the recorded session */
+      if (opts.replay_file != NULL)
+        recorded_results[result > 0 ? 0 : (result < 0 ? 1 : 2)]++;
+      else
+        process_share_info(result);
+    } break;
+  }
+
+  return msg_type;
+}
+
+/**
+ * receive the next recorded message (replay mode)
+ * (waits until the message is due, depending on --replay-speed)
+ * returns
+ *  the message type or
+ *  -1 at the end of the record
+ */
+static int replay_work() {
+
+  /* answer the shares found meanwhile */
+  send_shares();
+
+  uint64_t usec;
+  int len = replay_read(recv_buffer, RECV_BUFFER_SIZE, &usec);
+
+  if (len <= 0) {
+
+    if (len == 0 && !opts.quiet)
+      info_msg("replay finished, recorded pool results: "
+               "%" PRIu64 " accepted %" PRIu64 " stale %" PRIu64 
+               " rejected\n",
+               recorded_results[0], 
+               recorded_results[1], 
+               recorded_results[2]);
+
+    replay_close();
+    running = 0;
+    return -1;
+  }
 
-      /* get the next pending share */
-      FifoE *next_share = fifo_rem(&pending_shares);
+  /* answer shares while waiting */
+  if (opts.replay_speed > 0) {
+
+    uint64_t due = replay_start + usec / opts.replay_speed;
+    uint64_t now;
+
+    while (running && (now = gettime_usec()) < due)
+      wait_for(0, (due - now) / 1000 + 1);
+  }
+
+  recv_len = len;
+  int msg_type = process_msg();
+  recv_len = 0;
+
+  return msg_type;
+}
+
+/**
+ * receive work from server
+ * returns
+ *  the message type or
+ *  -1 on failure 
+ */
+int recv_work() {
+
+  if (opts.replay_file != NULL)
+    return replay_work();
+  
+  while (running) {
+
+    /* complete message in the buffer? */
+    if (recv_len > 0) {
+
+      uint32_t len = msg_length(recv_buffer[0]);
+
+      if (len == 0) {
+
+        if (!opts.quiet)
+          error_msg("[EE] received invalid message type: %d\n", 
+                    recv_buffer[0]);
 
-      /* received share result for non existing share */
-      if (next_share == NULL)
         return -1;
+      }
+
+      if (recv_len >= len) {
 
-      /* share rejected */
-      if (buffer == 0) {
-        opts.stats.rejected++;
-        rejected++;
-        info_msg("%s rejected\n", next_share->str);
-
-      /* share stale */
-      } else if (buffer < 0) {
-        opts.stats.stale++;
-        rejected = 0;
-        info_msg("%s stale\n", next_share->str);
-
-      /* share was a new block */  
-      } else if (buffer > 100000) {
-        opts.stats.block++;
-        rejected = 0;
-        info_msg("%s block!! (%" PRIu32 ")\n", next_share->str, buffer);
-
-      /* share accepted */
-      } else {
-        opts.stats.share++;
-        rejected = 0;
-        info_msg("%s accepted (%" PRIu32 ")\n", next_share->str, buffer);
+        if (opts.record_file != NULL)
+          record_msg(recv_buffer, len);
+
+        int msg_type = process_msg();
+
+        /* the message could have caused an reconnect */
+        if (recv_len >= len) {
+          recv_len -= len;
+          memmove(recv_buffer, recv_buffer + len, recv_len);
+        }
+
+        return msg_type;
       }
+    }
+
+    /* read deadline reached */
+    uint64_t timeout = opts.pool_timeout * 1000000L;
+    uint64_t now     = gettime_usec();
+
+    if (now - last_recv >= timeout) {
+
+      if (!opts.quiet)
+        error_msg("[EE] no data received from pool for %" PRIu32 "s\n",
+                  opts.pool_timeout);
+
+      return -1;
+    }
+
+    int events = wait_for(EPOLLIN, (timeout - (now - last_recv)) / 1000);
+    
+    if (events < 0)
+      return -1;
+
+    if (events == 0)
+      continue;
+
+    int ret = recv(tcp_socket, 
+                   recv_buffer + recv_len, 
+                   RECV_BUFFER_SIZE - recv_len, 
+                   MSG_DONTWAIT);
+
+    /* connection closed by the pool */
+    if (ret == 0) {
+
+      if (!opts.quiet)
+        error_msg("[EE] connection closed by pool\n");
+
+      return -1;
+    }
+
+    if (ret < 0) {
       
-      free(next_share);
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        continue;
 
-      /* force reconnect after 3 continuous rejected shares */
-      if (rejected == 3)
-        connect_to_pool();
-    } break;
+      errno_msg("failed to receive from pool");
+      return -1;
+    }
+
+    recv_len += ret;
+    last_recv = gettime_usec();
   }
 
-  return msg_type;
+  return -1;
 }
 
 /**
- * sends a valid share (block header) to the server
+ * returns the overall time (in microseconds) we were not
+ * connected to the pool (including the current disconnect)
  */
-void submit_share(BlockHeader *share, 
-                  char type, 
-                  uint32_t difficulty) {
+uint64_t get_disconnected_time() {
 
-  pthread_mutex_lock(&send_mutex);
+  uint64_t since = disconnected_since;
 
-  char *chain_str = (type == BI_TWIN_CHAIN) ? "TWN" : 
-                    (type == FIRST_CUNNINGHAM_CHAIN) ? "1CC" : "2CC";
+  if (since == 0)
+    return opts.stats.disconnected_time;
 
+  return opts.stats.disconnected_time + gettime_usec() - since;
+}
 
-  /* add share verbose message to the pending queue */
-  FifoE *share_info = (FifoE *) calloc(sizeof(FifoE), 1);
-  sprintf(share_info->str, "Found Chain: %s%02x.%06x =>",  
-          chain_str, 
-          chain_length(difficulty), 
-          fractional_length(difficulty));
+/**
+ * queues a share of a downstream miner (--proxy) for submission
+ * (only called by the network thread, the pool result gets routed 
+ *  back with proxy_share_result)
+ * returns 0 if the share was dropped (replaced work or full queue)
+ */
+char submit_proxy_share(BlockHeader *share, 
+                        char type, 
+                        uint32_t difficulty,
+                        uint32_t client) {
 
-  fifo_add(&pending_shares, share_info);
+  /* the work of the share is unknown, so it is compared by content */
+  if (share_replaced(share, 0)) {
+    drop_replaced_share(type, difficulty);
+    return 0;
+  }
 
+  if (!share_queue_add(share, type, difficulty, 0, client)) {
 
-  /* send the share to the pool */
-  while (running && send(tcp_socket, 
-                         (uint8_t *) share, 
-                         BLOCK_HEADER_LENGTH, 
-                         MSG_DONTWAIT) != BLOCK_HEADER_LENGTH) {
+    __atomic_add_fetch(&opts.stats.dropped, 1, __ATOMIC_RELAXED);
+    error_msg("[EE] failed to submit share: share queue full\n");
+    return 0;
+  }
 
-    errno_msg("failed to submit share!!!");
-    connect_to_pool();
+  send_shares();
+  return 1;
+}
+
+/**
+ * queues a valid share (block header) for submission to the server
+ * (never blocks, the share is send by the network thread)
+ * shares for replaced work (see share_replaced) get dropped
+ */
+void submit_share(BlockHeader *share, 
+                  char type, 
+                  uint32_t difficulty,
+                  uint32_t epoch) {
+
+  if (share_replaced(share, epoch)) {
+    drop_replaced_share(type, difficulty);
+    return;
+  }
+
+  if (!share_queue_add(share, type, difficulty, epoch, 0)) {
+
+    __atomic_add_fetch(&opts.stats.dropped, 1, __ATOMIC_RELAXED);
+    error_msg("[EE] failed to submit share: share queue full\n");
+    return;
   }
 
-  pthread_mutex_unlock(&send_mutex);
+  /* wake up the network thread */
+  uint64_t count = 1;
+  if (share_event >= 0 && 
+      write(share_event, &count, sizeof(uint64_t)) < 0 && 
+      errno != EAGAIN) {
+
+    errno_msg("failed to signal share");
+  }
 }
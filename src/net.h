@@ -35,17 +35,44 @@ void connect_to_pool();
 
 /**
  * receive work from server
+ * (waits at most --pool-timeout seconds for data)
  * returns
  *  the message type or
  *  -1 on failure 
  */
-int recv_work(MinerArgs *args);
+int recv_work();
 
 /**
- * sends a valid share (block header) to the server
+ * returns the overall time (in microseconds) we were not
+ * connected to the pool (including the current disconnect)
+ */
+uint64_t get_disconnected_time();
+
+/**
+ * returns the current number of shares waiting for submission
+ */
+uint32_t share_queue_depth();
+
+/**
+ * queues a valid share (block header) for submission to the server
+ * (never blocks, the share is send by the network thread)
+ * shares for replaced work (epoch is the work epoch of the header)
+ * of an old block get dropped
  */
 void submit_share(BlockHeader *share, 
                   char type, 
-                  uint32_t difficulty);
+                  uint32_t difficulty,
+                  uint32_t epoch);
+
+/**
+ * queues a share of a downstream miner (--proxy) for submission
+ * (only called by the network thread, the pool result gets routed 
+ *  back with proxy_share_result)
+ * returns 0 if the share was dropped (replaced work or full queue)
+ */
+char submit_proxy_share(BlockHeader *share, 
+                        char type, 
+                        uint32_t difficulty,
+                        uint32_t client);
 
 #endif /* __NET_H__ */
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <openssl/sha.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "main.h"
 
@@ -49,6 +50,29 @@
 #define POOL_SHARE          17
 #define USE_FIRST_HALF      18
 #define QUIET               19
+#define POOL_TIMEOUT        20
+#define BENCHMARK           21
+#define BENCH_SEED          22
+#define BENCH_ROUNDS        23
+#define BENCH_TIME          24
+#define RECORD              25
+#define REPLAY              26
+#define REPLAY_SPEED        27
+#define PRIME_CACHE         28
+#define NO_PRIME_CACHE      29
+#define CONFIG              30
+#define CPU_FEATURES        31
+#define METRICS_PORT        32
+#define PRUNE_EXTENSIONS    33
+#define PROXY               34
+#define PROCESS_INDEX       35
+#define PROCESSES           36
+#define BACKGROUND          37
+#define CPU_BUDGET          38
+#define MEMORY_LIMIT        39
+#define HOST_INDEX          40
+#define HOSTS               41
+#define BENCH_HASH_SWEEP    42
 
 /**
  * the available command line options
@@ -74,21 +98,207 @@ static struct option long_options[] = {
   { "pool-share",          required_argument, 0, POOL_SHARE          },
   { "use-first-half",      no_argument      , 0, USE_FIRST_HALF      },
   { "quiet",               no_argument,       0, QUIET               },
+  { "pool-timeout",        required_argument, 0, POOL_TIMEOUT        },
+  { "benchmark",           no_argument,       0, BENCHMARK           },
+  { "bench-seed",          required_argument, 0, BENCH_SEED          },
+  { "bench-rounds",        required_argument, 0, BENCH_ROUNDS        },
+  { "bench-time",          required_argument, 0, BENCH_TIME          },
+  { "record",              required_argument, 0, RECORD              },
+  { "replay",              required_argument, 0, REPLAY              },
+  { "replay-speed",        required_argument, 0, REPLAY_SPEED        },
+  { "prime-cache",         required_argument, 0, PRIME_CACHE         },
+  { "no-prime-cache",      no_argument,       0, NO_PRIME_CACHE      },
+  { "config",              required_argument, 0, CONFIG              },
+  { "cpu-features",        required_argument, 0, CPU_FEATURES        },
+  { "metrics-port",        required_argument, 0, METRICS_PORT        },
+  { "prune-extensions",    required_argument, 0, PRUNE_EXTENSIONS    },
+  { "proxy",               required_argument, 0, PROXY               },
+  { "process-index",       required_argument, 0, PROCESS_INDEX       },
+  { "processes",           required_argument, 0, PROCESSES           },
+  { "background",          no_argument,       0, BACKGROUND          },
+  { "cpu-budget",          required_argument, 0, CPU_BUDGET          },
+  { "memory-limit",        required_argument, 0, MEMORY_LIMIT        },
+  { "host-index",          required_argument, 0, HOST_INDEX          },
+  { "hosts",               required_argument, 0, HOSTS               },
+  { "bench-hash-sweep",    required_argument, 0, BENCH_HASH_SWEEP    },
   { 0,                     0,                 0, 0                   }
 };
 
 /**
- * initialize program wide parameters
+ * set the prime index after which we have to use 64 bit arithmetic
+ * (this is cached together with the prime table)
  */
-void init_program_parameters() {
+static void init_int64_arithmetic() {
 
-  opts.header = calloc(sizeof(BlockHeader), 1);
+  uint32_t i;
+  opts.int64_arithmetic = UINT32_MAX;
 
-  /* init offset to zero */
-  opts.time_offset = 0;
+  /* two_inverse * prime grows with the prime */
+  for (i = 0; i < opts.primes->len; i++) {
+    
+    if (UINT32_MAX / opts.two_inverses[i] < opts.primes->ptr[i]) {
+      opts.int64_arithmetic = i;
+      break;
+    }
+  }
+}
+
+/**
+ * returns the number up to which the prime table has to be generated,
+ * so that it contains at least n_primes primes
+ */
+static uint32_t prime_table_bound(uint32_t n_primes) {
+
+  uint32_t bound = n_primes;
+
+  /* n / log(n) is an lower bound for the numbers of primes smaller than n */
+  while ((bound / log(bound)) < n_primes)
+    bound *= 2;
+
+  return bound;
+}
+
+/**
+ * rounds the given sieve size down to a multiple of 2 * cache_bits
+ * (extensions using only the half array)
+ */
+static uint32_t round_sieve_size(uint32_t sieve_size) {
+
+  sieve_size = (sieve_size / (2 * opts.cache_bits)) * (2 * opts.cache_bits);
+
+  return (sieve_size == 0) ? 2 * opts.cache_bits : sieve_size;
+}
+
+/**
+ * returns the bytes needed with the current sieve options and
+ * n_threads threads: the sieves are per thread, the prime table
+ * and the stats groups are shared
+ */
+static uint64_t memory_footprint(uint32_t n_threads) {
+
+  /* there are less than 1.25506 * n / log(n) primes below n (Rosser) */
+  uint32_t bound  = prime_table_bound(opts.sieve_primes);
+  uint64_t primes = 1.25506 * bound / log(bound);
+
+  uint64_t groups = (n_threads + STATS_GROUP_THREADS - 1) / 
+                    STATS_GROUP_THREADS;
+
+  return 2 * sizeof(uint32_t) * primes + 
+         groups * sizeof(StatsGroup) +
+         n_threads * sieve_memory(opts.sieve_size, 
+                                  opts.sieve_extensions,
+                                  opts.chain_length,
+                                  opts.sieve_primes);
+}
+
+/**
+ * whether the current options fit into --memory-limit
+ */
+static inline char fits_memory_limit() {
+  return memory_footprint(opts.num_threads) <= opts.memory_limit;
+}
+
+/**
+ * the candidates of one round over all running threads (relative),
+ * the extensions only use the upper half of the sieve
+ */
+static double round_candidates() {
+
+  long cpus                = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t running_threads = (cpus > 0 && opts.num_threads > cpus) ? 
+                             (uint32_t) cpus : opts.num_threads;
+
+  return running_threads * (double) opts.sieve_size * 
+         (1 + opts.sieve_extensions / 2.0);
+}
+
+/**
+ * reduces --sieve-extensions, --sieve-size and (only before the
+ * threads are started) --num-threads until the footprint fits into 
+ * --memory-limit, and reports the chosen layout
+ */
+static void fit_memory_limit(char startup) {
+
+  if (opts.memory_limit == 0)
+    return;
+
+  const uint32_t extensions = opts.sieve_extensions;
+  const uint32_t sieve_size = opts.sieve_size;
+  const uint32_t n_threads  = opts.num_threads;
+  const double   candidates = round_candidates();
+  const uint32_t min_size   = round_sieve_size(MEMORY_MIN_SIEVE_SIZE);
+  const uint32_t step       = 2 * opts.cache_bits;
+
+  /* the cheapest reductions first */
+  while (!fits_memory_limit() && 
+         opts.sieve_extensions > MEMORY_MIN_EXTENSIONS)
+    opts.sieve_extensions--;
+
+  while (!fits_memory_limit() && opts.sieve_size >= min_size + step)
+    opts.sieve_size -= step;
+
+  while (startup && !fits_memory_limit() && opts.num_threads > 1)
+    opts.num_threads--;
+
+  /* the smallest possible layout */
+  while (!fits_memory_limit() && opts.sieve_extensions > 0)
+    opts.sieve_extensions--;
+
+  while (!fits_memory_limit() && opts.sieve_size >= 2 * step)
+    opts.sieve_size -= step;
+
+  uint64_t footprint = memory_footprint(opts.num_threads);
+
+  if (footprint > opts.memory_limit) {
+    error_msg("[EE] --memory-limit %.1fMB is too small, at least %.1fMB "
+              "are needed\n",
+              opts.memory_limit / 1048576.0,
+              footprint / 1048576.0);
+
+    if (startup)
+      exit(EXIT_FAILURE);
+  }
+
+  if (opts.quiet)
+    return;
+
+  info_msg("memory: %.1fMB of %.1fMB with %" PRIu32 " threads, "
+           "sieve-size %" PRIu32 " and sieve-extensions %" PRIu32 "\n",
+           footprint / 1048576.0,
+           opts.memory_limit / 1048576.0,
+           opts.num_threads,
+           opts.sieve_size,
+           opts.sieve_extensions);
+
+  if (opts.num_threads      != n_threads  ||
+      opts.sieve_size       != sieve_size ||
+      opts.sieve_extensions != extensions)
+    info_msg("memory: reduced from %" PRIu32 " threads, sieve-size %" PRIu32 
+             " and sieve-extensions %" PRIu32 ", about %.0f%% fewer "
+             "candidates per round\n",
+             n_threads,
+             sieve_size,
+             extensions,
+             100 * (1 - round_candidates() / candidates));
+}
+
+/**
+ * initialize the parameters depending on the sieve options
+ * (--sieve-primes, --sieve-size, --cache-bits, --sieve-extensions
+ *  and --pool-share, which can be reloaded with --config)
+ */
+void init_sieve_parameters() {
+
+  /* the threads are started after the first initialization */
+  static char startup = 1;
 
   mpz_init(opts.mpz_primorial);
   mpz_init(opts.mpz_fixed_hash_multiplier);
+  mpz_init(opts.mpz_hash_primorial);
+
+  /* also for --config reloads */
+  if (opts.sieve_extensions > MAX_SIEVE_EXTENSIONS)
+    opts.sieve_extensions = MAX_SIEVE_EXTENSIONS;
 
   /* cache bits need to be a multiple of word_bits */
   opts.cache_bits = (opts.cache_bits / word_bits) * word_bits;
@@ -96,34 +306,41 @@ void init_program_parameters() {
   if (opts.cache_bits == 0)
     opts.cache_bits = word_bits;
 
-  /**
-   * sive size need to be a multiple of 2 * cache_bits 
-   * (extensions using only the half array)
-   */
-  opts.sieve_size = (opts.sieve_size / (2 * opts.cache_bits)) *
-                   (2 * opts.cache_bits);
+  /* sive size need to be a multiple of 2 * cache_bits */
+  opts.sieve_size = round_sieve_size(opts.sieve_size);
 
-  if (opts.sieve_size == 0)
-    opts.sieve_size = 2 * opts.cache_bits;
+  /* reduce the options to the --memory-limit */
+  fit_memory_limit(startup);
+  startup = 0;
 
   opts.sieve_words = (opts.sieve_size / word_bits);
 
   /* make sure enough primes are calculated */
-  uint32_t sieve_size = opts.sieve_primes;
+  uint32_t sieve_size = prime_table_bound(opts.sieve_primes);
 
-  /* n / log(n) is an lower bound for the numbers of primes smaller than n */
-  while ((sieve_size / log(sieve_size)) < opts.sieve_primes)
-    sieve_size *= 2;
+  /**
+   * load the prime table and the per prime constants from the cache
+   * or generate (and cache) them
+   */
+  if (!prime_cache_load(sieve_size)) {
 
-  /* generate the prime table */
-  opts.primes = gen_prime_table(sieve_size);
+    opts.primes       = gen_prime_table(sieve_size, opts.num_threads);
+    opts.two_inverses = opts.primes->two_inverses;
+    init_int64_arithmetic();
+    prime_cache_save(sieve_size);
+  }
 
   /* the highest prime index to sieve */
   opts.max_prime_index = opts.sieve_primes;
 
   /* generate the hash_primorial */
-  int_primorial(opts.primes, &opts.hash_primorial, opts.primes_in_hash);
+  primorial(opts.primes, opts.mpz_hash_primorial, 0, opts.primes_in_hash);
 
+  /* and split it into 64 bit factors for the header hash mining */
+  opts.hash_primorials   = malloc(sizeof(uint64_t) * opts.primes_in_hash);
+  opts.n_hash_primorials = word_primorials(opts.primes, 
+                                           opts.hash_primorials,
+                                           opts.primes_in_hash);
 
   /* generate the fixed hash multiplier */
   primorial(opts.primes, 
@@ -138,8 +355,8 @@ void init_program_parameters() {
    * (if the hash is divisible by more primes you have to multiply more
    *  primes for the primorial)
    */
-  for (; mpz_cmp_ui(opts.mpz_fixed_hash_multiplier, 
-                    opts.hash_primorial) <= 0; opts.primes_in_primorial++) {
+  for (; mpz_cmp(opts.mpz_fixed_hash_multiplier, 
+                 opts.mpz_hash_primorial) <= 0; opts.primes_in_primorial++) {
 
     primorial(opts.primes, 
               opts.mpz_fixed_hash_multiplier, 
@@ -147,26 +364,6 @@ void init_program_parameters() {
               opts.primes_in_primorial);
   } 
 
-  /**
-   * create the inverses of two for all used primes 
-   */
-  uint32_t i;
-  opts.two_inverses = malloc(sizeof(uint32_t) * opts.primes->len);
-
-  opts.int64_arithmetic = UINT32_MAX;
-
-  for (i = 0; i < opts.primes->len; i++) {
-    
-    opts.two_inverses[i] = (opts.primes->ptr[i] + 1) / 2;
-    
-    /* set the index after which we have to use 64 bit arithmetic */
-    if (opts.int64_arithmetic == UINT32_MAX &&
-        UINT32_MAX / opts.two_inverses[i] < opts.primes->ptr[i]) {
-
-      opts.int64_arithmetic = i;
-    }
-  }
-
   /** 
    * estimate the sieve percentage 
    * n / log(n) is a good approximation for the
@@ -175,6 +372,55 @@ void init_program_parameters() {
   opts.sieve_percentage = (opts.sieve_primes * 100) / 
                           (opts.sieve_size / log(opts.sieve_size));
 
+  /* init sieve globals */
+  init_sieve_globals();
+}
+
+/**
+ * frees the parameters depending on the sieve options
+ */
+void free_sieve_parameters() {
+  
+  mpz_clear(opts.mpz_primorial);
+  mpz_clear(opts.mpz_fixed_hash_multiplier);
+  mpz_clear(opts.mpz_hash_primorial);
+
+  free(opts.hash_primorials);
+
+  /* the cached prime table is mapped */
+  if (!prime_cache_free()) {
+    free(opts.primes->ptr);
+    free(opts.two_inverses);
+  }
+
+  free(opts.primes);
+
+  free_sieve_globals();
+}
+
+/**
+ * initialize program wide parameters
+ */
+static void init_program_parameters() {
+
+  /* init offset to zero */
+  opts.time_offset = 0;
+
+  /* calibrate the cycle counter of the latency histograms */
+  init_histograms();
+
+  init_sieve_parameters();
+
+  /* a round needs about twice the hash primorial of hashes */
+  if (opts.primes_in_hash > MAX_MINABLE_PRIMES_IN_HASH && 
+      !opts.bench_hash_sweep)
+    error_msg("[WW] --primes-in-hash %" PRIu32 " needs about %.1e hashes "
+              "per round, more than %d primes take hours per round and "
+              "thread\n",
+              opts.primes_in_hash,
+              2 * mpz_get_d(opts.mpz_hash_primorial),
+              MAX_MINABLE_PRIMES_IN_HASH);
+
   /* encrypt the password with sha1 */
   uint32_t *pwd_hash = (uint32_t *) SHA1((unsigned char *) opts.pool_pwd, 
                                          strlen(opts.pool_pwd),
@@ -188,9 +434,6 @@ void init_program_parameters() {
           pwd_hash[0] ^ pwd_hash[1] ^ pwd_hash[4],
           pwd_hash[2] ^ pwd_hash[3] ^ pwd_hash[4]);
 
-  /* init sieve globals */
-  init_sieve_globals();
-
   opts.start_time = time(NULL);
 }
 
@@ -199,19 +442,31 @@ void init_program_parameters() {
  */
 void free_opts() {
   
-  mpz_clear(opts.mpz_primorial);
-  mpz_clear(opts.mpz_fixed_hash_multiplier);
-
-  free(opts.primes->ptr);
-  free(opts.two_inverses);
-  free(opts.primes);
+  free_sieve_parameters();
   free(opts.pool_pwd);
-  free(opts.header);
-
-  free_sieve_globals();
 }
 
 
+/**
+ * returns $XDG_CACHE_HOME/xpminer or $HOME/.cache/xpminer
+ * (NULL if neither is set)
+ */
+static char *default_prime_cache_dir() {
+
+  static char dir[1024];
+  char *cache_home = getenv("XDG_CACHE_HOME");
+  char *home       = getenv("HOME");
+
+  if (cache_home != NULL && cache_home[0] != '\0')
+    snprintf(dir, sizeof(dir), "%s/xpminer", cache_home);
+  else if (home != NULL && home[0] != '\0')
+    snprintf(dir, sizeof(dir), "%s/.cache/xpminer", home);
+  else
+    return NULL;
+
+  return dir;
+}
+
 /**
  * read the command line options into a Opts structure
  */
@@ -221,6 +476,15 @@ void init_opts(int argc, char *argv[]) {
  
   int opt       = 0;
   int opt_index = 0;
+
+  /* --replay-speed 0 means as fast as possible */
+  char replay_speed_given = 0;
+
+  /* don't cache the prime table */
+  char no_prime_cache = 0;
+
+  /* use the best kernels for this cpu by default */
+  uint32_t cpu_features = CPU_AUTO;
  
   /* loop */
   for (;;) {
@@ -259,7 +523,8 @@ void init_opts(int argc, char *argv[]) {
         break;
 
       case NUM_THREADS:
-        opts.num_threads = atoi(optarg);
+        /* zero or less selects the default */
+        opts.num_threads = (atoi(optarg) > 0) ? atoi(optarg) : 0;
         break;
 
       case MINER_ID:
@@ -313,13 +578,143 @@ void init_opts(int argc, char *argv[]) {
       case QUIET:
         opts.quiet = 1;
         break;
+
+      case POOL_TIMEOUT:
+        opts.pool_timeout = atoi(optarg);
+        break;
+
+      case BENCHMARK:
+        opts.benchmark = 1;
+        break;
+
+      case BENCH_SEED:
+        opts.bench_seed = atoi(optarg);
+        break;
+
+      case BENCH_ROUNDS:
+        opts.bench_rounds = atoi(optarg);
+        break;
+
+      case BENCH_TIME:
+        opts.bench_time = atoi(optarg);
+        break;
+
+      case BENCH_HASH_SWEEP:
+        opts.bench_hash_sweep = atoi(optarg);
+        opts.benchmark        = 1;
+        break;
+
+      case RECORD:
+        opts.record_file = optarg;
+        break;
+
+      case REPLAY:
+        opts.replay_file = optarg;
+        break;
+
+      case REPLAY_SPEED:
+        opts.replay_speed  = atof(optarg);
+        replay_speed_given = 1;
+        break;
+
+      case PRIME_CACHE:
+        opts.prime_cache_dir = optarg;
+        break;
+
+      case NO_PRIME_CACHE:
+        no_prime_cache = 1;
+        break;
+
+      case CONFIG:
+        opts.config_file = optarg;
+        break;
+
+      case CPU_FEATURES:
+        if (!cpu_parse_level(optarg, &cpu_features)) {
+          error_msg("[EE] unknown --cpu-features %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case METRICS_PORT:
+        opts.metrics_port = atoi(optarg);
+        break;
+
+      case PRUNE_EXTENSIONS:
+        opts.prune_ratio = atof(optarg);
+        break;
+
+      case PROXY:
+        opts.proxy_port = atoi(optarg);
+        break;
+
+      case HOST_INDEX:
+        opts.host_index = atoi(optarg);
+        break;
+
+      case HOSTS:
+        opts.hosts = atoi(optarg);
+        break;
+
+      case PROCESS_INDEX:
+        opts.process_index = atoi(optarg);
+        break;
+
+      case PROCESSES:
+        opts.processes = atoi(optarg);
+        break;
+
+      case BACKGROUND:
+        opts.background = 1;
+        break;
+
+      case CPU_BUDGET:
+        opts.cpu_budget = atof(optarg);
+        break;
+
+      case MEMORY_LIMIT:
+        opts.memory_limit = (atof(optarg) > 0) ? atof(optarg) * 1048576 : 0;
+        break;
     }
   }
 
-  /* exit if not all neccesary options ar given */
-  if (opts.pool_ip   == NULL || 
-      opts.pool_port == 0    || 
-      opts.pool_user == NULL) {
+  /* a replay can't be recorded */
+  if (opts.replay_file != NULL && opts.record_file != NULL) {
+    error_msg("[EE] --record and --replay can't be used together\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* a benchmark has no work to forward */
+  if (opts.proxy_port != 0 && opts.benchmark) {
+    error_msg("[EE] --proxy can't be used with --benchmark\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* parked threads would falsify the benchmark */
+  if ((opts.background || opts.cpu_budget != 0) && opts.benchmark) {
+    error_msg("[EE] --background and --cpu-budget can't be used with "
+              "--benchmark\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (opts.cpu_budget < 0 || opts.cpu_budget > 100) {
+    error_msg("[EE] --cpu-budget has to be between 0 and 100\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* background mining fills up the whole machine by default */
+  if (opts.background && opts.cpu_budget == 0)
+    opts.cpu_budget = 100;
+
+  /**
+   * exit if not all neccesary options ar given 
+   * (benchmark and replay run offline) 
+   */
+  if (!opts.benchmark &&
+      opts.replay_file == NULL &&
+      (opts.pool_ip   == NULL || 
+       opts.pool_port == 0    || 
+       opts.pool_user == NULL)) {
 
     print_help();
   }
@@ -331,9 +726,40 @@ void init_opts(int argc, char *argv[]) {
   if (opts.pool_pwd == NULL)
     opts.pool_pwd = "very insecure!!!";
 
-  if (opts.num_threads <= 0)
+  if (opts.num_threads == 0)
     opts.num_threads = DEFAULT_NUM_THREADS;
 
+  /* the header space partition of this host and process (see block.h) */
+  if (opts.hosts == 0)
+    opts.hosts = 1;
+
+  if (opts.hosts > MAX_HOSTS) {
+    error_msg("[EE] --hosts has to be at most %u\n", MAX_HOSTS);
+    exit(EXIT_FAILURE);
+  }
+
+  if (opts.host_index >= opts.hosts) {
+    error_msg("[EE] --host-index has to be less than --hosts\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (opts.host_bits = 0; (1U << opts.host_bits) < opts.hosts; )
+    opts.host_bits++;
+
+  if (opts.processes == 0)
+    opts.processes = 1;
+
+  if (opts.process_index >= opts.processes) {
+    error_msg("[EE] --process-index has to be less than --processes\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (partition_stride(opts.num_threads) > MAX_PARTITION_STRIDE) {
+    error_msg("[EE] --processes * --num-threads has to be at most %d\n",
+              MAX_PARTITION_STRIDE);
+    exit(EXIT_FAILURE);
+  }
+
   if (opts.sieve_extensions <= 0)
     opts.sieve_extensions = DEFAULT_SIEVE_EXTENSIONS;
 
@@ -349,6 +775,9 @@ void init_opts(int argc, char *argv[]) {
   if (opts.primes_in_hash > MAX_NUM_PRIMES_IN_HASH)
     opts.primes_in_hash = MAX_NUM_PRIMES_IN_HASH;
 
+  if (opts.bench_hash_sweep > MAX_NUM_PRIMES_IN_HASH)
+    opts.bench_hash_sweep = MAX_NUM_PRIMES_IN_HASH;
+
   if (opts.primes_in_primorial <= 0)
     opts.primes_in_primorial = DEFAULT_NUM_PRIMES_IN_PRIMORIAL;
 
@@ -364,6 +793,29 @@ void init_opts(int argc, char *argv[]) {
   if (opts.pool_share <= 0)
     opts.pool_share = DEFAULT_POOL_SHARE;
 
+  if (opts.pool_timeout <= 0)
+    opts.pool_timeout = DEFAULT_POOL_TIMEOUT;
+
+  /* replay in real time by default */
+  if (opts.replay_speed < 0)
+    opts.replay_speed = 0;
+  else if (opts.replay_speed == 0 && !replay_speed_given)
+    opts.replay_speed = 1;
+
+  /* cache the prime table in the users cache directory by default */
+  if (no_prime_cache)
+    opts.prime_cache_dir = NULL;
+  else if (opts.prime_cache_dir == NULL)
+    opts.prime_cache_dir = default_prime_cache_dir();
+
+  /* select the kernel variants before the sieve globals get initialized */
+  opts.cpu_level = cpu_select_level(cpu_features);
+
+  /* a time limited benchmark runs as many rounds as possible */
+  if (opts.bench_rounds == 0)
+    opts.bench_rounds = (opts.bench_time > 0) ? UINT32_MAX : 
+                                                DEFAULT_BENCH_ROUNDS;
+
 
   /* init program wide parameters */
   init_program_parameters();
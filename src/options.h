@@ -34,6 +34,21 @@ struct MiningStats {
   uint64_t rejected;
   uint64_t stale;
   uint64_t block;
+  uint64_t reconnects;
+  uint64_t disconnected_time; /* in microseconds */
+
+  /* share submission */
+  uint64_t submitted;       /* shares send to the pool                    */
+  uint64_t dropped;         /* shares lost because of a full share queue  */
+  uint64_t stale_dropped;   /* shares not send because of replaced work   */
+
+  /* downstream miners (--proxy) */
+  uint32_t proxy_miners;    /* connected downstream miners                */
+  uint64_t proxy_shares;    /* shares received from downstream miners     */
+  uint64_t proxy_invalid;   /* invalid downstream shares (not forwarded)  */
+  uint64_t submit_time;     /* sum of usecs from queuing till send        */
+  uint64_t ack_time;        /* sum of usecs from queuing till pool result */
+  uint32_t queue_depth_max; /* maximum number of queued shares            */
 };
 
 /**
@@ -57,11 +72,18 @@ struct Opts {
   char *pool_pwd;
 
   /* number of miner threads */
-  uint8_t num_threads;
+  uint32_t num_threads;
 
   /* miner id */
   uint16_t miner_id;
 
+  /* header space partition of this host and process (see block.h) */
+  uint32_t host_index;
+  uint32_t hosts;
+  uint32_t host_bits;
+  uint32_t process_index;
+  uint32_t processes;
+
   /* number of sieve extensions */
   uint32_t sieve_extensions;
 
@@ -109,6 +131,66 @@ struct Opts {
 
   /* min chain length to submit to the pool */
   uint32_t pool_share;
+
+  /* seconds without data from the pool until reconnecting */
+  uint32_t pool_timeout;
+
+  /* run an offline benchmark instead of mining */
+  char benchmark;
+
+  /* seed for the synthetic benchmark header */
+  uint32_t bench_seed;
+
+  /* number of benchmark rounds (sieve runs over all threads) */
+  uint32_t bench_rounds;
+
+  /* benchmark time limit in seconds (0 = none) */
+  uint32_t bench_time;
+
+  /* benchmark every --primes-in-hash up to this one (0 = none) */
+  uint32_t bench_hash_sweep;
+
+  /* file to record the received pool messages to */
+  char *record_file;
+
+  /* file to replay the pool messages from (instead of a pool) */
+  char *replay_file;
+
+  /* replay speed factor (0 = as fast as possible) */
+  double replay_speed;
+
+  /* directory of the prime table cache (NULL = no caching) */
+  char *prime_cache_dir;
+
+  /* file with sieve options to reload while mining (NULL = none) */
+  char *config_file;
+
+  /* instruction set level of the kernels (see cpu.h) */
+  uint32_t cpu_level;
+
+  /* localhost port of the metrics endpoint (0 = none) */
+  uint16_t metrics_port;
+
+  /* port for downstream miners (--proxy, 0 = disabled) */
+  uint16_t proxy_port;
+
+  /* run the miner threads with the lowest priority (--background) */
+  char background;
+
+  /* maximum bytes of memory to use (0 = no limit, see --memory-limit) */
+  uint64_t memory_limit;
+
+  /**
+   * percent of the machines cpu time the miner may fill up
+   * (0 = no throttling, see throttle.h)
+   */
+  double cpu_budget;
+
+  /**
+   * stop sieving extensions with less than prune_ratio times the
+   * chains per cpu second of extension 0 (0 = never)
+   */
+  double prune_ratio;
   
   /**
    * the target chain length to mine
@@ -121,7 +203,16 @@ struct Opts {
   uint32_t max_prime_index;
  
   /* the primorial trough which the header hash should be divisible */
-  uint32_t hash_primorial;            
+  mpz_t mpz_hash_primorial;
+
+  /**
+   * the hash primorial split into 64 bit factors
+   * (the header hash is checked against each of them while mining)
+   */
+  uint64_t *hash_primorials;
+
+  /* the number of 64 bit hash primorial factors */
+  uint32_t n_hash_primorials;
 
   /* the prime table with the first n primes */
   PrimeTable *primes;
@@ -156,11 +247,6 @@ struct Opts {
    */
   mpz_t mpz_fixed_hash_multiplier;
 
-  /**
-   * the block header we are mining for
-   */
-  BlockHeader *header;
-
   /**
    * Mining statistics
    */
@@ -197,4 +283,16 @@ void init_opts(int argc, char *argv[]);
  */
 void free_opts();
 
+/**
+ * initialize the parameters depending on the sieve options
+ * (--sieve-primes, --sieve-size, --cache-bits, --sieve-extensions
+ *  and --pool-share, which can be reloaded with --config)
+ */
+void init_sieve_parameters();
+
+/**
+ * frees the parameters depending on the sieve options
+ */
+void free_sieve_parameters();
+
 #endif /* __OPTIONS_H__ */
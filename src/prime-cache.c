@@ -0,0 +1,239 @@
+/**
+ * Implementation of the on disk cache of the prime table and the
+ * per prime constants.
+ *
+ * The cache is mapped read only, so all miner processes on a host
+ * share the same pages.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "main.h"
+
+/**
+ * the cache file header
+ */
+typedef struct {
+  char     magic[4];
+  uint32_t version;
+  uint32_t bound;
+  uint32_t len;
+  uint32_t int64_arithmetic;
+  uint32_t zero;
+  uint64_t checksum;
+} PrimeCacheHeader;
+
+/**
+ * the mapped cache file (NULL if not loaded)
+ */
+static void  *cache_map  = NULL;
+static size_t cache_size = 0;
+
+/**
+ * start value of the checksum
+ */
+#define CHECKSUM_INIT 0xcbf29ce484222325LU
+
+/**
+ * continues the checksum hash over the given words
+ * (64 bit FNV-1a over words instead of bytes)
+ */
+static uint64_t cache_checksum(uint64_t hash, 
+                               const uint32_t *words, 
+                               uint64_t len) {
+
+  uint64_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= words[i];
+    hash *= 0x100000001b3LU;
+  }
+
+  return hash;
+}
+
+/**
+ * writes the cache file name for the given bound into path
+ * returns 0 if caching is disabled
+ */
+static char cache_path(char *path, size_t size, uint32_t bound) {
+
+  if (opts.prime_cache_dir == NULL)
+    return 0;
+
+  snprintf(path,
+           size,
+           "%s/primes-%" PRIu32 ".v%d",
+           opts.prime_cache_dir,
+           bound,
+           PRIME_CACHE_VERSION);
+
+  return 1;
+}
+
+/**
+ * maps the cached prime table for the given bound (read only)
+ * and sets opts.primes, opts.two_inverses and opts.int64_arithmetic
+ * returns 0 if there is no valid cache
+ */
+char prime_cache_load(uint32_t bound) {
+
+  char path[1024];
+  if (!cache_path(path, sizeof(path), bound))
+    return 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(PrimeCacheHeader)) {
+    close(fd);
+    return 0;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return 0;
+
+  PrimeCacheHeader *header = (PrimeCacheHeader *) map;
+  uint32_t *data           = (uint32_t *) (header + 1);
+
+  /* silently regenerate broken or outdated caches */
+  if (memcmp(header->magic, PRIME_CACHE_MAGIC, 4) != 0 ||
+      header->version != PRIME_CACHE_VERSION           ||
+      header->bound   != bound                         ||
+      (size_t) st.st_size != sizeof(PrimeCacheHeader) +
+                             2 * sizeof(uint32_t) * (size_t) header->len ||
+      cache_checksum(CHECKSUM_INIT, 
+                     data, 
+                     2 * (uint64_t) header->len) != header->checksum) {
+
+    if (opts.verbose)
+      info_msg("ignoring invalid prime cache %s\n", path);
+
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  opts.primes               = malloc(sizeof(PrimeTable));
+  opts.primes->ptr          = data;
+  opts.primes->len          = header->len;
+  opts.primes->two_inverses = data + header->len;
+  opts.two_inverses         = opts.primes->two_inverses;
+  opts.int64_arithmetic = header->int64_arithmetic;
+
+  cache_map  = map;
+  cache_size = st.st_size;
+
+  return 1;
+}
+
+/**
+ * creates the given directory and its parent
+ * (ignores already existing ones)
+ */
+static char make_dirs(const char *dir) {
+
+  char parent[1024];
+  snprintf(parent, sizeof(parent), "%s", dir);
+
+  char *slash = strrchr(parent, '/');
+  if (slash != NULL && slash != parent) {
+    *slash = '\0';
+    mkdir(parent, 0755);
+  }
+
+  return (mkdir(dir, 0755) == 0 || errno == EEXIST);
+}
+
+/**
+ * writes the current prime table and per prime constants
+ * to the cache for the given bound
+ */
+void prime_cache_save(uint32_t bound) {
+
+  char path[1024], tmp_path[1100];
+  if (!cache_path(path, sizeof(path), bound))
+    return;
+
+  /* caching is only an optimization, so failing is fine */
+  if (!make_dirs(opts.prime_cache_dir))
+    return;
+
+  PrimeCacheHeader header;
+  memset(&header, 0, sizeof(PrimeCacheHeader));
+  memcpy(header.magic, PRIME_CACHE_MAGIC, 4);
+  header.version          = PRIME_CACHE_VERSION;
+  header.bound            = bound;
+  header.len              = opts.primes->len;
+  header.int64_arithmetic = opts.int64_arithmetic;
+
+  header.checksum = cache_checksum(CHECKSUM_INIT, 
+                                   opts.primes->ptr, 
+                                   header.len);
+  header.checksum = cache_checksum(header.checksum, 
+                                   opts.two_inverses, 
+                                   header.len);
+
+  /* processes starting at the same time must not see a partial file */
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, getpid());
+
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL)
+    return;
+
+  size_t len = header.len;
+  char ok    = 
+    fwrite(&header, sizeof(PrimeCacheHeader), 1, file)        == 1   &&
+    fwrite(opts.primes->ptr, sizeof(uint32_t), len, file)     == len &&
+    fwrite(opts.two_inverses, sizeof(uint32_t), len, file)    == len;
+
+  if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0) {
+
+    if (opts.verbose)
+      errno_msg("failed to write prime cache");
+
+    unlink(tmp_path);
+  }
+}
+
+/**
+ * unmaps the cache (if it was loaded)
+ * returns 0 if the prime table was not loaded from the cache
+ */
+char prime_cache_free() {
+
+  if (cache_map == NULL)
+    return 0;
+
+  munmap(cache_map, cache_size);
+  cache_map  = NULL;
+  cache_size = 0;
+
+  return 1;
+}
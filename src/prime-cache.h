@@ -0,0 +1,69 @@
+/**
+ * Header file of the on disk cache of the prime table and the
+ * per prime constants.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PRIME_CACHE_H__
+#define __PRIME_CACHE_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * The cache file format (all values in host byte order):
+ *
+ * file header:
+ *   4 byte  magic "XPMP"
+ *   4 byte  version
+ *   4 byte  prime table bound (all primes smaller than it are cached)
+ *   4 byte  number of primes n
+ *   4 byte  int64_arithmetic index
+ *   4 byte  zero
+ *   8 byte  checksum of the following data
+ *
+ * followed by:
+ *   n * 4 byte  the primes
+ *   n * 4 byte  the inverses of two
+ *
+ * there is one file per bound, so processes with different
+ * --sieve-primes don't overwrite each others cache, and a new
+ * version (for new per prime constants) uses new files.
+ */
+#define PRIME_CACHE_MAGIC   "XPMP"
+#define PRIME_CACHE_VERSION 2
+
+/**
+ * maps the cached prime table for the given bound (read only)
+ * and sets opts.primes, opts.two_inverses and opts.int64_arithmetic
+ * returns 0 if there is no valid cache
+ */
+char prime_cache_load(uint32_t bound);
+
+/**
+ * writes the current prime table and per prime constants
+ * to the cache for the given bound
+ */
+void prime_cache_save(uint32_t bound);
+
+/**
+ * unmaps the cache (if it was loaded)
+ * returns 0 if the prime table was not loaded from the cache
+ */
+char prime_cache_free();
+
+#endif /* __PRIME_CACHE_H__ */
@@ -1,6 +1,7 @@
 /**
- * Implementation of the default Sieve of Eratosthenes to generate
- * a prime table including all primes till a given number starting by 2.
+ * Implementation of a segmented, multi threaded Sieve of Eratosthenes
+ * to generate a prime table including all primes till a given number
+ * starting by 2.
  *
  * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
  * 
@@ -19,144 +20,268 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include <inttypes.h>
 #include <gmp.h>
 
 #include "main.h"
 
 /**
- * Sets the given bit-position in an byte array
+ * number of bytes of a sieve segment (fits into the L1 cache)
+ * each bit represents an odd number, so a segment covers
+ * SEGMENT_NUMBERS numbers
  */
-#define set_bit(ary, i) (ary[(i) >> 3] |= (1 << ((i) & 0x7)))
-    
-/**
- * Unset the given bit-position in an byte array
- */
-#define unset_bit(ary, i) (ary[(i) >> 3] &= ~(1 << ((i) & 0x7)))
+#define SEGMENT_BYTES   32768
+#define SEGMENT_WORDS   (SEGMENT_BYTES / sizeof(uint64_t))
+#define SEGMENT_NUMBERS (SEGMENT_BYTES * 8 * 2)
 
 /**
- * returns whether the given bit-position in a byte array is setted or not
+ * sets the given bit-position in an word array
  */
-#define bit_at(ary, i) (ary[(i) >> 3] & (1 << ((i) & 0x7)))
+#define set_bit(ary, i) (ary[(i) >> 6] |= (1LU << ((i) & 63)))
 
 /**
- * returns whether the given index is a prime or not
+ * the work of one prime table generation thread
  */
-#define is_prime(ary, i) !bit_at(ary, i)
+typedef struct {
 
-/**
- * generate the X**2
- */
-#define POW(X) ((X) * (X))
+  /* the odd primes up to the square root of the table bound */
+  uint32_t *base_primes;
+  uint32_t n_base_primes;
+
+  /* range of this thread (start is a multiple of SEGMENT_NUMBERS) */
+  uint64_t start;
+  uint64_t end;
+
+  /* the found primes and their inverses of two (growable) */
+  uint32_t *primes;
+  uint32_t *two_inverses;
+  uint32_t len;
+  uint32_t size;
+} GenArgs;
 
 /**
- * returns the number of primes in the sieve
+ * returns the odd primes smaller than limit
+ * (simple sieve, limit is at most 2^16)
  */
-static uint64_t count_sieve(uint8_t *ary, uint32_t sieve_size) {
+static uint32_t *gen_base_primes(uint32_t limit, uint32_t *len) {
 
-  /* 2 and 3 are not counted in the loop */
-  uint64_t i, n = 2;
+  uint8_t *composite = calloc(sizeof(uint8_t), limit + 1);
+  uint32_t *primes   = malloc(sizeof(uint32_t) * (limit / 2 + 1));
+  uint32_t i, p;
 
-  /** 
-   * run the sieve in steps of size 6 
-   * (each prime > 3 will be on one of the following places: 6n +/- 1)
-   */
-  for (i = 5; i < sieve_size; i += 4 ) {
+  *len = 0;
+  for (i = 3; i < limit; i += 2) {
 
-    /* check 6n - 1*/
-    if (is_prime(ary, i))
-      n++;
+    if (composite[i])
+      continue;
 
-    i += 2; /* check 6n + 1 */
-    if (is_prime(ary, i))
-      n++;
+    primes[(*len)++] = i;
+
+    for (p = i * i; p < limit; p += 2 * i)
+      composite[p] = 1;
   }
 
-  return n;
+  free(composite);
+  return primes;
 }
 
 /**
- * saves the primes and frees the sieve
+ * exits if an allocation for the prime table failed
  */
-static PrimeTable *save_primes(uint8_t *ary, uint32_t sieve_size) {
-  
-  PrimeTable *table = (PrimeTable *) malloc(sizeof(PrimeTable));
+static inline void check_alloc(void *ptr) {
 
-  if (table == NULL)
+  if (ptr == NULL) {
     errno_msg("failed to allocate space for the prime table");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * appends a prime and its per prime constants to the thread table
+ */
+static inline void append_prime(GenArgs *args, uint32_t prime) {
+
+  if (args->len == args->size) {
+    uint32_t size          = args->size * 2 + 1024;
+    uint32_t *primes       = realloc(args->primes, 
+                                     sizeof(uint32_t) * size);
+    check_alloc(primes);
+    args->primes = primes;
+
+    uint32_t *two_inverses = realloc(args->two_inverses, 
+                                     sizeof(uint32_t) * size);
+    check_alloc(two_inverses);
+    args->two_inverses = two_inverses;
+    args->size         = size;
+  }
+
+  args->primes[args->len]       = prime;
+  args->two_inverses[args->len] = (prime + 1) / 2;
+  args->len++;
+}
 
-  table->len = count_sieve(ary, sieve_size);
-  table->ptr = (uint32_t *) malloc(sizeof(uint32_t) * table->len);
+/**
+ * sieves the range of one thread segment by segment and collects
+ * the primes in ascending order
+ */
+static void *gen_primes_thread(void *thread_args) {
+
+  GenArgs *args     = (GenArgs *) thread_args;
+  uint64_t *segment = malloc(SEGMENT_BYTES);
+  uint64_t lo, hi, m;
+  uint32_t i, w;
+
+  /* about n / log(n) primes in the range */
+  args->size         = (args->end - args->start) / 
+                       log(args->end > 2 ? args->end : 3) * 1.2 + 1024;
+  args->primes       = malloc(sizeof(uint32_t) * args->size);
+  args->two_inverses = malloc(sizeof(uint32_t) * args->size);
+
+  check_alloc(segment);
+  check_alloc(args->primes);
+  check_alloc(args->two_inverses);
+
+  for (lo = args->start; lo < args->end; lo += SEGMENT_NUMBERS) {
+
+    hi = (lo + SEGMENT_NUMBERS < args->end) ? lo + SEGMENT_NUMBERS : 
+                                              args->end;
+
+    /* bit j represents the odd number lo + 2j + 1 */
+    uint32_t bits = (hi - lo) / 2;
+    memset(segment, 0, SEGMENT_BYTES);
 
-  /* 2 and 3 are not counted in the loop */
-  uint64_t i, n = 2;
-  table->ptr[0] = 2;
-  table->ptr[1] = 3;
+    for (i = 0; i < args->n_base_primes; i++) {
 
-  /** 
-   * run the sieve in steps of size 6 
-   * (each prime > 3 will be on one of the following places: 6n +/- 1)
-   */
-  for (i = 5; i < sieve_size; i += 4 ) {
+      uint64_t p     = args->base_primes[i];
+      uint64_t first = p * p;
 
-    /* check 6n - 1*/
-    if (is_prime(ary, i)) {
-      table->ptr[n] = i;
-      n++;
+      if (first >= hi)
+        break;
+
+      /* first odd multiple of p in the segment */
+      if (first < lo) {
+        first = ((lo + p - 1) / p) * p;
+
+        if (!(first & 1))
+          first += p;
+      }
+
+      for (m = first; m < hi; m += 2 * p)
+        set_bit(segment, (m - lo) / 2);
     }
 
-    i += 2; /* check 6n + 1 */
-    if (is_prime(ary, i)) {
-      table->ptr[n] = i;
-      n++;
+    /* collect the unmarked bits */
+    for (w = 0; w * 64 < bits; w++) {
+
+      uint64_t primes = ~segment[w];
+
+      if (bits - w * 64 < 64)
+        primes &= (1LU << (bits - w * 64)) - 1;
+
+      while (primes) {
+
+        uint64_t n = lo + 2 * (w * 64 + __builtin_ctzl(primes)) + 1;
+        primes    &= primes - 1;
+
+        /* 1 is not a prime */
+        if (n > 1)
+          append_prime(args, n);
+      }
     }
   }
 
-  free(ary);
-  return table;
+  free(segment);
+  return NULL;
 }
 
 /**
+ * generates a prime table with all primes smaller than sieve_size
+ * (and the inverses of two for each prime)
  * 
+ * the range is split into cache sized segments of odd numbers,
+ * which are sieved in parallel by n_threads threads
  */
-PrimeTable *gen_prime_table(uint32_t sieve_size) {
-
-  /* bit array for sieving */
-  uint8_t *ary = (uint8_t *) calloc(sizeof(uint8_t), sieve_size / 8 + 6);
-
-  if (ary == NULL) 
-    errno_msg("failed to allocate space for prime table generation");
-  
-  uint32_t i, p, limit = (uint32_t) (sqrt((double) sieve_size) + 1);
-
-  /* 0 and 1 are not primes */
-  set_bit(ary, 0);
-  set_bit(ary, 1);
-
-  /* sieve 2 and 3 first */
-  for (i = 2; i < 4; i++) 
-    for (p = POW(i); p < sieve_size; p += i)
-      set_bit(ary, p);
-
-  /** 
-   * now run the sieve in steps of size 6 
-   * (each prime > 3 will be on one of the following places: 6n +/- 1)
-   */
-  for (i = 5; i < limit; i += 4) {
-
-    /* test 6n - 1 */
-    if (is_prime(ary, i)) 
-      for (p = POW(i); p < sieve_size; p += i) 
-        set_bit(ary, p);
-
-    i += 2; /* test 6n + 1 */
-    if (is_prime(ary, i)) 
-      for (p = POW(i); p < sieve_size; p += i) 
-        set_bit(ary, p);
+PrimeTable *gen_prime_table(uint32_t sieve_size, uint32_t n_threads) {
+
+  PrimeTable *table = (PrimeTable *) malloc(sizeof(PrimeTable));
+  check_alloc(table);
+
+  /* primes up to the square root of sieve_size */
+  uint32_t n_base_primes;
+  uint32_t *base_primes = gen_base_primes(sqrt((double) sieve_size) + 2, 
+                                          &n_base_primes);
+
+  uint64_t n_segments = ((uint64_t) sieve_size + SEGMENT_NUMBERS - 1) / 
+                        SEGMENT_NUMBERS;
+
+  if (n_threads > n_segments) n_threads = n_segments;
+  if (n_threads == 0)         n_threads = 1;
+
+  GenArgs *args      = calloc(n_threads, sizeof(GenArgs));
+  pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+  uint32_t i;
+
+  check_alloc(args);
+  check_alloc(threads);
+
+  for (i = 0; i < n_threads; i++) {
+    args[i].base_primes   = base_primes;
+    args[i].n_base_primes = n_base_primes;
+    args[i].start         = (n_segments * i / n_threads) * SEGMENT_NUMBERS;
+    args[i].end           = (n_segments * (i + 1) / n_threads) * 
+                            SEGMENT_NUMBERS;
+
+    if (args[i].end > sieve_size)
+      args[i].end = sieve_size;
+
+    /* the calling thread takes the first range */
+    if (i > 0)
+      pthread_create(&threads[i], NULL, gen_primes_thread, &args[i]);
+  }
+
+  gen_primes_thread(&args[0]);
+
+  for (i = 1; i < n_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  /* 2 is the only even prime */
+  table->len = 1;
+  for (i = 0; i < n_threads; i++)
+    table->len += args[i].len;
+
+  table->ptr          = malloc(sizeof(uint32_t) * table->len);
+  table->two_inverses = malloc(sizeof(uint32_t) * table->len);
+
+  check_alloc(table->ptr);
+  check_alloc(table->two_inverses);
+
+  table->ptr[0]          = 2;
+  table->two_inverses[0] = 1;
+
+  /* the thread ranges are in ascending order */
+  uint32_t n = 1;
+  for (i = 0; i < n_threads; i++) {
+
+    memcpy(table->ptr + n, 
+           args[i].primes, 
+           sizeof(uint32_t) * args[i].len);
+    memcpy(table->two_inverses + n, 
+           args[i].two_inverses, 
+           sizeof(uint32_t) * args[i].len);
+
+    n += args[i].len;
+    free(args[i].primes);
+    free(args[i].two_inverses);
   }
 
-  return save_primes(ary, sieve_size);
+  free(base_primes);
+  free(threads);
+  free(args);
+
+  return table;
 }
 
 /**
@@ -176,14 +301,25 @@ void primorial(PrimeTable *primes,
 }
 
 /**
- * create an so called primorial 
- * (a composite number out of a given range of primes)
+ * splits the primorial of the first end primes into factors which
+ * fit into a 64 bit word, so that a number can be checked for
+ * divisibility with a few word sized modulo operations
+ *
+ * returns the number of factors stored in primorials
  */
-void int_primorial(PrimeTable *primes, uint32_t *primorial, uint32_t end) {
+uint32_t word_primorials(PrimeTable *primes, uint64_t *primorials, uint32_t end) {
 
-  *primorial = 1;
+  uint32_t i, n = 0;
+  primorials[0] = 1;
 
-  uint32_t i;
-  for (i = 0; i < end; i++)
-    *primorial *= primes->ptr[i];
+  for (i = 0; i < end; i++) {
+
+    /* start a new factor if the current one would overflow */
+    if (primorials[n] > UINT64_MAX / primes->ptr[i])
+      primorials[++n] = 1;
+
+    primorials[n] *= primes->ptr[i];
+  }
+
+  return n + 1;
 }
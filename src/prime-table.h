@@ -31,12 +31,16 @@
 struct PrimeTable {
   uint32_t *ptr;
   uint32_t len;
+
+  /* the inverses of two for each prime */
+  uint32_t *two_inverses;
 };
 
 /**
- * 
+ * generates a prime table with all primes smaller than sieve_size
+ * (and the inverses of two for each prime) using n_threads threads
  */
-PrimeTable *gen_prime_table(uint32_t sieve_size);
+PrimeTable *gen_prime_table(uint32_t sieve_size, uint32_t n_threads);
 
 /**
  * create an so called primorial 
@@ -48,9 +52,12 @@ void primorial(PrimeTable *primes,
                uint32_t end);
 
 /**
- * create an so called primorial 
- * (a composite number out of a given range of primes)
+ * splits the primorial of the first end primes into factors which
+ * fit into a 64 bit word, so that a number can be checked for
+ * divisibility with a few word sized modulo operations
+ *
+ * returns the number of factors stored in primorials
  */
-void int_primorial(PrimeTable *primes, uint32_t *primorial, uint32_t end);
+uint32_t word_primorials(PrimeTable *primes, uint64_t *primorials, uint32_t end);
 
 #endif /* __PRIME_TABLE_H__ */
@@ -0,0 +1,416 @@
+/**
+ * Implementation of the --proxy mode.
+ *
+ * One xpminer holds the pool connection and accepts downstream xpminers
+ * (which use it as their pool) with the server side of the protocol
+ * (server.c). The network thread handles both sides: work from the pool
+ * is published to the own miner threads and broadcasted downstream,
+ * downstream shares go through the same share queue as the own ones
+ * (tagged with the client), and the pool results get routed back.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "main.h"
+
+/**
+ * the per client state
+ */
+typedef struct {
+  uint32_t id; /* routes the pool results (never reused) */
+} ProxyClient;
+
+/**
+ * the id of the next downstream miner (0 are the own miner threads)
+ */
+static uint32_t next_id = 1;
+
+/**
+ * parameters for determining the chain type of downstream shares
+ * (only used by the verifier thread)
+ */
+static TestParams test_params;
+
+/**
+ * a downstream share, and its type and difficulty once it is verified
+ */
+typedef struct {
+  BlockHeader share;
+  uint32_t    client;
+  uint32_t    difficulty;
+  char        type;
+} ProxyShare;
+
+/**
+ * The chain tests of a share take milliseconds, so they don't run on the
+ * network thread, but on the verifier thread. The ring holds the verified
+ * shares in [head, verified), and the ones waiting for it in 
+ * [verified, tail). The verifier signals the network thread through
+ * verified_event, which is watched together with the downstream
+ * connections in proxy_epoll.
+ */
+static ProxyShare verify_ring[PROXY_VERIFY_QUEUE];
+static uint32_t   verify_head     = 0;
+static uint32_t   verify_verified = 0;
+static uint32_t   verify_tail     = 0;
+static char       verify_stop     = 0;
+
+static pthread_mutex_t verify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  verify_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t       verifier;
+
+static int verified_event = -1;
+static int proxy_epoll    = -1;
+
+/**
+ * sends the current work to new downstream miners
+ */
+static void proxy_hello(ServerClient *client) {
+
+  ProxyClient *proxy = calloc(1, sizeof(ProxyClient));
+
+  if (proxy == NULL) {
+    errno_msg("failed to allocate space for a downstream miner");
+    server_close(client);
+    return;
+  }
+
+  proxy->id    = next_id++;
+  client->data = proxy;
+
+  __atomic_add_fetch(&opts.stats.proxy_miners, 1, __ATOMIC_RELAXED);
+
+  if (!opts.quiet)
+    info_msg("[proxy] miner %s connected: %d threads, miner id %" PRIu16 
+             "\n",
+             client->user,
+             client->num_threads,
+             client->miner_id);
+
+  BlockHeader work;
+  uint64_t published;
+
+  /* otherwise the miner gets the next work */
+  if (read_work(&work, &published) != 0)
+    server_send_work(client, &work);
+}
+
+/**
+ * returns the downstream miner with the given id 
+ * (NULL if it disconnected)
+ */
+static ServerClient *proxy_client(uint32_t id) {
+
+  uint32_t i;
+  for (i = 0; i < server_clients(); i++) {
+
+    ServerClient *miner = server_client(i);
+    ProxyClient  *proxy = (ProxyClient *) miner->data;
+
+    if (proxy != NULL && proxy->id == id)
+      return miner;
+  }
+
+  return NULL;
+}
+
+/**
+ * returns the chain type with the highest difficulty of the given 
+ * share in type, and its difficulty (0 if it's no valid chain)
+ */
+static uint32_t verify_share(BlockHeader *share, char *type) {
+
+  static const char types[] = { 
+    FIRST_CUNNINGHAM_CHAIN, 
+    SECOND_CUNNINGHAM_CHAIN, 
+    BI_TWIN_CHAIN 
+  };
+
+  /* the share doesn't contain its chain type */
+  uint32_t difficulty = 0;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(types); i++) {
+
+    uint32_t type_difficulty = get_share_difficulty(share, 
+                                                    types[i], 
+                                                    &test_params);
+
+    if (type_difficulty > difficulty) {
+      difficulty = type_difficulty;
+      *type      = types[i];
+    }
+  }
+
+  return difficulty;
+}
+
+/**
+ * verifies the queued downstream shares
+ */
+static void *verifier_thread(void *arg) {
+
+  (void) arg;
+
+  pthread_mutex_lock(&verify_mutex);
+
+  for (;;) {
+
+    while (!verify_stop && verify_verified == verify_tail)
+      pthread_cond_wait(&verify_cond, &verify_mutex);
+
+    if (verify_stop)
+      break;
+
+    /* the network thread doesn't touch the slot until it's verified */
+    ProxyShare *slot = &verify_ring[verify_verified % PROXY_VERIFY_QUEUE];
+    pthread_mutex_unlock(&verify_mutex);
+
+    slot->type       = 0;
+    slot->difficulty = verify_share(&slot->share, &slot->type);
+
+    pthread_mutex_lock(&verify_mutex);
+    verify_verified++;
+
+    /* wake up the network thread */
+    uint64_t count = 1;
+    if (write(verified_event, &count, sizeof(uint64_t)) < 0 && 
+        errno != EAGAIN) {
+
+      errno_msg("failed to signal a verified share");
+    }
+  }
+
+  pthread_mutex_unlock(&verify_mutex);
+  return NULL;
+}
+
+/**
+ * queues a downstream share for the verifier thread
+ */
+static void proxy_share(ServerClient *client, BlockHeader *share) {
+
+  ProxyClient *proxy = (ProxyClient *) client->data;
+
+  __atomic_add_fetch(&opts.stats.proxy_shares, 1, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock(&verify_mutex);
+
+  /* the verifier can't keep up */
+  if (verify_tail - verify_head == PROXY_VERIFY_QUEUE) {
+
+    pthread_mutex_unlock(&verify_mutex);
+
+    __atomic_add_fetch(&opts.stats.dropped, 1, __ATOMIC_RELAXED);
+    error_msg("[EE] dropped share from miner %s: verify queue full\n",
+              client->user);
+    server_send_share_info(client, -1);
+    return;
+  }
+
+  ProxyShare *slot = &verify_ring[verify_tail % PROXY_VERIFY_QUEUE];
+  memcpy(&slot->share, share, sizeof(BlockHeader));
+  slot->client = proxy->id;
+
+  verify_tail++;
+  pthread_cond_signal(&verify_cond);
+  pthread_mutex_unlock(&verify_mutex);
+}
+
+/**
+ * queues the verified shares for the pool, and answers the invalid ones
+ * (only called by the network thread)
+ */
+static void submit_verified_shares() {
+
+  uint64_t count;
+  if (read(verified_event, &count, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+    errno_msg("failed to read the verified share event");
+
+  for (;;) {
+
+    pthread_mutex_lock(&verify_mutex);
+
+    if (verify_head == verify_verified) {
+      pthread_mutex_unlock(&verify_mutex);
+      return;
+    }
+
+    ProxyShare verified = verify_ring[verify_head % PROXY_VERIFY_QUEUE];
+    verify_head++;
+
+    pthread_mutex_unlock(&verify_mutex);
+
+    /* invalid shares would only count against us at the pool */
+    if (verified.difficulty == 0) {
+
+      ServerClient *miner = proxy_client(verified.client);
+
+      __atomic_add_fetch(&opts.stats.proxy_invalid, 1, __ATOMIC_RELAXED);
+      error_msg("[EE] invalid share from miner %s\n", 
+                miner != NULL ? miner->user : "(disconnected)");
+
+      if (miner != NULL)
+        server_send_share_info(miner, 0);
+      continue;
+    }
+
+    /* work replaced or share queue full */
+    if (!submit_proxy_share(&verified.share, 
+                            verified.type, 
+                            verified.difficulty, 
+                            verified.client))
+      proxy_share_result(verified.client, -1);
+  }
+}
+
+/**
+ * frees the state of a disconnected miner
+ */
+static void proxy_closed(ServerClient *client) {
+
+  if (client->data == NULL)
+    return;
+
+  __atomic_sub_fetch(&opts.stats.proxy_miners, 1, __ATOMIC_RELAXED);
+
+  if (!opts.quiet)
+    info_msg("[proxy] miner %s disconnected\n", client->user);
+
+  free(client->data);
+  client->data = NULL;
+}
+
+/**
+ * closes the downstream connections and the verified share event
+ */
+static void free_proxy_events() {
+
+  server_shutdown();
+
+  if (verified_event >= 0) close(verified_event);
+  if (proxy_epoll    >= 0) close(proxy_epoll);
+
+  verified_event = -1;
+  proxy_epoll    = -1;
+}
+
+/**
+ * starts listening for downstream miners on the given port
+ * returns a file descriptor which gets readable on downstream events
+ * (see proxy_poll) or -1 on failure
+ */
+int init_proxy(uint16_t port) {
+
+  ServerHandlers handlers = { proxy_hello, proxy_share, proxy_closed };
+
+  if (server_init(port, &handlers) != 0)
+    return -1;
+
+  verified_event = eventfd(0, EFD_NONBLOCK);
+  proxy_epoll    = epoll_create1(0);
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events  = EPOLLIN;
+  event.data.fd = verified_event;
+
+  if (verified_event < 0 || 
+      proxy_epoll < 0 || 
+      epoll_ctl(proxy_epoll, EPOLL_CTL_ADD, verified_event, &event) < 0) {
+
+    errno_msg("failed to create the verified share event");
+    free_proxy_events();
+    return -1;
+  }
+
+  /* the epoll instance of the server gets readable on client events */
+  event.data.fd = server_fd();
+  if (epoll_ctl(proxy_epoll, EPOLL_CTL_ADD, server_fd(), &event) < 0) {
+    errno_msg("failed to watch the downstream miners");
+    free_proxy_events();
+    return -1;
+  }
+
+  init_test_params(&test_params);
+
+  verify_head = verify_verified = verify_tail = 0;
+  verify_stop = 0;
+  pthread_create(&verifier, NULL, verifier_thread, NULL);
+
+  if (!opts.quiet)
+    info_msg("[proxy] waiting for miners on port %" PRIu16 "\n", port);
+
+  return proxy_epoll;
+}
+
+/**
+ * handles the pending downstream events and verified shares 
+ * without blocking
+ */
+void proxy_poll() {
+
+  submit_verified_shares();
+
+  if (server_poll(0) < 0)
+    errno_msg("failed to poll downstream miners");
+}
+
+/**
+ * sends new work to all downstream miners
+ */
+void proxy_broadcast_work(BlockHeader *header) {
+  server_broadcast_work(header);
+}
+
+/**
+ * sends the pool result of a share to the downstream miner 
+ * which found it (if it is still connected)
+ */
+void proxy_share_result(uint32_t client, int32_t result) {
+
+  ServerClient *miner = proxy_client(client);
+
+  if (miner != NULL)
+    server_send_share_info(miner, result);
+}
+
+/**
+ * closes all downstream connections
+ */
+void free_proxy() {
+
+  if (proxy_epoll < 0)
+    return;
+
+  pthread_mutex_lock(&verify_mutex);
+  verify_stop = 1;
+  pthread_cond_signal(&verify_cond);
+  pthread_mutex_unlock(&verify_mutex);
+
+  pthread_join(verifier, NULL);
+
+  clear_test_params(&test_params);
+  free_proxy_events();
+}
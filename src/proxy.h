@@ -0,0 +1,63 @@
+/**
+ * Header file of the --proxy mode (share aggregator for downstream miners).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * the downstream shares waiting for the verifier thread
+ * (more get answered as stale)
+ */
+#define PROXY_VERIFY_QUEUE 64
+
+/**
+ * starts listening for downstream miners on the given port
+ * returns a file descriptor which gets readable on downstream events
+ * (see proxy_poll) or -1 on failure
+ */
+int init_proxy(uint16_t port);
+
+/**
+ * handles the pending downstream events and verified shares 
+ * without blocking (only called by the network thread)
+ */
+void proxy_poll();
+
+/**
+ * sends new work to all downstream miners
+ * (only called by the network thread)
+ */
+void proxy_broadcast_work(BlockHeader *header);
+
+/**
+ * sends the pool result of a share to the downstream miner 
+ * which found it (if it is still connected)
+ * (only called by the network thread)
+ */
+void proxy_share_result(uint32_t client, int32_t result);
+
+/**
+ * closes all downstream connections
+ */
+void free_proxy();
+
+#endif /* __PROXY_H__ */
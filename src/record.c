@@ -0,0 +1,160 @@
+/**
+ * Implementation of recording and replaying the messages received
+ * from the pool.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+
+/**
+ * the record and replay files
+ */
+static FILE *record_file = NULL;
+static FILE *replay_file = NULL;
+
+/**
+ * start time of the recording (in microseconds)
+ */
+static uint64_t record_start = 0;
+
+/**
+ * opens the given file for recording
+ * returns 0 on failure
+ */
+char record_open(const char *file) {
+
+  record_file = fopen(file, "wb");
+
+  if (record_file == NULL) {
+    errno_msg("failed to open record file");
+    return 0;
+  }
+
+  uint32_t version = RECORD_VERSION;
+  record_start     = gettime_usec();
+
+  if (fwrite(RECORD_MAGIC, 4, 1, record_file)                 != 1 ||
+      fwrite(&version, sizeof(uint32_t), 1, record_file)      != 1 ||
+      fwrite(&record_start, sizeof(uint64_t), 1, record_file) != 1) {
+
+    errno_msg("failed to write record file");
+    record_close();
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * appends a received message to the record file
+ */
+void record_msg(const uint8_t *msg, uint16_t len) {
+
+  if (record_file == NULL) return;
+
+  uint64_t usec = gettime_usec() - record_start;
+
+  if (fwrite(&usec, sizeof(uint64_t), 1, record_file) != 1 ||
+      fwrite(&len, sizeof(uint16_t), 1, record_file)  != 1 ||
+      fwrite(msg, len, 1, record_file)                != 1 ||
+      fflush(record_file) != 0) {
+
+    /* don't stop mining because of a broken record */
+    errno_msg("failed to write record file, recording stopped");
+    record_close();
+  }
+}
+
+/**
+ * closes the record file
+ */
+void record_close() {
+
+  if (record_file != NULL)
+    fclose(record_file);
+
+  record_file = NULL;
+}
+
+/**
+ * opens the given record file for replaying
+ * returns 0 on failure
+ */
+char replay_open(const char *file) {
+
+  replay_file = fopen(file, "rb");
+
+  if (replay_file == NULL) {
+    errno_msg("failed to open replay file");
+    return 0;
+  }
+
+  char magic[4];
+  uint32_t version;
+  uint64_t start;
+
+  if (fread(magic, 4, 1, replay_file)                != 1 ||
+      fread(&version, sizeof(uint32_t), 1, replay_file) != 1 ||
+      fread(&start, sizeof(uint64_t), 1, replay_file)   != 1 ||
+      memcmp(magic, RECORD_MAGIC, 4) != 0 ||
+      version != RECORD_VERSION) {
+
+    error_msg("[EE] %s is not a valid record file\n", file);
+    replay_close();
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * reads the next message from the replay file
+ * returns the message length, 0 at the end of the file or -1 on failure
+ * (usec is set to the time since the start of the recording)
+ */
+int replay_read(uint8_t *msg, uint32_t size, uint64_t *usec) {
+
+  if (replay_file == NULL) return -1;
+
+  uint16_t len;
+
+  if (fread(usec, sizeof(uint64_t), 1, replay_file) != 1)
+    return feof(replay_file) ? 0 : -1;
+
+  if (fread(&len, sizeof(uint16_t), 1, replay_file) != 1 ||
+      len == 0 || len > size ||
+      fread(msg, len, 1, replay_file) != 1) {
+
+    error_msg("[EE] truncated or invalid replay file\n");
+    return -1;
+  }
+
+  return len;
+}
+
+/**
+ * closes the replay file
+ */
+void replay_close() {
+
+  if (replay_file != NULL)
+    fclose(replay_file);
+
+  replay_file = NULL;
+}
@@ -0,0 +1,77 @@
+/**
+ * Header file for recording and replaying the messages received
+ * from the pool.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * The record file format (all values in host byte order):
+ *
+ * file header:
+ *   4 byte  magic "XPMR"
+ *   4 byte  version
+ *   8 byte  start time of the recording (unix time in microseconds)
+ *
+ * followed by one entry per received message:
+ *   8 byte  microseconds since the start of the recording
+ *   2 byte  message length (including the message type)
+ *   n byte  the message (type + payload) as received from the pool
+ */
+#define RECORD_MAGIC   "XPMR"
+#define RECORD_VERSION 1
+
+/**
+ * opens the given file for recording
+ * returns 0 on failure
+ */
+char record_open(const char *file);
+
+/**
+ * appends a received message to the record file
+ */
+void record_msg(const uint8_t *msg, uint16_t len);
+
+/**
+ * closes the record file
+ */
+void record_close();
+
+/**
+ * opens the given record file for replaying
+ * returns 0 on failure
+ */
+char replay_open(const char *file);
+
+/**
+ * reads the next message from the replay file
+ * returns the message length, 0 at the end of the file or -1 on failure
+ * (usec is set to the time since the start of the recording)
+ */
+int replay_read(uint8_t *msg, uint32_t size, uint64_t *usec);
+
+/**
+ * closes the replay file
+ */
+void replay_close();
+
+#endif /* __RECORD_H__ */
@@ -0,0 +1,498 @@
+/**
+ * Implementation of the server side of the xolominer pool protocol
+ * (used by the mock pool).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "main.h"
+
+/**
+ * maximum number of events handled per poll
+ */
+#define MAX_EVENTS 64
+
+/**
+ * the listening socket and the epoll instance
+ */
+static int server_socket = -1;
+static int server_epoll  = -1;
+
+/**
+ * the client event handlers
+ */
+static ServerHandlers server_handlers;
+
+/**
+ * the connected clients
+ */
+static ServerClient *clients[SERVER_MAX_CLIENTS];
+static uint32_t n_clients = 0;
+
+/**
+ * indicates whether closed clients have to be freed
+ */
+static char clients_closed = 0;
+
+/**
+ * starts listening on the given port
+ * returns 0 on success
+ */
+int server_init(uint16_t port, ServerHandlers *handlers) {
+
+  memcpy(&server_handlers, handlers, sizeof(ServerHandlers));
+
+  server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  server_epoll  = epoll_create1(0);
+
+  if (server_socket < 0 || server_epoll < 0) {
+    errno_msg("failed to create server socket");
+    return -1;
+  }
+
+  int optval = 1;
+  setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(int));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(struct sockaddr_in));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  /* the listening socket is the only event without a client */
+  struct epoll_event event;
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events   = EPOLLIN;
+  event.data.ptr = NULL;
+
+  if (bind(server_socket,
+           (struct sockaddr *) &addr,
+           sizeof(struct sockaddr_in)) < 0 ||
+      listen(server_socket, SOMAXCONN) < 0 ||
+      epoll_ctl(server_epoll, EPOLL_CTL_ADD, server_socket, &event) < 0) {
+
+    errno_msg("failed to listen on server port");
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * returns the epoll instance of the server, which gets readable on
+ * client events (to wait for them in an other event loop)
+ */
+int server_fd() {
+  return server_epoll;
+}
+
+/**
+ * (un)watch the client socket for writability
+ */
+static inline void client_want_write(ServerClient *client, char write) {
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(struct epoll_event));
+  event.events   = EPOLLIN | EPOLLRDHUP | (write ? EPOLLOUT : 0);
+  event.data.ptr = client;
+
+  epoll_ctl(server_epoll, EPOLL_CTL_MOD, client->sock, &event);
+}
+
+/**
+ * sends as much of the send buffer as possible
+ * returns 0 on failure
+ */
+static char client_flush(ServerClient *client) {
+
+  uint32_t had_data = client->send_len;
+
+  while (client->send_len > 0) {
+
+    int ret = send(client->sock,
+                   client->send_buffer,
+                   client->send_len,
+                   MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+
+      return 0;
+    }
+
+    client->send_len -= ret;
+    memmove(client->send_buffer,
+            client->send_buffer + ret,
+            client->send_len);
+  }
+
+  /* only touch the epoll set if something changed */
+  if ((had_data > 0) != (client->send_len > 0))
+    client_want_write(client, client->send_len > 0);
+
+  return 1;
+}
+
+/**
+ * queues the given message and sends it if possible
+ * returns 0 on failure (the client gets closed)
+ */
+static char client_send(ServerClient *client, uint8_t *msg, uint32_t len) {
+
+  if (client->closed)
+    return 0;
+
+  /* a client which doesn't read its messages is of no use */
+  if (client->send_len + len > SERVER_BUFFER_SIZE) {
+    error_msg("[EE] client %s too slow, closing connection\n", client->user);
+    server_close(client);
+    return 0;
+  }
+
+  memcpy(client->send_buffer + client->send_len, msg, len);
+  client->send_len += len;
+
+  if (!client_flush(client)) {
+    server_close(client);
+    return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * sends work to the given client
+ * returns 0 on failure (the client gets closed)
+ */
+char server_send_work(ServerClient *client, BlockHeader *header) {
+
+  uint8_t msg[1 + BLOCK_HEADER_LENGTH];
+
+  msg[0] = WORK_MSG;
+  memcpy(msg + 1, header, BLOCK_HEADER_LENGTH);
+
+  return client_send(client, msg, sizeof(msg));
+}
+
+/**
+ * sends a share result to the given client
+ * returns 0 on failure (the client gets closed)
+ */
+char server_send_share_info(ServerClient *client, int32_t result) {
+
+  uint8_t msg[1 + sizeof(int32_t)];
+
+  msg[0] = SHARE_INFO_MSG;
+  memcpy(msg + 1, &result, sizeof(int32_t));
+
+  return client_send(client, msg, sizeof(msg));
+}
+
+/**
+ * sends work to all clients which sent their hello
+ */
+void server_broadcast_work(BlockHeader *header) {
+
+  /* closing a client doesn't change the client list until the next poll */
+  uint32_t i;
+  for (i = 0; i < n_clients; i++)
+    if (clients[i]->hello_received)
+      server_send_work(clients[i], header);
+}
+
+/**
+ * closes the connection to the given client
+ * (the client gets freed after the current poll)
+ */
+void server_close(ServerClient *client) {
+
+  if (client->closed)
+    return;
+
+  /* closing removes the socket from the epoll set */
+  close(client->sock);
+  client->closed = 1;
+  clients_closed = 1;
+
+  if (server_handlers.closed != NULL)
+    server_handlers.closed(client);
+}
+
+/**
+ * frees all closed clients
+ */
+static void free_closed_clients() {
+
+  if (!clients_closed)
+    return;
+
+  int i;
+  for (i = n_clients - 1; i >= 0; i--) {
+
+    ServerClient *client = clients[i];
+
+    if (client->closed) {
+
+      /* move the last client into the gap */
+      n_clients--;
+      clients[i]        = clients[n_clients];
+      clients[i]->index = i;
+
+      free(client);
+    }
+  }
+
+  clients_closed = 0;
+}
+
+/**
+ * accepts all pending connections
+ */
+static void accept_clients() {
+
+  for (;;) {
+
+    int sock = accept4(server_socket, NULL, NULL, SOCK_NONBLOCK);
+
+    if (sock < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        errno_msg("failed to accept client");
+
+      return;
+    }
+
+    if (n_clients >= SERVER_MAX_CLIENTS) {
+      error_msg("[EE] too many clients, connection refused\n");
+      close(sock);
+      continue;
+    }
+
+    ServerClient *client = calloc(1, sizeof(ServerClient));
+    client->sock         = sock;
+    client->index        = n_clients;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events   = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = client;
+
+    if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, sock, &event) < 0) {
+      errno_msg("failed to watch client");
+      close(sock);
+      free(client);
+      continue;
+    }
+
+    clients[n_clients++] = client;
+  }
+}
+
+/**
+ * parses the hello message at the start of the receive buffer
+ * (the message format comes from xolominer, see send_hello in net.c)
+ * returns the hello length or 0 if it is incomplete
+ */
+static uint32_t parse_hello(ServerClient *client) {
+
+  uint8_t *hello = client->recv_buffer;
+
+  if (client->recv_len < 1)
+    return 0;
+
+  uint32_t user_len = hello[0];
+
+  if (client->recv_len < user_len + 21)
+    return 0;
+
+  uint32_t pwd_len = hello[user_len + 20];
+  uint32_t len     = user_len + HELLO_LENGTH + pwd_len;
+
+  if (client->recv_len < len)
+    return 0;
+
+  memcpy(client->user, hello + 1,              user_len);
+  memcpy(client->pwd,  hello + user_len + 21, pwd_len);
+  client->user[user_len] = '\0';
+  client->pwd[pwd_len]   = '\0';
+
+  client->version_major = hello[user_len + 2];
+  client->version_minor = hello[user_len + 3];
+  client->num_threads   = hello[user_len + 4];
+  client->pool_fee      = hello[user_len + 5];
+
+  memcpy(&client->miner_id,         hello + user_len + 6,  sizeof(uint16_t));
+  memcpy(&client->sieve_extensions, hello + user_len + 8,  sizeof(uint32_t));
+  memcpy(&client->sieve_percentage, hello + user_len + 12, sizeof(uint32_t));
+  memcpy(&client->sieve_size,       hello + user_len + 16, sizeof(uint32_t));
+
+  client->hello_received = 1;
+  return len;
+}
+
+/**
+ * handles the complete messages in the receive buffer
+ */
+static void process_client_msgs(ServerClient *client) {
+
+  while (!client->closed) {
+
+    uint32_t len;
+
+    if (!client->hello_received) {
+
+      if ((len = parse_hello(client)) == 0)
+        break;
+
+      if (server_handlers.hello != NULL)
+        server_handlers.hello(client);
+
+    /* everything after the hello is a share */
+    } else {
+
+      if (client->recv_len < BLOCK_HEADER_LENGTH)
+        break;
+
+      BlockHeader share;
+      memcpy(&share, client->recv_buffer, BLOCK_HEADER_LENGTH);
+      len = BLOCK_HEADER_LENGTH;
+
+      if (server_handlers.share != NULL)
+        server_handlers.share(client, &share);
+    }
+
+    client->recv_len -= len;
+    memmove(client->recv_buffer, client->recv_buffer + len, client->recv_len);
+  }
+}
+
+/**
+ * reads all available data of the given client
+ * returns 0 if the connection was closed
+ */
+static char client_recv(ServerClient *client) {
+
+  for (;;) {
+
+    int ret = recv(client->sock,
+                   client->recv_buffer + client->recv_len,
+                   SERVER_BUFFER_SIZE - client->recv_len,
+                   MSG_DONTWAIT);
+
+    if (ret == 0)
+      return 0;
+
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return 1;
+
+      return 0;
+    }
+
+    client->recv_len += ret;
+    process_client_msgs(client);
+
+    if (client->closed)
+      return 1;
+  }
+}
+
+/**
+ * waits at most timeout milliseconds for client events and handles them
+ * returns the number of handled events or -1 on failure
+ */
+int server_poll(int timeout) {
+
+  struct epoll_event events[MAX_EVENTS];
+
+  int ret = epoll_wait(server_epoll, events, MAX_EVENTS, timeout);
+
+  if (ret < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  int i;
+  for (i = 0; i < ret; i++) {
+
+    ServerClient *client = (ServerClient *) events[i].data.ptr;
+
+    if (client == NULL) {
+      accept_clients();
+      continue;
+    }
+
+    /* closed by an handler of an earlier event */
+    if (client->closed)
+      continue;
+
+    if ((events[i].events & EPOLLOUT) && !client_flush(client)) {
+      server_close(client);
+      continue;
+    }
+
+    /* read the remaining data before handling a hangup */
+    if ((events[i].events & EPOLLIN) && !client_recv(client)) {
+      server_close(client);
+      continue;
+    }
+
+    if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+      server_close(client);
+  }
+
+  free_closed_clients();
+  return ret;
+}
+
+/**
+ * returns the number of connected clients
+ */
+uint32_t server_clients() {
+  return n_clients;
+}
+
+/**
+ * returns the n-th connected client
+ */
+ServerClient *server_client(uint32_t n) {
+  return clients[n];
+}
+
+/**
+ * closes all connections and the server socket
+ */
+void server_shutdown() {
+
+  uint32_t i;
+  for (i = 0; i < n_clients; i++)
+    server_close(clients[i]);
+
+  free_closed_clients();
+
+  if (server_socket >= 0) close(server_socket);
+  if (server_epoll  >= 0) close(server_epoll);
+
+  server_socket = -1;
+  server_epoll  = -1;
+}
@@ -0,0 +1,154 @@
+/**
+ * Header file of the server side of the xolominer pool protocol
+ * (used by the mock pool).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * maximum number of connected clients
+ */
+#define SERVER_MAX_CLIENTS 1024
+
+/**
+ * size of the per client receive and send buffers
+ */
+#define SERVER_BUFFER_SIZE 4096
+
+/**
+ * length of the hello message without user name and password
+ * (see send_hello in net.c)
+ */
+#define HELLO_LENGTH 23
+
+/**
+ * a connected miner
+ */
+struct ServerClient {
+
+  int sock;
+
+  /* index in the client list */
+  uint32_t index;
+
+  /* client was closed, gets freed after the current poll */
+  char closed;
+
+  /* partial received messages */
+  uint8_t recv_buffer[SERVER_BUFFER_SIZE];
+  uint32_t recv_len;
+
+  /* data not yet send because the socket buffer was full */
+  uint8_t send_buffer[SERVER_BUFFER_SIZE];
+  uint32_t send_len;
+
+  /* the hello message of the client */
+  char hello_received;
+  char user[256];
+  char pwd[256];
+  uint8_t version_major;
+  uint8_t version_minor;
+  uint8_t num_threads;
+  uint8_t pool_fee;
+  uint16_t miner_id;
+  uint32_t sieve_extensions;
+  uint32_t sieve_percentage;
+  uint32_t sieve_size;
+
+  /* user data */
+  void *data;
+};
+
+/**
+ * callbacks for client events
+ * (all handlers are optional)
+ */
+struct ServerHandlers {
+
+  /* a client sent its hello message */
+  void (*hello)(ServerClient *client);
+
+  /* a client submitted a share */
+  void (*share)(ServerClient *client, BlockHeader *share);
+
+  /* a client disconnected (or was closed) */
+  void (*closed)(ServerClient *client);
+};
+
+/**
+ * starts listening on the given port
+ * returns 0 on success
+ */
+int server_init(uint16_t port, ServerHandlers *handlers);
+
+/**
+ * returns the epoll instance of the server, which gets readable on
+ * client events (to wait for them in an other event loop)
+ */
+int server_fd();
+
+/**
+ * waits at most timeout milliseconds for client events and handles them
+ * returns the number of handled events or -1 on failure
+ */
+int server_poll(int timeout);
+
+/**
+ * sends work to the given client
+ * returns 0 on failure (the client gets closed)
+ */
+char server_send_work(ServerClient *client, BlockHeader *header);
+
+/**
+ * sends a share result to the given client
+ * returns 0 on failure (the client gets closed)
+ */
+char server_send_share_info(ServerClient *client, int32_t result);
+
+/**
+ * sends work to all clients which sent their hello
+ */
+void server_broadcast_work(BlockHeader *header);
+
+/**
+ * closes the connection to the given client
+ * (the client gets freed after the current poll)
+ */
+void server_close(ServerClient *client);
+
+/**
+ * returns the number of connected clients
+ */
+uint32_t server_clients();
+
+/**
+ * returns the n-th connected client
+ * (n < server_clients(), the order changes when clients disconnect)
+ */
+ServerClient *server_client(uint32_t n);
+
+/**
+ * closes all connections and the server socket
+ */
+void server_shutdown();
+
+#endif /* __SERVER_H__ */
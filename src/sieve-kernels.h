@@ -0,0 +1,272 @@
+/**
+ * The hot sieve kernels.
+ *
+ * This file is included by sieve.c once per instruction set level
+ * (see cpu.h), with KERNEL(name) appending the level to the names and
+ * the target set by a pragma, so there is no include guard.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * sieves all primes in the given interval, and layer (cache optimization)
+ * for the given candidates array
+ */
+static void KERNEL(sieve_from_to)(sieve_t  *const   candidates,
+                                  uint32_t *const   multipliers,
+                                  const    uint32_t start,
+                                  const    uint32_t end,
+                                  const    uint32_t layer) {
+
+  /* wipe the array */
+  memset(candidates + word_index(start), 0, cache_bytes);
+
+  uint32_t i;
+  for (i = min_prime_index; i < max_prime_index; i++) {
+
+    /* current prime */
+    const uint32_t prime = primes[i];
+
+    /* current factor (from the inverse calculation) */
+    uint32_t factor = multipliers[i * layers + layer];
+
+    /* adjust factor for the given range */
+    if (factor < start)
+      factor += (start - factor + prime - 1) / prime * prime;
+
+    /* progress the given range of the sieve */
+    for (; factor < end; factor += prime) {
+
+      /* set sieve[factor] = composite */
+      word_at(candidates, factor) |= bit_word(factor);
+    }
+
+    /* save the factor for the next round */
+    multipliers[i * layers + layer] = factor;
+  }
+}
+
+/**
+ * applies the sieved cc1 and cc2 layers to the given candidates
+ * (in the word range [start, end))
+ */
+static void KERNEL(merge_layers)(sieve_t *const       cc2,
+                                 sieve_t *const       cc1,
+                                 const sieve_t *const cc2_layer,
+                                 const sieve_t *const cc1_layer,
+                                 const uint32_t       start,
+                                 const uint32_t       end) {
+
+  uint32_t w;
+  for (w = start; w < end; w++) {
+    cc2[w] |= cc2_layer[w];
+    cc1[w] |= cc1_layer[w];
+  }
+}
+
+/**
+ * dst |= src (in the word range [start, end))
+ */
+static void KERNEL(merge_words)(sieve_t *const       dst,
+                                const sieve_t *const src,
+                                const uint32_t       start,
+                                const uint32_t       end) {
+
+  uint32_t w;
+  for (w = start; w < end; w++)
+    dst[w] |= src[w];
+}
+
+/**
+ * creates the final set of candidates (in the word range [start, end))
+ */
+static void KERNEL(combine_candidates)(sieve_t *const       all,
+                                       const sieve_t *const cc1,
+                                       const sieve_t *const cc2,
+                                       const sieve_t *const twn,
+                                       const uint32_t       start,
+                                       const uint32_t       end) {
+
+  uint32_t w;
+  for (w = start; w < end; w++)
+    all[w] = cc1[w] & cc2[w] & twn[w];
+}
+
+/**
+ * sieves layer l of one cache-bits segment of the second half, and
+ * applies it to the normal sieve, the extensions it belongs to
+ * (e < l <= e + length) and the twn candidates
+ */
+static inline __attribute__((always_inline))
+void KERNEL(sieve_segment_layer)(Sieve *const   sieve,
+                                 const uint32_t word_start,
+                                 const uint32_t bit_start,
+                                 const uint32_t length,
+                                 const uint32_t n_extensions,
+                                 const uint32_t l) {
+
+  sieve_t *const cc1       = sieve->cc1;
+  sieve_t *const cc2       = sieve->cc2;
+  sieve_t *const twn       = sieve->twn;
+  sieve_t *const cc1_layer = sieve->cc1_layer;
+  sieve_t *const cc2_layer = sieve->cc2_layer;
+  sieve_t *const ext_cc1   = sieve->ext_cc1;
+  sieve_t *const ext_cc2   = sieve->ext_cc2;
+  sieve_t *const ext_twn   = sieve->ext_twn;
+
+  const uint32_t word_end = word_start + cache_words;
+  const uint32_t bit_end  = bit_start  + cache_bits;
+
+  /* see twn_cc1_layers and twn_cc2_layers */
+  const uint32_t twn_cc1 = (length + 1) / 2 - 1;
+  const uint32_t twn_cc2 = length       / 2 - 1;
+
+  uint32_t e;
+
+  /* sieve cc1 and cc2 layer l */
+  KERNEL(sieve_from_to)(cc2_layer, sieve->cc2_muls, bit_start, bit_end, l);
+  KERNEL(sieve_from_to)(cc1_layer, sieve->cc1_muls, bit_start, bit_end, l);
+
+  /* apply the layer to extension 0 (the normal sieve) */
+  if (l < length)
+    KERNEL(merge_layers)(cc2, cc1, cc2_layer, cc1_layer, 
+                         word_start, word_end);
+
+  /* copy the cc2 layers to the twn candidates */
+  if (l == twn_cc2)
+    memcpy(twn + word_start, cc2 + word_start, cache_bytes);
+
+  /* apply the cc1 layers to the twn candidates */
+  if (l == twn_cc1)
+    KERNEL(merge_words)(twn, cc1, word_start, word_end);
+
+  /* apply the layer to the extensions it belongs to */
+  for (e = (l > length) ? l - length : 0; e < l && e < n_extensions; e++)
+    KERNEL(merge_layers)(ext_cc2 + e * sieve_words, 
+                         ext_cc1 + e * sieve_words, 
+                         cc2_layer, 
+                         cc1_layer, 
+                         word_start, 
+                         word_end);
+
+  /* the extension for which this is the last cc2 twn layer */
+  e = l - 1 - twn_cc2;
+  if (l > twn_cc2 && e < n_extensions)
+    memcpy(ext_twn + e * sieve_words + word_start, 
+           ext_cc2 + e * sieve_words + word_start, 
+           cache_bytes);
+
+  /* the extension for which this is the last cc1 twn layer */
+  e = l - 1 - twn_cc1;
+  if (l > twn_cc1 && e < n_extensions)
+    KERNEL(merge_words)(ext_twn + e * sieve_words, 
+                        ext_cc1 + e * sieve_words, 
+                        word_start, 
+                        word_end);
+}
+
+/**
+ * sieves all layers of one cache-bits segment of the second half
+ *
+ * in the specializations (see SEGMENT_SPECIALIZATIONS) length and
+ * n_extensions are constants, so the layers get unrolled and the
+ * whole layer to extension schedule is resolved at compile time
+ */
+static inline __attribute__((always_inline))
+void KERNEL(sieve_segment_schedule)(Sieve *const   sieve,
+                                    const uint32_t word_start,
+                                    const uint32_t bit_start,
+                                    const uint32_t length,
+                                    const uint32_t n_extensions) {
+
+  uint32_t l;
+
+  if (__builtin_constant_p(length) && __builtin_constant_p(n_extensions)) {
+
+#pragma GCC unroll 64
+    for (l = 0; l < length + n_extensions; l++) {
+
+      /* stop on new work, shutdown or if the thread got parked */
+      if (!sieve_active(sieve))
+        return;
+
+      KERNEL(sieve_segment_layer)(sieve, 
+                                  word_start, 
+                                  bit_start, 
+                                  length, 
+                                  n_extensions, 
+                                  l);
+    }
+  } else {
+
+    for (l = 0; l < length + n_extensions; l++) {
+
+      if (!sieve_active(sieve))
+        return;
+
+      KERNEL(sieve_segment_layer)(sieve, 
+                                  word_start, 
+                                  bit_start, 
+                                  length, 
+                                  n_extensions, 
+                                  l);
+    }
+  }
+}
+
+/**
+ * the generic segment schedule (any chain length and extensions)
+ */
+static void KERNEL(sieve_segment)(Sieve *const   sieve,
+                                  const uint32_t word_start,
+                                  const uint32_t bit_start,
+                                  const uint32_t n_extensions) {
+
+  KERNEL(sieve_segment_schedule)(sieve, 
+                                 word_start, 
+                                 bit_start, 
+                                 chain_length, 
+                                 n_extensions);
+}
+
+/**
+ * the specialized segment schedules
+ */
+#define SEGMENT_KERNEL(length, n_extensions)                               \
+  static void KERNEL(sieve_segment_##length##_##n_extensions)(             \
+                                      Sieve *const   sieve,                \
+                                      const uint32_t word_start,           \
+                                      const uint32_t bit_start,            \
+                                      const uint32_t active) {             \
+    (void) active;                                                         \
+    KERNEL(sieve_segment_schedule)(sieve,                                  \
+                                   word_start,                             \
+                                   bit_start,                              \
+                                   length,                                 \
+                                   n_extensions);                          \
+  }
+
+SEGMENT_SPECIALIZATIONS(SEGMENT_KERNEL)
+#undef SEGMENT_KERNEL
+
+#define SEGMENT_ENTRY(length, n_extensions) \
+  { length, n_extensions, KERNEL(sieve_segment_##length##_##n_extensions) },
+
+static const SegmentSpecialization KERNEL(segment_specializations)[] = {
+  SEGMENT_SPECIALIZATIONS(SEGMENT_ENTRY)
+  { 0, 0, NULL }
+};
+#undef SEGMENT_ENTRY
@@ -16,12 +16,12 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-#include <sys/time.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <gmp.h>
+#include <math.h>
 
 #include "main.h"
 
@@ -38,18 +38,6 @@
  */
 #define bit_word(i) (((sieve_t) 1) << bit_index(i))
 
-/**
- * returns the current time in microseconds
- */
-static inline uint64_t gettime_usec() {
-
-  struct timeval time;
-  if (gettimeofday(&time, NULL) == -1)
-    return -1L;
-
-  return time.tv_sec * 1000000L + time.tv_usec;
-}
-
 /* the chain length we are sieving for */
 static uint32_t chain_length; 
 
@@ -163,6 +151,148 @@ static mpz_t mpz_fixed_hash_multiplier;
 static uint32_t twn_cc1_layers;
 static uint32_t twn_cc2_layers;
 
+/**
+ * the number of extensions which are still sieved and tested
+ * (lowered by prune_extensions, see --prune-extensions)
+ */
+static uint32_t active_extensions;
+
+/**
+ * the (chain length, extensions) pairs with a specialized segment
+ * schedule (the default and the current network difficulties, also
+ * with one extension pruned), the compiler unrolls the layer to
+ * extension schedule of these, the others use the generic one
+ * (each pair adds about 25KB of code per instruction set level)
+ */
+#define SEGMENT_SPECIALIZATIONS(X) \
+  X(10, 8) X(10, 9) X(10, 10)      \
+  X(11, 8) X(11, 9) X(11, 10)
+
+/**
+ * sieves one cache-bits segment of the second half with n_extensions
+ */
+typedef void (*SegmentKernel)(Sieve *const   sieve,
+                              const uint32_t word_start,
+                              const uint32_t bit_start,
+                              const uint32_t n_extensions);
+
+/**
+ * a specialized segment schedule
+ * (the tables end with a NULL kernel)
+ */
+typedef struct {
+  uint32_t      chain_length;
+  uint32_t      extensions;
+  SegmentKernel kernel;
+} SegmentSpecialization;
+
+/**
+ * the sieve kernels for each instruction set level (see cpu.h)
+ */
+#define KERNEL(name) name##_baseline
+#include "sieve-kernels.h"
+#undef KERNEL
+
+#if CPU_DISPATCH
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi2")
+#define KERNEL(name) name##_avx2
+#include "sieve-kernels.h"
+#undef KERNEL
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi2,avx512f,avx512bw,avx512vl,"\
+                   "prefer-vector-width=512")
+#define KERNEL(name) name##_avx512
+#include "sieve-kernels.h"
+#undef KERNEL
+#pragma GCC pop_options
+#endif
+
+/**
+ * the sieve kernels of one instruction set level
+ */
+typedef struct {
+
+  void (*sieve_from_to)(sieve_t  *const   candidates,
+                        uint32_t *const   multipliers,
+                        const    uint32_t start,
+                        const    uint32_t end,
+                        const    uint32_t layer);
+
+  void (*merge_layers)(sieve_t *const       cc2,
+                       sieve_t *const       cc1,
+                       const sieve_t *const cc2_layer,
+                       const sieve_t *const cc1_layer,
+                       const uint32_t       start,
+                       const uint32_t       end);
+
+  void (*merge_words)(sieve_t *const       dst,
+                      const sieve_t *const src,
+                      const uint32_t       start,
+                      const uint32_t       end);
+
+  void (*combine_candidates)(sieve_t *const       all,
+                             const sieve_t *const cc1,
+                             const sieve_t *const cc2,
+                             const sieve_t *const twn,
+                             const uint32_t       start,
+                             const uint32_t       end);
+
+  /* the generic and the specialized segment schedules */
+  SegmentKernel sieve_segment;
+  const SegmentSpecialization *segment_specializations;
+} SieveKernels;
+
+#define SIEVE_KERNELS(level)         \
+  { sieve_from_to_##level,           \
+    merge_layers_##level,            \
+    merge_words_##level,             \
+    combine_candidates_##level,      \
+    sieve_segment_##level,           \
+    segment_specializations_##level }
+
+static const SieveKernels sieve_kernels[CPU_LEVELS] = {
+  SIEVE_KERNELS(baseline),
+#if CPU_DISPATCH
+  SIEVE_KERNELS(avx2),
+  SIEVE_KERNELS(avx512)
+#endif
+};
+
+/* the kernels selected by init_sieve_globals */
+static SieveKernels kernels;
+
+/**
+ * the segment schedule for each number of active extensions
+ * (selected by init_sieve_globals, see prune_extensions)
+ */
+static SegmentKernel segment_kernels[MAX_SIEVE_EXTENSIONS + 1];
+
+/**
+ * returns the specialized segment schedule for the given chain length 
+ * and extensions, or NULL if there is none
+ */
+static SegmentKernel segment_specialization(uint32_t length, 
+                                            uint32_t n_extensions) {
+
+  const SegmentSpecialization *spec;
+  for (spec = kernels.segment_specializations; spec->kernel != NULL; spec++)
+    if (spec->chain_length == length && spec->extensions == n_extensions)
+      return spec->kernel;
+
+  return NULL;
+}
+
+/**
+ * returns whether the current chain length and extensions
+ * use a specialized segment schedule
+ */
+char sieve_segment_specialized() {
+  return segment_specialization(chain_length, extensions) != NULL;
+}
+
 /**
  * initializes the sieve global variables
  */
@@ -190,6 +320,21 @@ void init_sieve_globals() {
   cache_words          = word_index(cache_bits);
   cache_bytes          = byte_index(cache_bits); 
 
+  /* a reload gives pruned extensions a new chance */
+  __atomic_store_n(&active_extensions, extensions, __ATOMIC_RELAXED);
+
+  /* the kernels for the selected instruction set */
+  kernels = sieve_kernels[CPU_DISPATCH ? opts.cpu_level : CPU_BASELINE];
+
+  /* the segment schedules (pruning lowers the active extensions) */
+  uint32_t e;
+  for (e = 0; e <= extensions; e++) {
+    segment_kernels[e] = segment_specialization(chain_length, e);
+
+    if (segment_kernels[e] == NULL)
+      segment_kernels[e] = kernels.sieve_segment;
+  }
+
   /* calculate the bi-twin cc1 and cc2 layers */
   twn_cc1_layers = (chain_length + 1) / 2 - 1;
   twn_cc2_layers = chain_length       / 2 - 1;
@@ -199,6 +344,13 @@ void init_sieve_globals() {
   check_primes(primes, two_inverses, max_prime_index);
 }
 
+/**
+ * returns the number of extensions which are not pruned
+ */
+uint32_t sieve_active_extensions() {
+  return __atomic_load_n(&active_extensions, __ATOMIC_RELAXED);
+}
+
 /**
  * frees sieve globals
  */
@@ -307,12 +459,25 @@ static inline uint32_t invert(const uint32_t a, const uint32_t p) {
   return (inverse + p) % p;
 }
 
+/**
+ * returns the current time in microseconds
+ */
+uint64_t gettime_usec() {
+
+  struct timeval time;
+  if (gettimeofday(&time, NULL) == -1)
+    return -1L;
+
+  return time.tv_sec * 1000000L + time.tv_usec;
+}
+
 /**
  * sets a new header 
  */
 void sieve_set_header(Sieve *sieve, BlockHeader *header) {
 
   memcpy(&sieve->header, header, sizeof(BlockHeader));
+  header_hash_midstate(&sieve->header, &sieve->midstate);
 }
 
 /** 
@@ -341,18 +506,10 @@ void reinit_sieve(Sieve *sieve) {
 }
 
 /**
- * initializes a given sieve for the first time
+ * allocates the bit vectors and multipliers of the sieve
+ * (their size depends on the sieve globals)
  */
-void init_sieve(Sieve *sieve) {
-
-  memset(sieve, 0, sizeof(Sieve));
-  sieve_set_header(sieve, opts.header);
-    
-  mpz_init(sieve->mpz_test_origin);
-  mpz_init(sieve->mpz_multiplier);
-  mpz_init(sieve->mpz_reminder);
-  mpz_init(sieve->mpz_hash);
-  mpz_init(sieve->mpz_tmp);
+static void alloc_sieve_buffers(Sieve *sieve) {
 
   sieve->cc1 = (sieve_t *) malloc(candidate_bytes);
   sieve->cc2 = (sieve_t *) malloc(candidate_bytes);
@@ -370,17 +527,31 @@ void init_sieve(Sieve *sieve) {
   /* multiplicators (inverse) for cc1 and cc2 chains, for each layer */
   sieve->cc1_muls = malloc(sizeof(uint32_t) * layers * max_prime_index);
   sieve->cc2_muls = malloc(sizeof(uint32_t) * layers * max_prime_index);
+}
 
-  init_test_params(&sieve->test_params);
-
-  sieve->stats.start_time = gettime_usec();
-
+/**
+ * returns the bytes one miner thread allocates for a sieve with
+ * the given options (see alloc_sieve_buffers() and init_sieve())
+ */
+uint64_t sieve_memory(uint32_t sieve_size, 
+                      uint32_t extensions, 
+                      uint32_t chain_length, 
+                      uint32_t sieve_primes) {
+
+  uint64_t bytes  = sizeof(sieve_t) * (sieve_size / word_bits);
+  uint64_t layers = extensions + chain_length;
+
+  /* cc1, cc2, twn, all, the two layers and 4 arrays per extension */
+  return bytes * (6 + 4 * (uint64_t) extensions) +
+         2 * sizeof(uint32_t) * layers * sieve_primes +
+         HIST_STAGES * sizeof(Histogram) +
+         sizeof(MinerArgs);
 }
 
 /**
- * frees all used resources of the sieve
+ * frees the bit vectors and multipliers of the sieve
  */
-void free_sieve(Sieve *sieve) {
+static void free_sieve_buffers(Sieve *sieve) {
 
   free(sieve->cc1);
   free(sieve->cc2);
@@ -394,6 +565,52 @@ void free_sieve(Sieve *sieve) {
   free(sieve->ext_all);
   free(sieve->cc1_layer);
   free(sieve->cc2_layer);
+}
+
+/**
+ * initializes a given sieve for the first time
+ */
+void init_sieve(Sieve *sieve) {
+
+  memset(sieve, 0, sizeof(Sieve));
+    
+  mpz_init(sieve->mpz_test_origin);
+  mpz_init(sieve->mpz_multiplier);
+  mpz_init(sieve->mpz_reminder);
+  mpz_init(sieve->mpz_hash);
+  mpz_init(sieve->mpz_tmp);
+
+  alloc_sieve_buffers(sieve);
+  init_test_params(&sieve->test_params);
+
+  /* written by this thread only, so it's allocated (and touched) here */
+  sieve->hist = calloc(HIST_STAGES, sizeof(Histogram));
+
+  stats_set(sieve->stats.start_time, gettime_usec());
+
+}
+
+/**
+ * reallocates the sieve after the sieve globals changed
+ * (the header, the statistics and the prime test state are kept)
+ */
+void realloc_sieve(Sieve *sieve) {
+
+  free_sieve_buffers(sieve);
+  alloc_sieve_buffers(sieve);
+}
+
+/**
+ * frees all used resources of the sieve
+ */
+void free_sieve(Sieve *sieve) {
+
+  /* the last stats of the thread */
+  stats_group_flush(sieve, 1);
+
+  free_sieve_buffers(sieve);
+  free(sieve->queue);
+  free(sieve->hist);
 
   clear_test_params(&sieve->test_params);
 
@@ -405,60 +622,116 @@ void free_sieve(Sieve *sieve) {
 }
 
 /**
- * sieves all primes in the given interval, and layer (cache optimization)
- * for the given candidates array
+ * copies the stats of a (running) thread
+ * (each counter is read atomically, but not the whole snapshot)
  */
-static void sieve_from_to(sieve_t  *const   candidates,
-                          uint32_t *const   multipliers,
-                          const    uint32_t start,
-                          const    uint32_t end,
-                          const    uint32_t layer) {
+void sieve_stats_snapshot(SieveStats *snapshot, const SieveStats *stats) {
 
-  /* wipe the array */
-  memset(candidates + word_index(start), 0, cache_bytes);
+  const uint64_t *src = (const uint64_t *) stats;
+  uint64_t *dst       = (uint64_t *) snapshot;
 
   uint32_t i;
-  for (i = min_prime_index; i < max_prime_index; i++) {
+  for (i = 0; i < sizeof(SieveStats) / sizeof(uint64_t); i++)
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
 
-    /* current prime */
-    const uint32_t prime = primes[i];
-    
-    /* current factor (from the inverse calculation) */
-    uint32_t factor = multipliers[i * layers + layer];
+/**
+ * the value of a candidate is rated by its type, and its size:
+ * a share needs pool_share primes, each with a chance of 1 / ln(N),
+ * and a fermat test costs about (log N)^3, so a candidate gets
+ *
+ *   log2(type yield) - (pool_share + 3) * log2(log2(N))
+ *
+ * the numbers are stored relative to the best possible value
+ * in QUEUE_RESOLUTION steps per log2 unit
+ */
+static inline uint64_t candidate_priority(const double *const type_score,
+                                          const uint32_t type,
+                                          const uint32_t index,
+                                          const uint32_t extension,
+                                          const uint32_t base_bits) {
+
+  /* index 0 is always marked composite, but log2(0) would be -inf */
+  double index_bits = (index > 0) ? log2(index) : 0;
+
+  double size  = log2((base_bits + index_bits + extension) / base_bits);
+  double score = type_score[type] + (pool_share + 3) * size;
+  double steps = score * QUEUE_RESOLUTION;
+
+  return (steps < QUEUE_MAX_PRIORITY) ? (uint64_t) steps : QUEUE_MAX_PRIORITY;
+}
+
+/**
+ * rates the candidate types by the chains per test the thread found 
+ * so far (type_score is the log2 distance to the best type)
+ *
+ * like prune_extensions the chains are counted from the longest length
+ * up to pool_share at which all types have PRUNE_MIN_CHAINS chains,
+ * all types are equal until then
+ */
+static void rate_candidate_types(const SieveStats *const stats, 
+                                 double *const type_score) {
 
-    /* adjust factor for the given range */
-    if (factor < start)
-      factor += (start - factor + prime - 1) / prime * prime;
+  const uint64_t *chains[CANDIDATE_TYPES] = { 
+    stats->twn, 
+    stats->cc1, 
+    stats->cc2 
+  };
 
-    /* progress the given range of the sieve */
-    for (; factor < end; factor += prime) {
+  uint32_t length, type, n;
+  for (length = pool_share; length > 0; length--) {
 
-      /* set sieve[factor] = composite */
-      word_at(candidates, factor) |= bit_word(factor);
+    for (type = 0; type < CANDIDATE_TYPES; type++) {
+
+      uint64_t found = 0;
+      for (n = length; n < MAX_CHAIN_LENGTH; n++)
+        found += chains[type][n];
+
+      if (found < PRUNE_MIN_CHAINS) 
+        break;
     }
 
-    /* save the factor for the next round */
-    multipliers[i * layers + layer] = factor;
+    if (type == CANDIDATE_TYPES)
+      break;
   }
-}
 
+  double best = -INFINITY;
+  for (type = 0; type < CANDIDATE_TYPES; type++) {
+
+    uint64_t tests = 0, found = 0;
+    for (n = 0; n < MAX_CHAIN_LENGTH; n++) {
+      tests += chains[type][n];
+
+      if (n >= length)
+        found += chains[type][n];
+    }
+
+    type_score[type] = (length > 0) ? log2((found + 1) / (tests + 1.0)) : 0;
+
+    if (type_score[type] > best)
+      best = type_score[type];
+  }
+
+  for (type = 0; type < CANDIDATE_TYPES; type++)
+    type_score[type] = best - type_score[type];
+}
 
 /**
- * test the found candidates with the fermat primality test
+ * adds the found candidates of the given extension to the test queue
  */
-static inline void test_candidates(Sieve *const sieve, 
-                                   const sieve_t *const cc1,
-                                   const sieve_t *const twn,
-                                   const sieve_t *const all,
-                                   const mpz_t mpz_primorial,
-                                   const uint32_t extension) {
+static void queue_candidates(Sieve *const sieve, 
+                             const sieve_t *const cc1,
+                             const sieve_t *const twn,
+                             const sieve_t *const all,
+                             const uint32_t extension,
+                             const uint32_t base_bits,
+                             const double *const type_score) {
 
-  SieveStats *const stats       = &sieve->stats;
-  TestParams *const test_params = &sieve->test_params;
+  SieveStats *const stats = &sieve->stats;
 
   uint32_t i;
   for (i = (use_first_half ? 0 : sieve_words / 2); 
-       sieve->active && i < sieve_words; 
+       sieve_active(sieve) && i < sieve_words; 
        i++) {
 
     /* current word */
@@ -467,89 +740,182 @@ static inline void test_candidates(Sieve *const sieve,
     /* skip a word if there are no candidates in it */
     if (word == word_max) continue; 
 
-
     sieve_t n, bit;
     for (n = 1, bit = 0; n != 0; n <<= 1, bit++) {
 
       /* fond an not sieved index */
       if ((word & n) == 0) {
 
-        stats->tests++;
+        const uint32_t index = word_bits * i + bit;
+        uint32_t type;
+
+        if ((twn[i] & n) == 0)
+          type = CANDIDATE_TWN;
+        else if ((cc1[i] & n) == 0)
+          type = CANDIDATE_CC1;
+        else
+          type = CANDIDATE_CC2;
 
-        /* break if sieve should terminate */
-        if (!sieve->active) break;
-        
-        /* origin = (primorial * index) * 2^extension */
-        mpz_mul_ui(sieve->mpz_test_origin, 
-                   mpz_primorial, 
-                   (word_bits * i + bit) << extension);
+        /* grow the queue if needed */
+        if (sieve->queue_length == sieve->queue_size) {
 
-        uint32_t chain_length;
-        char     type;
+          uint32_t size   = sieve->queue_size * 2 + 1024;
+          uint64_t *queue = realloc(sieve->queue, sizeof(uint64_t) * size);
 
-        /* bi-twin candidate */
-        if ((twn[i] & n) == 0) {
-          
-          chain_length = twn_chain_test(sieve->mpz_test_origin,
-                                        test_params); 
+          /* test the candidates queued so far */
+          if (queue == NULL) {
+            error_msg("[EE] failed to grow the candidate queue to %" 
+                      PRIu32 " candidates\n", size);
+            return;
+          }
 
-          stats->twn[chain_length]++;
-          type = BI_TWIN_CHAIN;
+          sieve->queue      = queue;
+          sieve->queue_size = size;
+        }
 
-        /* cc1 candidate */
-        } else if ((cc1[i] & n) == 0) {
+        sieve->queue[sieve->queue_length++] = 
+          (candidate_priority(type_score, type, index, extension, base_bits)
+             << QUEUE_PRIORITY_SHIFT)                             |
+          ((uint64_t) extension << QUEUE_EXTENSION_SHIFT)         |
+          ((uint64_t) type      << QUEUE_TYPE_SHIFT)              |
+          index;
 
-          chain_length = cc1_chain_test(sieve->mpz_test_origin,
-                                        test_params);
+        stats_add(stats->ext_candidates[extension], 1);
+      }
+    }
+  }
+}
 
-          stats->cc1[chain_length]++;
-          type = FIRST_CUNNINGHAM_CHAIN;
+/**
+ * orders the test queue (the priority is in the top bits)
+ */
+static int compare_candidates(const void *a, const void *b) {
 
-        /* cc2 candidate */
-        } else {
-        
-          chain_length = cc2_chain_test(sieve->mpz_test_origin,
-                                        test_params);
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
 
-          stats->cc2[chain_length]++;
-          type = SECOND_CUNNINGHAM_CHAIN;
-        }
+  return (x > y) - (x < y);
+}
 
-        
-        if (chain_length >= pool_share) {
+/**
+ * test the queued candidates with the fermat primality test,
+ * the most valuable first, so new work only interrupts the least 
+ * valuable tests
+ */
+static inline void test_candidates(Sieve *const sieve, 
+                                   const mpz_t mpz_primorial) {
 
-          /* calculate the difficulty */
-          uint32_t difficulty = chain_length << FRACTIONAL_BITS;
-          difficulty += get_fractional_length(sieve->mpz_test_origin,
-                                              type,
-                                              chain_length,
-                                              &sieve->test_params);
+  SieveStats *const stats       = &sieve->stats;
+  TestParams *const test_params = &sieve->test_params;
 
-          /* calculate the proove of work certificate */
-          mpz_mul_ui(sieve->mpz_multiplier, 
-                     mpz_fixed_hash_multiplier, 
-                     (word_bits * i + bit) << extension);
+  uint32_t i;
+  for (i = 0; sieve_active(sieve) && i < sieve->queue_length; i++) {
 
-          size_t multiplier_length;
+    const uint64_t candidate = sieve->queue[i];
+    const uint32_t index     = (uint32_t) candidate;
+    const uint32_t type      = (candidate >> QUEUE_TYPE_SHIFT) & 0xFF;
+    const uint32_t extension = (candidate >> QUEUE_EXTENSION_SHIFT) & 0xFF;
 
-          memset(sieve->header.primemultiplier, 0, MULTIPLIER_LENGTH);
+    /* the latency histogram of this extension */
+    Histogram *const ext_hist = &sieve->hist[HIST_EXTENSION + 
+                                             min(extension, 
+                                                 HIST_EXTENSIONS - 1)];
 
-          mpz_to_ary(sieve->mpz_multiplier, 
-                     sieve->header.primemultiplier,
-                     &multiplier_length);
+    stats_add(stats->tests, 1);
+    
+    /* origin = (primorial * index) * 2^extension */
+    mpz_mul_ui(sieve->mpz_test_origin, 
+               mpz_primorial, 
+               (uint64_t) index << extension);
 
-          if (multiplier_length > MULTIPLIER_LENGTH) {
-            error_msg("[EE] to less space for primemultiplier\n");
-            continue;
-          }
+    uint32_t chain_length;
+    char     chain_type;
+    uint64_t start  = gettime_usec();
+    uint64_t cycles = hist_cycles();
 
-          sieve->header.multiplier_length = (uint8_t) multiplier_length;
+    /* bi-twin candidate */
+    if (type == CANDIDATE_TWN) {
+      
+      chain_length = twn_chain_test(sieve->mpz_test_origin,
+                                    test_params); 
 
-          /* check share if debuging is enabled */
-          check_share(&sieve->header, difficulty, type);
+      stats_add(stats->twn[chain_length], 1);
+      chain_type = BI_TWIN_CHAIN;
 
-          submit_share(&sieve->header, type, difficulty); 
-        }
+      cycles = hist_cycles() - cycles;
+      hist_record(&sieve->hist[HIST_TEST_TWN], cycles);
+
+    /* cc1 candidate */
+    } else if (type == CANDIDATE_CC1) {
+
+      chain_length = cc1_chain_test(sieve->mpz_test_origin,
+                                    test_params);
+
+      stats_add(stats->cc1[chain_length], 1);
+      chain_type = FIRST_CUNNINGHAM_CHAIN;
+
+      cycles = hist_cycles() - cycles;
+      hist_record(&sieve->hist[HIST_TEST_CC1], cycles);
+
+    /* cc2 candidate */
+    } else {
+    
+      chain_length = cc2_chain_test(sieve->mpz_test_origin,
+                                    test_params);
+
+      stats_add(stats->cc2[chain_length], 1);
+      chain_type = SECOND_CUNNINGHAM_CHAIN;
+
+      cycles = hist_cycles() - cycles;
+      hist_record(&sieve->hist[HIST_TEST_CC2], cycles);
+    }
+
+    hist_record(ext_hist, cycles);
+
+    stats_add(stats->ext_tests[extension], 1);
+    stats_add(stats->ext_chains[extension][chain_length], 1);
+    stats_add(stats->ext_time[extension], gettime_usec() - start);
+
+    
+    if (chain_length >= pool_share) {
+
+      /* calculate the difficulty */
+      uint32_t difficulty = chain_length << FRACTIONAL_BITS;
+      difficulty += get_fractional_length(sieve->mpz_test_origin,
+                                          chain_type,
+                                          chain_length,
+                                          &sieve->test_params);
+
+      /* calculate the proove of work certificate */
+      mpz_mul_ui(sieve->mpz_multiplier, 
+                 mpz_fixed_hash_multiplier, 
+                 (uint64_t) index << extension);
+
+      size_t multiplier_length;
+
+      memset(sieve->header.primemultiplier, 0, MULTIPLIER_LENGTH);
+
+      mpz_to_ary(sieve->mpz_multiplier, 
+                 sieve->header.primemultiplier,
+                 &multiplier_length);
+
+      if (multiplier_length > MULTIPLIER_LENGTH) {
+        error_msg("[EE] to less space for primemultiplier\n");
+        continue;
+      }
+
+      sieve->header.multiplier_length = (uint8_t) multiplier_length;
+
+      /* check share if debuging is enabled */
+      if (!sieve->synthetic_hash) {
+        check_share(&sieve->header, difficulty, chain_type);
+      }
+
+      /* benchmarks never submit anything */
+      if (!opts.benchmark) {
+        cycles = hist_cycles();
+        submit_share(&sieve->header, chain_type, difficulty, sieve->epoch);
+        hist_record(&sieve->hist[HIST_SUBMIT], hist_cycles() - cycles);
       }
     }
   }
@@ -564,17 +930,13 @@ static inline void test_candidates(Sieve *const sieve,
 static inline void calc_multipliers(Sieve *const sieve, 
                                     const mpz_t mpz_primorial) {
 
-#ifdef PRINT_TIME
-  uint64_t start_time = gettime_usec();
-#endif
-
   uint32_t *const cc1_muls = sieve->cc1_muls;
   uint32_t *const cc2_muls = sieve->cc2_muls;
 
   /* generate the multiplicators for the first layer first */
   uint32_t i;
   for (i = min_prime_index; 
-       sieve->active && i < max_prime_index; 
+       sieve_active(sieve) && i < max_prime_index; 
        i++) {
 
     /* current prime */
@@ -617,10 +979,6 @@ static inline void calc_multipliers(Sieve *const sieve,
     }
   }
 
-#ifdef PRINT_TIME
-  error_msg("[DD] calulating mulls: %" PRIu64 "\n", gettime_usec() - start_time);
-#endif
-
   /* run test if DEBUG is enabeld */
   check_mulltiplier(mpz_primorial,    
                     cc1_muls,         
@@ -634,6 +992,106 @@ static inline void calc_multipliers(Sieve *const sieve,
 }
 
 
+/**
+ * returns the number of chains of at least the given length
+ * found in the given extension
+ */
+static uint64_t ext_chains_from(const SieveStats *const stats, 
+                                const uint32_t extension,
+                                const uint32_t length) {
+
+  uint64_t chains = 0;
+  uint32_t n;
+
+  for (n = length; n < MAX_CHAIN_LENGTH; n++)
+    chains += stats->ext_chains[extension][n];
+
+  return chains;
+}
+
+/**
+ * adds the sieve time of a round (multipliers and all layers) to the
+ * cpu time of the extensions, every extension is sieved with chain_length
+ * of the same layers, so each one gets an equal share of it
+ */
+void charge_sieve_time(SieveStats *const stats, 
+                       const uint64_t sieve_time,
+                       const uint32_t active) {
+
+  const uint64_t share = sieve_time / (active + 1);
+
+  uint32_t e;
+  for (e = 0; e <= active; e++)
+    stats_add(stats->ext_time[e], share);
+}
+
+/**
+ * returns whether the highest active extension is unprofitable, that 
+ * is its chains per cpu second are below ratio times the ones of 
+ * extension 0 (the normal sieve), length gets the compared chain length
+ *
+ * shares are to rare for a fast decision, so the chains are counted
+ * from the longest length up to pool_share for which extension 0 has
+ * PRUNE_MIN_CHAINS, which favors the higher extensions
+ */
+char extension_unprofitable(const SieveStats *const stats, 
+                            const uint32_t active,
+                            const double ratio,
+                            uint32_t *const length) {
+
+  if (active == 0) return 0;
+
+  for (*length = pool_share; *length > 1; (*length)--)
+    if (ext_chains_from(stats, 0, *length) >= PRUNE_MIN_CHAINS)
+      break;
+
+  uint64_t chains = ext_chains_from(stats, 0, *length);
+  if (chains < PRUNE_MIN_CHAINS || stats->ext_time[0] == 0)
+    return 0;
+
+  /* the chains the extension should have found in its cpu time */
+  double min_yield = ratio * chains / stats->ext_time[0];
+  double expected  = min_yield * stats->ext_time[active];
+
+  /* not enough data yet */
+  if (expected < PRUNE_MIN_CHAINS)
+    return 0;
+
+  return ext_chains_from(stats, active, *length) < expected;
+}
+
+/**
+ * stops sieving and testing the highest active extension, 
+ * if it is unprofitable (see --prune-extensions)
+ */
+static void prune_extensions(const SieveStats *const stats, 
+                             const uint32_t active) {
+
+  uint32_t length;
+  if (!extension_unprofitable(stats, active, opts.prune_ratio, &length))
+    return;
+
+  /* other threads may have pruned it already */
+  uint32_t current = active;
+  if (__atomic_compare_exchange_n(&active_extensions, 
+                                  &current, 
+                                  active - 1,
+                                  0,
+                                  __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED) && 
+      !opts.quiet) {
+
+    info_msg("pruning extension %" PRIu32 ": %.1f %" PRIu32 
+             "-chains per cpu second, extension 0: %.1f\n",
+             active,
+             ext_chains_from(stats, active, length) * 1000000.0 / 
+             stats->ext_time[active],
+             length,
+             ext_chains_from(stats, 0, length) * 1000000.0 / 
+             stats->ext_time[0]);
+  }
+}
+
 /**
  * run the sieve
  * primorial is x * 2 * 3 * 5 * 11 * 17 * ...
@@ -645,9 +1103,8 @@ static inline void calc_multipliers(Sieve *const sieve,
  */
 void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
 
-#ifdef PRINT_TIME
-  uint64_t start_time = gettime_usec();
-#endif
+  uint64_t stage_start = gettime_usec();
+  uint64_t cycles      = hist_cycles();
 
   /* save arrays to local variables for faster access */
   uint32_t *const cc1_muls  = sieve->cc1_muls;
@@ -662,11 +1119,21 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
   sieve_t  *const ext_cc2   = sieve->ext_cc2;
   sieve_t  *const ext_cc1   = sieve->ext_cc1;
   sieve_t  *const ext_all   = sieve->ext_all;
+
+  /* the extensions which are not pruned */
+  const uint32_t active = __atomic_load_n(&active_extensions, 
+                                          __ATOMIC_RELAXED);
   
   /* calculate the multipliers first */
   calc_multipliers(sieve, mpz_primorial);
+  hist_record(&sieve->hist[HIST_MULTIPLIERS], hist_cycles() - cycles);
+
+  uint64_t stage_end       = gettime_usec();
+  uint64_t multiplier_time = stage_end - stage_start;
+  stats_add(sieve->stats.multiplier_time, multiplier_time);
+  stage_start = stage_end;
 
-  uint32_t l, w, e;
+  uint32_t l, e;
   uint32_t word_start, word_end, bit_start, bit_end;
 
   /* calculate the first half of extension 0 */
@@ -675,28 +1142,21 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
          bit_start  = 0, 
          word_end   = cache_words,
          bit_end    = cache_bits;
-         sieve->active && bit_start < bit_half;
+         sieve_active(sieve) && bit_start < bit_half;
          word_start += cache_words,
          word_end   += cache_words,
          bit_start  += cache_bits,
          bit_end    += cache_bits) {
  
-      for (l = 0; sieve->active && l < chain_length; l++) {
+      cycles = hist_cycles();
 
-#ifdef PRINT_CACHE_TIME      
-        uint64_t cache_time = gettime_usec();
-#endif
-        sieve_from_to(cc2_layer, cc2_muls, bit_start, bit_end, l);  
-#ifdef PRINT_CACHE_TIME
-        error_msg("[DD] cache time: %" PRIu64 "\n", 
-                  gettime_usec() - cache_time);
-#endif
-        sieve_from_to(cc1_layer, cc1_muls, bit_start, bit_end, l);  
+      for (l = 0; sieve_active(sieve) && l < chain_length; l++) {
 
-        for (w = word_start; w < word_end; w++) {
-          cc2[w] |= cc2_layer[w];
-          cc1[w] |= cc1_layer[w];
-        }
+        kernels.sieve_from_to(cc2_layer, cc2_muls, bit_start, bit_end, l);  
+        kernels.sieve_from_to(cc1_layer, cc1_muls, bit_start, bit_end, l);  
+
+        kernels.merge_layers(cc2, cc1, cc2_layer, cc1_layer, 
+                             word_start, word_end);
  
         /* copy layers to the twn candidates */
         if (l == twn_cc2_layers) 
@@ -704,82 +1164,23 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
  
         /* apply layers to the twn candidates */
         if (l == twn_cc1_layers) 
-          for (w = word_start; w < word_end; w++)
-            twn[w] |= cc1[w];
+          kernels.merge_words(twn, cc1, word_start, word_end);
       }
+
+      hist_record(&sieve->hist[HIST_SEGMENT], hist_cycles() - cycles);
     }
   }
 
   /* sieve the second half of all extensions */
-  for (word_start = word_half, 
-       bit_start  = bit_half, 
-       word_end   = word_half + cache_words,
-       bit_end    = bit_half  + cache_bits;
-       sieve->active && bit_start < sieve_size;
-       word_start += cache_words,
-       word_end   += cache_words,
-       bit_start  += cache_bits,
-       bit_end    += cache_bits) {
-
-    for (l = 0; sieve->active && l < layers; l++) {
-
-      /* sieve cc1 and cc2 layer l */
-      sieve_from_to(cc2_layer, cc2_muls, bit_start, bit_end, l);  
-      sieve_from_to(cc1_layer, cc1_muls, bit_start, bit_end, l);  
-
-      /* apply the layer to extension 0 (the normal sieve) */
-      if (l < chain_length) {
-
-        for (w = word_start; w < word_end; w++) {
-          cc2[w] |= cc2_layer[w];
-          cc1[w] |= cc1_layer[w];
-        }
-      }
-
-      /* copy the cc2 layers to the twn candidates */
-      if (l == twn_cc2_layers) 
-        memcpy(twn + word_start, cc2 + word_start, cache_bytes);
-
-      /* apply the cc1 layers to the twn candidates */
-      if (l == twn_cc1_layers) 
-        for (w = word_start; w < word_end; w++)
-          twn[w] |= cc1[w];
-
-
-      /* apply layers to the extensions */
-      for (e = 0; sieve->active && e < extensions; e++) {
-        
-        uint32_t ext_offset = e * sieve_words;
-        uint32_t ext_layer  = l - (e + 1);
-     
-        if (e < l && l <= e + chain_length) {
-     
-          sieve_t *ptr_cc2 = ext_cc2 + ext_offset;
-          sieve_t *ptr_cc1 = ext_cc1 + ext_offset;
-     
-          for (w = word_start; w < word_end; w++) {
-            ptr_cc2[w] |= cc2_layer[w];
-            ptr_cc1[w] |= cc1_layer[w];
-          }
-        }
-
-        /* copy layers to the extended twn candidates */
-        if (ext_layer == twn_cc2_layers) {
-          uint32_t offset = word_start + ext_offset;
-          memcpy(ext_twn + offset, ext_cc2 + offset, cache_bytes);
-        }
+  const SegmentKernel sieve_segment = segment_kernels[active];
 
-        /* copy layers to the extended twn candidates */ 
-        if (ext_layer == twn_cc1_layers) {
+  for (word_start = word_half, bit_start = bit_half;
+       sieve_active(sieve) && bit_start < sieve_size;
+       word_start += cache_words, bit_start += cache_bits) {
 
-          sieve_t *ptr_cc1 = ext_cc1 + ext_offset;
-          sieve_t *ptr_twn = ext_twn + ext_offset;
-     
-          for (w = word_start; w < word_end; w++)
-            ptr_twn[w] |= ptr_cc1[w];
-        }
-      }
-    }
+    cycles = hist_cycles();
+    sieve_segment(sieve, word_start, bit_start, active);
+    hist_record(&sieve->hist[HIST_SEGMENT], hist_cycles() - cycles);
   }
 
   /* check the sieve if DEBUG is enabled */
@@ -793,7 +1194,7 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
               cc2_muls,                
               chain_length,            
               sieve_words,
-              extensions,              
+              active,              
               layers,
               primes,                  
               min_prime_index,               
@@ -802,17 +1203,17 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
               sieve_size,
               use_first_half);
 
+  cycles = hist_cycles();
+
   /* create the final set of candidates */
-  uint32_t i;
-  for (i = 0; i < sieve_words; i++)
-    all[i] = cc1[i] & cc2[i] & twn[i];
+  kernels.combine_candidates(all, cc1, cc2, twn, 0, sieve_words);
 
   /* mark 0H as composite */
   all[0] |= (sieve_t) 1;
 
 
   /* create the final set of extended candidates */
-  for (e = 0; sieve->active && e < extensions; e++) {
+  for (e = 0; sieve_active(sieve) && e < active; e++) {
     
     sieve_t *ptr_cc1 = ext_cc1 + e * sieve_words;
     sieve_t *ptr_cc2 = ext_cc2 + e * sieve_words;
@@ -820,17 +1221,28 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
     sieve_t *ptr_all = ext_all + e * sieve_words;
 
     /* create the final set of candidates */
-    for (i = sieve_words / 2; i < sieve_words; i++) 
-      ptr_all[i] = ptr_cc1[i] & ptr_cc2[i] & ptr_twn[i];
+    kernels.combine_candidates(ptr_all, 
+                               ptr_cc1, 
+                               ptr_cc2, 
+                               ptr_twn, 
+                               sieve_words / 2, 
+                               sieve_words);
 
     /* mark factor 0 as composite */
     ptr_all[0] |= (sieve_t) 1;
    }
 
-#ifdef PRINT_TIME
-  error_msg("[DD] sieving: %" PRIu64 "\n", gettime_usec() - start_time);
-  start_time = gettime_usec();
-#endif
+  hist_record(&sieve->hist[HIST_EXTRACT], hist_cycles() - cycles);
+
+  stage_end = gettime_usec();
+  stats_add(sieve->stats.sieve_time, stage_end - stage_start);
+
+  /* the multipliers and layers are shared by all extensions */
+  charge_sieve_time(&sieve->stats, 
+                    multiplier_time + stage_end - stage_start, 
+                    active);
+
+  stage_start = stage_end;
 
   /* check sieve out put if DEBUG is enabled */
   check_candidates(mpz_primorial,     
@@ -842,11 +1254,16 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
                    sieve_words,
                    &sieve->test_params);
 
-  /* run the fermat test on the remaining candidates */
-  test_candidates(sieve, cc1, twn, all, mpz_primorial, 0); 
+  /* queue the candidates of all extensions by their value */
+  double type_score[CANDIDATE_TYPES];
+  rate_candidate_types(&sieve->stats, type_score);
+
+  const uint32_t base_bits = mpz_sizeinbase(mpz_primorial, 2);
+
+  sieve->queue_length = 0;
+  queue_candidates(sieve, cc1, twn, all, 0, base_bits, type_score);
 
-  /* test extended candidates */
-  for (e = 0; sieve->active && e < extensions; e++) {
+  for (e = 0; sieve_active(sieve) && e < active; e++) {
     
     sieve_t *ptr_cc1 = ext_cc1 + e * sieve_words;
     sieve_t *ptr_twn = ext_twn + e * sieve_words;
@@ -862,13 +1279,65 @@ void sieve_run(Sieve *const sieve, const mpz_t mpz_primorial) {
                      sieve_words,
                      &sieve->test_params);
 
-    /* run the fermat test on the remaining candidates */
-    test_candidates(sieve, ptr_cc1, ptr_twn, ptr_all, mpz_primorial, e + 1);
+    queue_candidates(sieve, 
+                     ptr_cc1, 
+                     ptr_twn, 
+                     ptr_all, 
+                     e + 1, 
+                     base_bits, 
+                     type_score);
   }
-#ifdef PRINT_TIME
-  error_msg("[DD] testing : %" PRIu64 "\n", gettime_usec() - start_time);
-#endif
+
+  qsort(sieve->queue, 
+        sieve->queue_length, 
+        sizeof(uint64_t), 
+        compare_candidates);
+
+  /* run the fermat test on the queued candidates */
+  test_candidates(sieve, mpz_primorial); 
+
+  stats_add(sieve->stats.test_time, gettime_usec() - stage_start);
+  stats_add(sieve->stats.rounds, 1);
+
+  /* stop sieving unprofitable extensions */
+  if (opts.prune_ratio > 0 && 
+      sieve->stats.rounds % PRUNE_CHECK_ROUNDS == 0)
+    prune_extensions(&sieve->stats, active);
 
   /* check candidate ratio if DEBUG is enabled */
   check_ratio(&sieve->stats);
+
+  /* make the stats visible to the stats and metrics threads */
+  stats_group_flush(sieve, 0);
+}
+
+/**
+ * the sieve kernels for the microbenchmarks (bench/xpminer-bench.c)
+ * (uses the sieve globals, so init_sieve_globals() has to be called first)
+ */
+uint32_t kernel_invert(const uint32_t a, const uint32_t p) {
+  return invert(a, p);
+}
+
+void kernel_sieve_from_to(sieve_t  *const   candidates,
+                          uint32_t *const   multipliers,
+                          const    uint32_t start,
+                          const    uint32_t end,
+                          const    uint32_t layer) {
+
+  kernels.sieve_from_to(candidates, multipliers, start, end, layer);
+}
+
+void kernel_calc_multipliers(Sieve *const sieve, const mpz_t mpz_primorial) {
+  calc_multipliers(sieve, mpz_primorial);
+}
+
+void kernel_merge_layers(sieve_t *const       cc2,
+                         sieve_t *const       cc1,
+                         const sieve_t *const cc2_layer,
+                         const sieve_t *const cc1_layer,
+                         const uint32_t       start,
+                         const uint32_t       end) {
+
+  kernels.merge_layers(cc2, cc1, cc2_layer, cc1_layer, start, end);
 }
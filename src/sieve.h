@@ -19,6 +19,7 @@
 #ifndef __SIEVE_H__
 #define __SIEVE_H__
 
+#include <sys/time.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
@@ -66,8 +67,18 @@
 
 #define byte_index(index) ((index) >> 3)
 
+/**
+ * returns the current time in microseconds
+ */
+uint64_t gettime_usec();
+
 /**
  * Structure to store sieve statistics
+ *
+ * Each thread has its own cache line aligned (and padded) stats,
+ * which are only written by the owning thread (see stats_add()),
+ * other threads only read the sums of the thread groups (see stats.h).
+ * (all fields have to be uint64_t counters)
  */
 struct SieveStats {
   uint64_t twn[MAX_CHAIN_LENGTH];
@@ -75,7 +86,107 @@ struct SieveStats {
   uint64_t cc1[MAX_CHAIN_LENGTH];
   uint64_t tests;
   uint64_t start_time;
-};
+  uint64_t hashes;    /* number of mined header hashes           */
+  uint64_t hash_time; /* microseconds spent in mine_header_hash  */
+
+  /* microseconds spent in the different stages of sieve_run */
+  uint64_t rounds;
+  uint64_t multiplier_time;
+  uint64_t sieve_time;
+  uint64_t test_time;
+
+  /* usecs from work publication till the thread switched to it */
+  uint64_t work_switches;
+  uint64_t switch_time;
+  uint64_t switch_time_max;
+
+  /**
+   * the yield of each extension (index 0 is the normal sieve),
+   * ext_time is the usecs spent testing it plus an equal share of the
+   * sieve time (see charge_sieve_time), ext_chains the found chains
+   * by length
+   */
+  uint64_t ext_candidates[MAX_SIEVE_EXTENSIONS + 1];
+  uint64_t ext_tests[MAX_SIEVE_EXTENSIONS + 1];
+  uint64_t ext_time[MAX_SIEVE_EXTENSIONS + 1];
+  uint64_t ext_chains[MAX_SIEVE_EXTENSIONS + 1][MAX_CHAIN_LENGTH];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/**
+ * single writer stats update (only called by the owning thread)
+ * relaxed atomics give torn free readings without locked instructions
+ */
+#define stats_set(counter, value) \
+  __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED)
+
+#define stats_add(counter, value) \
+  stats_set(counter, __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (value))
+
+/**
+ * copies the stats of a (running) thread
+ */
+void sieve_stats_snapshot(SieveStats *snapshot, const SieveStats *stats);
+
+/**
+ * the extension pruning (see --prune-extensions) is checked every
+ * PRUNE_CHECK_ROUNDS rounds of a thread, and only decides when at least
+ * PRUNE_MIN_CHAINS chains are expected
+ */
+#define PRUNE_CHECK_ROUNDS 16
+#define PRUNE_MIN_CHAINS   100
+
+/**
+ * adds the sieve time of a round (multipliers and all layers) to the
+ * cpu time of the extensions, every extension is sieved with chain_length
+ * of the same layers, so each one gets an equal share of it
+ */
+void charge_sieve_time(SieveStats *const stats, 
+                       const uint64_t sieve_time,
+                       const uint32_t active);
+
+/**
+ * returns whether the highest active extension is unprofitable, that 
+ * is its chains per cpu second are below ratio times the ones of 
+ * extension 0 (the normal sieve), length gets the compared chain length
+ */
+char extension_unprofitable(const SieveStats *const stats, 
+                            const uint32_t active,
+                            const double ratio,
+                            uint32_t *const length);
+
+/**
+ * returns the number of extensions which are not pruned
+ */
+uint32_t sieve_active_extensions();
+
+/**
+ * returns whether the current chain length and extensions
+ * use a specialized segment schedule
+ */
+char sieve_segment_specialized();
+
+/**
+ * the candidate types of the test queue
+ */
+#define CANDIDATE_TWN   0
+#define CANDIDATE_CC1   1
+#define CANDIDATE_CC2   2
+#define CANDIDATE_TYPES 3
+
+/**
+ * a queued candidate is (priority, extension, type, index) packed into
+ * an uint64_t, a lower priority gets tested first, so sorting the plain
+ * numbers orders the queue (equal ones by extension and index)
+ */
+#define QUEUE_PRIORITY_SHIFT  48
+#define QUEUE_EXTENSION_SHIFT 40
+#define QUEUE_TYPE_SHIFT      32
+#define QUEUE_MAX_PRIORITY    0xFFFFLU
+
+/**
+ * priority steps per halving of the expected chains per test time
+ */
+#define QUEUE_RESOLUTION 256
 
 /**
  * The sieve is basically a variation of the Sieve of Eratosthenes.
@@ -235,6 +346,20 @@ struct Sieve {
   /* prime test parameters */
   TestParams test_params;
 
+  /**
+   * the candidates of the current round, ordered by their value
+   * (see QUEUE_PRIORITY_SHIFT)
+   */
+  uint64_t *queue;
+  uint32_t queue_length;
+  uint32_t queue_size;
+
+  /**
+   * latency histograms of the mining stages (see histogram.h),
+   * allocated by the thread itself, and since the last flush
+   */
+  Histogram *hist;
+
   /* reminder for mining the header hash */
   mpz_t mpz_reminder;
 
@@ -252,6 +377,11 @@ struct Sieve {
    */
   BlockHeader header;
 
+  /**
+   * sha256 state after the first (constant) 64 bytes of the header
+   */
+  SHA256_CTX midstate;
+
   /**
    * the mpz_multiplier for the block hash
    * prime origin = multiplier * hash
@@ -261,15 +391,49 @@ struct Sieve {
 
   /**
    * indicates whether the sieve should continue running
+   * (use sieve_active() to also check for new work)
    */
   char active;
 
+  /**
+   * the work epoch of the header
+   */
+  uint32_t epoch;
+
+  /**
+   * the hash wasn't mined from the header (--bench-hash-sweep),
+   * so the found shares can't be checked
+   */
+  char synthetic_hash;
+
+  /**
+   * the id of the miner thread (see thread_throttled())
+   */
+  uint32_t id;
+
   /**
    * some statistics 
    */
   SieveStats stats;
+
+  /**
+   * the stats already added to the group of the thread 
+   * (see stats_group_flush())
+   */
+  SieveStats flushed;
+  StatsGroup *group;
+  uint64_t   flush_time;
 };
 
+/**
+ * indicates whether the sieve should continue running
+ * (false on shutdown, if new work arrived or if the thread got parked)
+ */
+#define sieve_active(sieve)                   \
+  ((sieve)->active &&                         \
+   (sieve)->epoch == work_epoch() &&          \
+   !thread_throttled((sieve)->id))
+
 /**
  * initializes the sieve global variables
  * (used by all mining threads)
@@ -296,6 +460,21 @@ void reinit_sieve(Sieve *sieve);
  */
 void init_sieve(Sieve *sieve);
 
+/**
+ * reallocates the sieve after the sieve globals changed
+ * (the header, the statistics and the prime test state are kept)
+ */
+void realloc_sieve(Sieve *sieve);
+
+/**
+ * returns the bytes one miner thread allocates for a sieve with
+ * the given options (see --memory-limit)
+ */
+uint64_t sieve_memory(uint32_t sieve_size, 
+                      uint32_t extensions, 
+                      uint32_t chain_length, 
+                      uint32_t sieve_primes);
+
 /**
  * frees all used resources of the sieve
  */
@@ -309,4 +488,25 @@ void free_sieve(Sieve *sieve);
  */
 void sieve_run(Sieve *sieve, const mpz_t mpz_primorial);
 
+/**
+ * the sieve kernels for the microbenchmarks (bench/xpminer-bench.c)
+ * (uses the sieve globals, so init_sieve_globals() has to be called first)
+ */
+uint32_t kernel_invert(const uint32_t a, const uint32_t p);
+
+void kernel_sieve_from_to(sieve_t  *const   candidates,
+                          uint32_t *const   multipliers,
+                          const    uint32_t start,
+                          const    uint32_t end,
+                          const    uint32_t layer);
+
+void kernel_calc_multipliers(Sieve *const sieve, const mpz_t mpz_primorial);
+
+void kernel_merge_layers(sieve_t *const       cc2,
+                         sieve_t *const       cc1,
+                         const sieve_t *const cc2_layer,
+                         const sieve_t *const cc1_layer,
+                         const uint32_t       start,
+                         const uint32_t       end);
+
 #endif /* __SIEVE_H__ */
@@ -0,0 +1,183 @@
+/**
+ * Implementation of the hierarchical aggregation of the mining statistics.
+ *
+ * Each miner thread adds the changes of its own stats and histograms
+ * to the group it belongs to (relaxed atomic adds, shared by at most
+ * STATS_GROUP_THREADS threads), the readers only sum up the groups.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+
+/**
+ * the groups of the miner threads
+ */
+static StatsGroup *groups  = NULL;
+static uint32_t   n_groups = 0;
+
+/**
+ * the only SieveStats field which is a maximum instead of a sum
+ */
+#define MAX_FIELD (offsetof(SieveStats, switch_time_max) / sizeof(uint64_t))
+
+/**
+ * allocates the groups for n_threads miner threads
+ */
+void init_stats_groups(uint32_t n_threads) {
+
+  free_stats_groups();
+
+  n_groups = (n_threads + STATS_GROUP_THREADS - 1) / STATS_GROUP_THREADS;
+
+  if (posix_memalign((void **) &groups,
+                     CACHE_LINE_SIZE,
+                     n_groups * sizeof(StatsGroup)) != 0) {
+
+    error_msg("[EE] failed to allocate the stats groups\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(groups, 0, n_groups * sizeof(StatsGroup));
+}
+
+/**
+ * returns the group of the given thread
+ * (NULL if there are no groups, like in the microbenchmarks)
+ */
+StatsGroup *stats_group(uint32_t thread) {
+
+  if (groups == NULL || thread / STATS_GROUP_THREADS >= n_groups)
+    return NULL;
+
+  return &groups[thread / STATS_GROUP_THREADS];
+}
+
+/**
+ * raises value to max (if it is lower)
+ */
+static void atomic_max(uint64_t *value, uint64_t max) {
+
+  uint64_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+
+  while (current < max &&
+         !__atomic_compare_exchange_n(value,
+                                      &current,
+                                      max,
+                                      1,
+                                      __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED));
+}
+
+/**
+ * adds the stats and histograms of the given sieve to its group,
+ * if STATS_FLUSH_INTERVAL passed (or if force is set)
+ * (only called by the owning thread)
+ */
+void stats_group_flush(Sieve *sieve, char force) {
+
+  StatsGroup *const group = sieve->group;
+  if (group == NULL)
+    return;
+
+  uint64_t now = gettime_usec();
+  if (!force && now < sieve->flush_time)
+    return;
+
+  sieve->flush_time = now + STATS_FLUSH_INTERVAL;
+
+  /* the stats are kept (the thread uses them), so add the difference */
+  const uint64_t *const stats = (const uint64_t *) &sieve->stats;
+  uint64_t *const flushed     = (uint64_t *) &sieve->flushed;
+  uint64_t *const sum         = (uint64_t *) &group->stats;
+
+  uint32_t i, n;
+  for (i = 0; i < sizeof(SieveStats) / sizeof(uint64_t); i++) {
+
+    if (stats[i] == flushed[i])
+      continue;
+
+    if (i == MAX_FIELD)
+      atomic_max(&sum[i], stats[i]);
+    else
+      __atomic_fetch_add(&sum[i], stats[i] - flushed[i], __ATOMIC_RELAXED);
+
+    flushed[i] = stats[i];
+  }
+
+  /* only the groups are read, so the histograms start again from zero */
+  for (n = 0; n < HIST_STAGES; n++) {
+
+    uint64_t *const counts = sieve->hist[n].counts;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+      if (counts[i] > 0) {
+        __atomic_fetch_add(&group->hist[n].counts[i],
+                           counts[i],
+                           __ATOMIC_RELAXED);
+        counts[i] = 0;
+      }
+    }
+  }
+}
+
+/**
+ * sums up the stats (and the histograms if hist is not NULL)
+ * of all groups (hist needs HIST_STAGES elements)
+ */
+void stats_groups_collect(SieveStats *stats, Histogram *hist) {
+
+  memset(stats, 0, sizeof(SieveStats));
+
+  if (hist != NULL)
+    memset(hist, 0, HIST_STAGES * sizeof(Histogram));
+
+  uint64_t *const sum = (uint64_t *) stats;
+  uint32_t g, i;
+
+  for (g = 0; g < n_groups; g++) {
+
+    SieveStats group_stats;
+    sieve_stats_snapshot(&group_stats, &groups[g].stats);
+
+    const uint64_t *const add = (const uint64_t *) &group_stats;
+
+    for (i = 0; i < sizeof(SieveStats) / sizeof(uint64_t); i++) {
+      if (i == MAX_FIELD)
+        sum[i] = (add[i] > sum[i]) ? add[i] : sum[i];
+      else
+        sum[i] += add[i];
+    }
+
+    if (hist != NULL)
+      for (i = 0; i < HIST_STAGES; i++)
+        hist_merge(&hist[i], &groups[g].hist[i]);
+  }
+}
+
+/**
+ * frees the groups
+ */
+void free_stats_groups() {
+
+  free(groups);
+  groups   = NULL;
+  n_groups = 0;
+}
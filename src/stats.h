@@ -0,0 +1,77 @@
+/**
+ * Header file of the hierarchical aggregation of the mining statistics.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * The miner threads keep their stats and histograms in their own memory,
+ * and every STATS_FLUSH_INTERVAL they add what changed to the group of
+ * STATS_GROUP_THREADS threads they belong to. The stats and metrics
+ * threads only read the groups, so their work doesn't grow with every
+ * thread, and they never touch the (hot) memory of the miners.
+ */
+#define STATS_GROUP_THREADS 16
+
+/**
+ * microseconds between two flushes of a thread
+ */
+#define STATS_FLUSH_INTERVAL 250000
+
+/**
+ * the summed stats of a group of threads
+ * (written with atomic adds by the threads of the group)
+ */
+struct StatsGroup {
+  SieveStats stats;
+  Histogram  hist[HIST_STAGES];
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/**
+ * allocates the groups for n_threads miner threads
+ */
+void init_stats_groups(uint32_t n_threads);
+
+/**
+ * returns the group of the given thread
+ */
+StatsGroup *stats_group(uint32_t thread);
+
+/**
+ * adds the stats and histograms of the given sieve to its group,
+ * if STATS_FLUSH_INTERVAL passed (or if force is set)
+ * (only called by the owning thread)
+ */
+void stats_group_flush(Sieve *sieve, char force);
+
+/**
+ * sums up the stats (and the histograms if hist is not NULL)
+ * of all groups (hist needs HIST_STAGES elements)
+ */
+void stats_groups_collect(SieveStats *stats, Histogram *hist);
+
+/**
+ * frees the groups
+ */
+void free_stats_groups();
+
+#endif /* __STATS_H__ */
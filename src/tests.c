@@ -664,47 +664,12 @@ char check_primes(const uint32_t *const primes,
  */
 char check_share(BlockHeader *share, uint32_t orig_difficulty, char type) {
 
-  mpz_t mpz_multiplier, mpz_origin, mpz_hash;
-
-  mpz_init(mpz_multiplier);
-  mpz_init(mpz_origin);
-  mpz_init(mpz_hash);
-
   TestParams params;
   init_test_params(&params);
-  
-  uint8_t hash[SHA256_DIGEST_LENGTH];
-  get_header_hash(share, hash);
-  mpz_set_sha256(mpz_hash, hash);
-
-  mpz_import(mpz_multiplier, 
-             share->multiplier_length, 
-             -1, 
-             sizeof(share->primemultiplier[0]), 
-             -1, 
-             0, 
-             share->primemultiplier);
 
-  mpz_mul(mpz_origin, mpz_hash, mpz_multiplier);
+  uint32_t difficulty = get_share_difficulty(share, type, &params);
 
-  uint8_t chain_length = 0;
- 
-  if (type == BI_TWIN_CHAIN) {
-    
-    chain_length = twn_chain_test(mpz_origin, &params);
-  } else if (type == FIRST_CUNNINGHAM_CHAIN) {
-
-    chain_length = cc1_chain_test(mpz_origin, &params);
-  } else {
-
-    chain_length = cc2_chain_test(mpz_origin, &params);
-  }
-
-  uint32_t difficulty = chain_length << FRACTIONAL_BITS;
-  difficulty += get_fractional_length(mpz_origin,
-                                      type,
-                                      chain_length,
-                                      &params);
+  clear_test_params(&params);
 
   if (difficulty != orig_difficulty) {
     
@@ -721,4 +686,200 @@ char check_share(BlockHeader *share, uint32_t orig_difficulty, char type) {
 
 #endif
 
+#ifdef CHECK_PARTITION
+
+/**
+ * counter wraps each worker walks through, and the most (time, host)
+ * pairs to check (fewer wraps with many workers, but at least 4)
+ */
+#define PARTITION_CHECK_WRAPS  64
+#define PARTITION_CHECK_BLOCKS (1 << 24)
+
+/**
+ * orders the used (time, host index) pairs
+ */
+static int compare_headers(const void *a, const void *b) {
+
+  const uint64_t x = *(const uint64_t *) a;
+  const uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * checks that the header partitions of all threads of all --processes
+ * of all --hosts don't overlap
+ * (each worker starts at an other time, walks through 
+ *  PARTITION_CHECK_WRAPS counter wraps and gets rebased once),
+ * and that a round with the configured --primes-in-hash doesn't 
+ * drift further than MAX_HEADER_DRIFT ahead of the clock
+ */
+char check_partition(uint32_t n_threads) {
+
+  const uint32_t stride  = partition_stride(n_threads);
+  const uint32_t bits    = nonce_counter_bits();
+  const uint64_t workers = (uint64_t) opts.hosts * opts.processes * n_threads;
+  const uint32_t now     = time(NULL);
+
+  uint32_t wraps = PARTITION_CHECK_WRAPS;
+  while (wraps > 4 && workers * wraps > PARTITION_CHECK_BLOCKS)
+    wraps /= 2;
+
+  uint64_t n_blocks = workers * wraps;
+  uint64_t *blocks  = malloc(sizeof(uint64_t) * n_blocks);
+  uint64_t i, w = 0;
+  uint32_t n, host, process, thread;
+
+  if (blocks == NULL) {
+    error_msg("[EE] partition check failed: %" PRIu64 " workers are too "
+              "many to check\n", workers);
+    return -1;
+  }
+
+  for (host = 0; host < opts.hosts; host++) {
+    for (process = 0; process < opts.processes; process++) {
+      for (thread = 0; thread < n_threads; thread++, w++) {
+
+        BlockHeader header;
+        header_set_worker(&header, 
+                          now + (w * 7919) % (4 * stride),
+                          host,
+                          process,
+                          n_threads,
+                          thread);
+
+        for (n = 0; n < wraps; n++) {
+
+          blocks[w * wraps + n] = ((uint64_t) header.time << 32) | 
+                                  ((uint64_t) header.nonce >> bits);
+
+          /* the clock passed the header time */
+          if (n == wraps / 2) {
+            header_rebase_time(&header, 
+                               header.time + (w * 7919) % (4 * stride) + 1, 
+                               stride);
+            continue;
+          }
+
+          /* use up the counter */
+          header.nonce |= nonce_counter_mask();
+          header_next_nonce(&header, stride);
+
+          if ((header.nonce & nonce_counter_mask()) != 0) {
+            error_msg("[EE] partition check failed: counter not reset\n");
+            free(blocks);
+            return -1;
+          }
+        }
+      }
+    }
+  }
+
+  qsort(blocks, n_blocks, sizeof(uint64_t), compare_headers);
+
+  for (i = 1; i < n_blocks; i++) {
+    if (blocks[i] == blocks[i - 1]) {
+
+      error_msg("[EE] partition check failed: time %" PRIu64 
+                " host %" PRIu64 " used twice\n",
+                blocks[i] >> 32,
+                blocks[i] & 0xFFFFFFFF);
+
+      free(blocks);
+      return -1;
+    }
+  }
+
+  free(blocks);
+
+  /**
+   * a round takes twice the hash primorial of hashes on average, 
+   * and more than ln(1000) times that only once in 1000 rounds
+   */
+  double hashes    = 2 * mpz_get_d(opts.mpz_hash_primorial) * log(1000);
+  uint64_t n_wraps = hashes / (nonce_counter_mask() + 1.0);
+  uint64_t drift   = (stride - 1) + n_wraps * stride;
+
+  if (drift > MAX_HEADER_DRIFT) {
+    error_msg("[EE] partition check failed: a round with %" PRIu32 
+              " primes in hash drifts up to %" PRIu64 " seconds ahead "
+              "(max %d)\n",
+              opts.primes_in_hash,
+              drift,
+              MAX_HEADER_DRIFT);
+    return -1;
+  }
+
+  error_msg("[DD] header partitions of %" PRIu64 " workers on %" PRIu32 
+            " hosts don't overlap, a round drifts up to %" PRIu64 
+            " seconds ahead\n",
+            workers,
+            opts.hosts,
+            drift);
+  return 0;
+}
+
+#endif
+
+#ifdef CHECK_PRUNE
+
+/**
+ * the simulated rounds of check_prune, with the timing of a real
+ * round (in microseconds) and the chains of each extension per round
+ */
+#define PRUNE_CHECK_EXTENSIONS  9
+#define PRUNE_CHECK_SIEVE_TIME  228000
+#define PRUNE_CHECK_TEST_TIME   500
+#define PRUNE_CHECK_CHAINS      10
+#define PRUNE_CHECK_RATIO       0.5
+
+/**
+ * checks that --prune-extensions prunes the highest extension if it
+ * finds a tenth of the chains of the others, but not if it finds as
+ * many as they do
+ */
+char check_prune() {
+
+  const uint32_t active = PRUNE_CHECK_EXTENSIONS;
+  uint32_t round, e, length;
+  char low_yield;
+
+  for (low_yield = 0; low_yield < 2; low_yield++) {
+
+    SieveStats stats;
+    memset(&stats, 0, sizeof(SieveStats));
+
+    /* (more than) enough rounds for a decision */
+    for (round = 0; round < 100 * PRUNE_MIN_CHAINS; round++) {
+
+      charge_sieve_time(&stats, PRUNE_CHECK_SIEVE_TIME, active);
+
+      for (e = 0; e <= active; e++) {
+        stats.ext_time[e]      += PRUNE_CHECK_TEST_TIME;
+        stats.ext_chains[e][1] += (low_yield && e == active) ? 
+                                  PRUNE_CHECK_CHAINS / 10 : 
+                                  PRUNE_CHECK_CHAINS;
+      }
+    }
+
+    char pruned = extension_unprofitable(&stats, 
+                                         active, 
+                                         PRUNE_CHECK_RATIO, 
+                                         &length);
+
+    if (pruned != low_yield) {
+      error_msg("[EE] prune check failed: extension %" PRIu32 " with %s "
+                "yield %s\n",
+                active,
+                low_yield ? "a low" : "the same",
+                pruned ? "got pruned" : "didn't get pruned");
+      return -1;
+    }
+  }
+
+  error_msg("[DD] only extensions with a low yield get pruned\n");
+  return 0;
+}
+#endif
+
 #endif /* DEBUG */
@@ -70,6 +70,10 @@
 #define check_primes(primes, two_inverses, len)
 
 #define check_share(share, orig_difficulty, type)
+
+#define check_partition(n_threads)
+
+#define check_prune()
    
 #else
 
@@ -192,6 +196,30 @@ char check_primes(const uint32_t *const primes,
 char check_share(BlockHeader *share, uint32_t orig_difficulty, char type);
 #endif
 
+#ifndef CHECK_PARTITION
+#define check_partition(n_threads)
+#else
+
+/**
+ * checks that the header partitions of all threads of all --processes
+ * of all --hosts don't overlap, and that a round with
+ * the configured --primes-in-hash doesn't drift too far ahead
+ */
+char check_partition(uint32_t n_threads);
+#endif
+
+#ifndef CHECK_PRUNE
+#define check_prune()
+#else
+
+/**
+ * checks that --prune-extensions prunes the highest extension if it
+ * finds a tenth of the chains of the others, but not if it finds as
+ * many as they do
+ */
+char check_prune();
+#endif
+
 #endif /* DEBUG */
 
 #endif /* __TESTS_H__ */
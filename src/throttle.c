@@ -0,0 +1,294 @@
+/**
+ * Implementation of the background mining (--background, --cpu-budget).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "main.h"
+
+/**
+ * to park the throttled miner threads
+ */
+static pthread_mutex_t throttle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  throttle_cond  = PTHREAD_COND_INITIALIZER;
+
+/**
+ * the miner threads and the cpus of the machine
+ */
+static uint32_t miner_threads = 0;
+static uint32_t n_cpus        = 1;
+
+/**
+ * the last measurement: busy and total jiffies of all cpus,
+ * the cpu time of this process and the time (in microseconds)
+ */
+static uint64_t last_busy    = 0;
+static uint64_t last_total   = 0;
+static uint64_t last_process = 0;
+static uint64_t last_time    = 0;
+
+/**
+ * the smoothed cpu usage of the other processes (in cpus),
+ * written by the throttle thread, read by the stats and metrics threads
+ */
+static double other_load = 0;
+
+/**
+ * reads the busy and total jiffies of all cpus from /proc/stat
+ * returns 0 on success
+ */
+static int read_cpu_times(uint64_t *busy, uint64_t *total) {
+
+  FILE *file = fopen("/proc/stat", "r");
+  if (file == NULL)
+    return -1;
+
+  uint64_t user, nice, system, idle, iowait, irq, softirq, steal;
+  int fields = fscanf(file,
+                      "cpu %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                      " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+                      &user, &nice, &system, &idle,
+                      &iowait, &irq, &softirq, &steal);
+  fclose(file);
+
+  if (fields != 8)
+    return -1;
+
+  *busy  = user + nice + system + irq + softirq + steal;
+  *total = *busy + idle + iowait;
+  return 0;
+}
+
+/**
+ * returns the cpu time of this process in microseconds
+ */
+static uint64_t process_time() {
+
+  struct timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+
+  return time.tv_sec * 1000000LU + time.tv_nsec / 1000;
+}
+
+/**
+ * returns the cpus of the cpu.max quota of the cgroup of this process
+ * (cgroup v2, or cpu.cfs_quota_us of v1), 0 if there is none
+ */
+static double cgroup_cpus() {
+
+  char path[1024] = "/sys/fs/cgroup/cpu.max";
+  char line[512];
+
+  /* "0::/path" is the v2 cgroup of this process */
+  FILE *file = fopen("/proc/self/cgroup", "r");
+  if (file != NULL) {
+    while (fgets(line, sizeof(line), file) != NULL) {
+      if (strncmp(line, "0::", 3) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", line + 3);
+        break;
+      }
+    }
+    fclose(file);
+  }
+
+  double quota = 0, period = 0;
+
+  file = fopen(path, "r");
+  if (file != NULL) {
+
+    /* "max 100000" means no quota */
+    if (fscanf(file, "%lf %lf", &quota, &period) != 2)
+      quota = 0;
+
+    fclose(file);
+  } else {
+
+    file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+    if (file == NULL)
+      return 0;
+
+    if (fscanf(file, "%lf", &quota) != 1)
+      quota = 0;
+    fclose(file);
+
+    file = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+    if (file == NULL)
+      return 0;
+
+    if (fscanf(file, "%lf", &period) != 1)
+      period = 0;
+    fclose(file);
+  }
+
+  return (quota > 0 && period > 0) ? quota / period : 0;
+}
+
+/**
+ * takes the first load measurement for n_threads miner threads
+ */
+void init_throttle(uint32_t n_threads) {
+
+  miner_threads = n_threads;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  n_cpus    = (cpus > 0) ? cpus : 1;
+
+  if (read_cpu_times(&last_busy, &last_total) != 0)
+    error_msg("[EE] failed to read /proc/stat, --cpu-budget only "
+              "applies to the cgroup quota\n");
+
+  last_process = process_time();
+  last_time    = gettime_usec();
+
+  double zero = 0;
+  __atomic_store(&other_load, &zero, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&throttled_threads, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * lowers the priority of the calling (miner) thread to SCHED_IDLE
+ * (or nice 19, if SCHED_IDLE isn't available)
+ */
+void background_priority() {
+
+#ifdef SCHED_IDLE
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+
+  if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+    return;
+#endif
+
+  /* on linux the nice value is per thread */
+  if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19) != 0)
+    errno_msg("failed to lower the miner thread priority");
+}
+
+/**
+ * waits timeout milliseconds, measures the load, and parks or
+ * unparks miner threads to stay within the budget
+ */
+void update_throttle(uint32_t timeout) {
+
+  usleep(timeout * 1000);
+
+  uint64_t busy = last_busy, total = last_total;
+  uint64_t now     = gettime_usec();
+  uint64_t process = process_time();
+
+  double budget = opts.cpu_budget * n_cpus / 100.0;
+  double other  = throttle_other_load();
+
+  if (read_cpu_times(&busy, &total) == 0 &&
+      total > last_total &&
+      now > last_time) {
+
+    double busy_cpus = n_cpus * (busy - last_busy) /
+                       (double) (total - last_total);
+    double own_cpus  = (process - last_process) / (double) (now - last_time);
+    double load      = (busy_cpus > own_cpus) ? busy_cpus - own_cpus : 0;
+
+    other = THROTTLE_SMOOTHING * load + (1 - THROTTLE_SMOOTHING) * other;
+    __atomic_store(&other_load, &other, __ATOMIC_RELAXED);
+  }
+
+  last_busy    = busy;
+  last_total   = total;
+  last_process = process;
+  last_time    = now;
+
+  /* the cpus left for mining */
+  double available = budget - other;
+  double quota     = cgroup_cpus();
+
+  if (quota > 0 && quota < available)
+    available = quota;
+
+  /* rounded, so background noise doesn't park a whole cpu */
+  uint32_t unparked = (available <= 0.5) ? 0 :
+                      (available >= miner_threads) ? miner_threads :
+                      (uint32_t) (available + 0.5);
+
+  uint32_t parked = miner_threads - unparked;
+  uint32_t old    = __atomic_exchange_n(&throttled_threads,
+                                        parked,
+                                        __ATOMIC_RELAXED);
+
+  if (parked == old)
+    return;
+
+  if (opts.verbose)
+    info_msg("[throttle] %" PRIu32 " of %" PRIu32 " miner threads running "
+             "(other processes: %.1f cpus, budget: %.1f cpus)\n",
+             unparked,
+             miner_threads,
+             other,
+             (quota > 0 && quota < budget) ? quota : budget);
+
+  /* unpark the threads which may run again */
+  if (parked < old) {
+    pthread_mutex_lock(&throttle_mutex);
+    pthread_cond_broadcast(&throttle_cond);
+    pthread_mutex_unlock(&throttle_mutex);
+  }
+}
+
+/**
+ * blocks while the given thread is parked or until shutdown
+ */
+void wait_while_throttled(uint32_t id) {
+
+  pthread_mutex_lock(&throttle_mutex);
+
+  while (running && thread_throttled(id))
+    pthread_cond_wait(&throttle_cond, &throttle_mutex);
+
+  pthread_mutex_unlock(&throttle_mutex);
+}
+
+/**
+ * wakes up all parked threads (on shutdown)
+ */
+void wake_throttled() {
+
+  pthread_mutex_lock(&throttle_mutex);
+  pthread_cond_broadcast(&throttle_cond);
+  pthread_mutex_unlock(&throttle_mutex);
+}
+
+/**
+ * returns the smoothed cpu usage of the other processes (in cpus)
+ */
+double throttle_other_load() {
+
+  double load;
+  __atomic_load(&other_load, &load, __ATOMIC_RELAXED);
+  return load;
+}
@@ -0,0 +1,92 @@
+/**
+ * Header file of the background mining (--background, --cpu-budget).
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __THROTTLE_H__
+#define __THROTTLE_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * The throttle thread measures the cpu usage of all other processes
+ * every THROTTLE_INTERVAL milliseconds (/proc/stat minus the own cpu
+ * time), and lets only as many miner threads run as cpus are left in
+ * --cpu-budget percent of the machine (and in the cpu.max quota of the
+ * cgroup, if there is one).
+ *
+ * The other threads get parked: the running ones leave sieve_run() at
+ * the next sieve_active() check (after one layer of a segment, or one
+ * prime test), and wait in wait_while_throttled() until they may
+ * run again.
+ */
+#define THROTTLE_INTERVAL 250
+
+/**
+ * weight of a new load measurement
+ * (the others are smoothed, so a short peak doesn't park everything)
+ */
+#define THROTTLE_SMOOTHING 0.5
+
+/**
+ * the number of parked miner threads, the ones with the lowest ids
+ * are parked first (0 without throttling)
+ */
+EXTERN uint32_t throttled_threads;
+
+/**
+ * returns whether the given miner thread should park
+ */
+static inline char thread_throttled(uint32_t id) {
+
+  return id < __atomic_load_n(&throttled_threads, __ATOMIC_RELAXED);
+}
+
+/**
+ * takes the first load measurement for n_threads miner threads
+ */
+void init_throttle(uint32_t n_threads);
+
+/**
+ * lowers the priority of the calling (miner) thread to SCHED_IDLE
+ * (or nice 19, if SCHED_IDLE isn't available)
+ */
+void background_priority();
+
+/**
+ * waits timeout milliseconds, measures the load, and parks or
+ * unparks miner threads to stay within the budget
+ */
+void update_throttle(uint32_t timeout);
+
+/**
+ * blocks while the given thread is parked or until shutdown
+ */
+void wait_while_throttled(uint32_t id);
+
+/**
+ * wakes up all parked threads (on shutdown)
+ */
+void wake_throttled();
+
+/**
+ * returns the smoothed cpu usage of the other processes (in cpus)
+ */
+double throttle_other_load();
+
+#endif /* __THROTTLE_H__ */
@@ -93,6 +93,19 @@ void print_license() {
 "  --miner-id  [NUM]            give your miner an id (0-65535)            \n"\
 "                               default: 0                                 \n"\
 "                                                                          \n"\
+"  --hosts  [NUM]               number of hosts mining for the same pool   \n"\
+"                               user (at most 65536), default: 1           \n"\
+"                                                                          \n"\
+"  --host-index  [NUM]          index of this host (0 to --hosts - 1),     \n"\
+"                               default: 0 (hosts with the same index      \n"\
+"                               search the same headers)                   \n"\
+"                                                                          \n"\
+"  --processes  [NUM]           number of xpminer processes on this host   \n"\
+"                               (with the same --num-threads), default: 1  \n"\
+"                                                                          \n"\
+"  --process-index  [NUM]       index of this process (0 to --processes    \n"\
+"                               - 1), default: 0                           \n"\
+"                                                                          \n"\
 "  --sieve-extensions [NUM]     the number of sieve extension to use       \n"\
 "                               this is the most sensitive parameter for   \n"\
 "                               tuning try the range around your           \n"\
@@ -113,7 +126,11 @@ void print_license() {
 "                               the more primes you use the longer it      \n"\
 "                               takes to calculate the header hash,        \n"\
 "                               but sieving will be faster                 \n"\
-"                               (use 0 - 9), default: 4                    \n"\
+"                               (each prime p multiplies the hashes per    \n"\
+"                               round by p, use --verbose to see the       \n"\
+"                               hashing share of the mining time)          \n"\
+"                               (use 1 - 32, more than 9 take hours per    \n"\
+"                               round, see --bench-hash-sweep), default: 4 \n"\
 "                                                                          \n"\
 "  --primes-in-primorial [NUM]  this is the number of additional primes    \n"\
 "                               multiplied to the header hash, the more    \n"\
@@ -153,6 +170,94 @@ void print_license() {
 "                                                                          \n"\
 "  --quiet                      print nothing                              \n"\
 "                                                                          \n"\
+"  --pool-timeout  [NUM]        seconds without any data from the pool     \n"\
+"                               until reconnecting, default: 300           \n"\
+"                                                                          \n"\
+"  --record  [FILE]             record all messages received from the pool \n"\
+"                               (work and share results) with timestamps   \n"\
+"                               to FILE for --replay                       \n"\
+"                                                                          \n"\
+"  --replay  [FILE]             mine on the work recorded in FILE instead  \n"\
+"                               of connecting to a pool (no pool options   \n"\
+"                               required), shares are answered locally:    \n"\
+"                               stale if the block changed, else accepted  \n"\
+"                                                                          \n"\
+"  --replay-speed  [NUM]        replay speed factor, 0 replays as fast as  \n"\
+"                               possible, default: 1 (original timing)     \n"\
+"                                                                          \n"\
+"  --prime-cache  [DIR]         directory to cache the prime table in      \n"\
+"                               (speeds up restarts with large             \n"\
+"                               --sieve-primes, shared by all processes)   \n"\
+"                               default: $XDG_CACHE_HOME/xpminer or        \n"\
+"                               ~/.cache/xpminer                           \n"\
+"                                                                          \n"\
+"  --no-prime-cache             always generate the prime table            \n"\
+"                                                                          \n"\
+"  --config  [FILE]             reload sieve-primes, sieve-extensions,     \n"\
+"                               sieve-size, cache-bits and pool-share      \n"\
+"                               from FILE (one \"option value\" per line)    \n"\
+"                               whenever it changes or on SIGUSR1, without \n"\
+"                               reconnecting to the pool                   \n"\
+"                                                                          \n"\
+"  --cpu-features  [NAME]       instruction set of the sieve kernels:      \n"\
+"                               baseline, avx2, avx512 or auto (the best   \n"\
+"                               one supported by the cpu), default: auto   \n"\
+"                                                                          \n"\
+"  --metrics-port  [NUM]        serve the mining and pool counters on      \n"\
+"                               http://127.0.0.1:NUM/metrics (Prometheus   \n"\
+"                               text format)                               \n"\
+"                                                                          \n"\
+"  --proxy  [PORT]              accept other xpminers on PORT, which use   \n"\
+"                               this one as their pool: one connection to  \n"\
+"                               the pool for all, work gets forwarded to   \n"\
+"                               them and their shares (credited to         \n"\
+"                               --pool-user) to the pool                   \n"\
+"                                                                          \n"\
+"  --prune-extensions  [RATIO]  stop sieving the highest extension while   \n"\
+"                               its chains per cpu second are below RATIO  \n"\
+"                               times the ones of the normal sieve (0.5    \n"\
+"                               is a good start), default: 0 (never)       \n"\
+"                                                                          \n"\
+"  --background                 run the miner threads with the lowest cpu  \n"\
+"                               priority (SCHED_IDLE) and park them while  \n"\
+"                               other processes need the cpus (see         \n"\
+"                               --cpu-budget, default: 100)                \n"\
+"                                                                          \n"\
+"  --cpu-budget  [PERCENT]      park miner threads while the cpu usage of  \n"\
+"                               the machine would exceed PERCENT (and the  \n"\
+"                               cpu.max quota of the cgroup), checked each \n"\
+"                               250ms, default: 0 (never)                  \n"\
+"                                                                          \n"\
+"  --memory-limit  [MB]         reduce --sieve-extensions, --sieve-size and\n"\
+"                               --num-threads (in this order) until the    \n"\
+"                               miner needs at most MB megabytes, the      \n"\
+"                               chosen layout is printed at startup        \n"\
+"                                                                          \n"\
+"Benchmark Options (no pool options required):                             \n"\
+"                                                                          \n"\
+"  --benchmark                  run the miner offline on a synthetic       \n"\
+"                               header and print tests/s, candidates per   \n"\
+"                               round, stage times and chains/h            \n"\
+"                               (nothing gets submitted)                   \n"\
+"                                                                          \n"\
+"  --bench-seed  [NUM]          seed for the synthetic header, the same    \n"\
+"                               seed, rounds and sieve options always give \n"\
+"                               the same tests and chains, default: 0      \n"\
+"                                                                          \n"\
+"  --bench-rounds  [NUM]        number of sieve rounds to run (over all    \n"\
+"                               threads), default: 64                      \n"\
+"                                                                          \n"\
+"  --bench-time  [NUM]          stop the benchmark after NUM seconds       \n"\
+"                               (at the next round boundary)               \n"\
+"                                                                          \n"\
+"  --bench-hash-sweep  [NUM]    benchmark every --primes-in-hash from 1 to \n"\
+"                               NUM (implies --benchmark) and print the    \n"\
+"                               hash and sieve time per round and the      \n"\
+"                               chains/h, to find where the trade-off      \n"\
+"                               peaks (rounds which would need more than   \n"\
+"                               4M hashes use a synthetic hash, and the    \n"\
+"                               hash time from the measured hash rate)     \n"\
+"                                                                          \n"\
 "Mining statistics (printed without --verbose):                            \n"\
 "                                                                          \n"\
 "  [DATE] T/s <test/s> P/s <primes/s> 5ch (<5-ch/h> / <avg 5-ch/h>)        \n"\
@@ -221,15 +326,121 @@ void print_mpz(const mpz_t mpz) {
   pthread_mutex_unlock(&mutex);
 }
 
+/**
+ * formats the given duration in microseconds
+ */
+static char *format_usec(char *buffer, double usec) {
+
+  if (usec < 1000)
+    sprintf(buffer, "%.1fus", usec);
+  else if (usec < 1000000)
+    sprintf(buffer, "%.1fms", usec / 1000);
+  else
+    sprintf(buffer, "%.1fs", usec / 1000000);
+
+  return buffer;
+}
+
+/**
+ * prints p50 / p99 of the given histogram (if anything was counted)
+ */
+static void print_percentiles(const char *name, const Histogram *hist) {
+
+  char p50[32], p99[32];
+
+  if (hist_count(hist) == 0) return;
+
+  info_msg("  %s %s / %s",
+           name,
+           format_usec(p50, hist_percentile(hist, 50)),
+           format_usec(p99, hist_percentile(hist, 99)));
+}
+
+/**
+ * prints the latencies of the mining stages of all threads
+ * (since the start)
+ */
+static void print_latencies(const Histogram *hist) {
+
+  uint32_t n;
+
+  info_msg("Stages (p50 / p99):");
+  print_percentiles("hash",        &hist[HIST_HASH]);
+  print_percentiles("multipliers", &hist[HIST_MULTIPLIERS]);
+  print_percentiles("segment",     &hist[HIST_SEGMENT]);
+  print_percentiles("extract",     &hist[HIST_EXTRACT]);
+  print_percentiles("submit",      &hist[HIST_SUBMIT]);
+
+  info_msg("\nTests (p50 / p99):");
+  print_percentiles("1CC", &hist[HIST_TEST_CC1]);
+  print_percentiles("2CC", &hist[HIST_TEST_CC2]);
+  print_percentiles("TWN", &hist[HIST_TEST_TWN]);
+
+  info_msg("\nExtensions (p50 / p99):");
+  for (n = 0; n < HIST_EXTENSIONS; n++) {
+
+    char name[16];
+    sprintf(name, "%" PRIu32 "%s:", n, (n == HIST_EXTENSIONS - 1) ? "+" : "");
+    print_percentiles(name, &hist[HIST_EXTENSION + n]);
+  }
+
+  info_msg("\n");
+}
+
+/**
+ * prints the yield of the sieve extensions of all threads
+ * (since the start, see --prune-extensions)
+ */
+static void print_extensions(const SieveStats *ext_stats) {
+
+  uint32_t extensions = opts.sieve_extensions;
+  uint32_t active     = sieve_active_extensions();
+  uint32_t e, n;
+
+  info_msg("Extension yield (tests / primes / %" PRIu32 "ch+ / cpu time / "
+           "%" PRIu32 "ch+ per cpu-h):\n",
+           opts.pool_share,
+           opts.pool_share);
+
+  for (e = 0; e <= extensions; e++) {
+
+    uint64_t primes = 0, chains = 0;
+    for (n = 1; n < MAX_CHAIN_LENGTH; n++) {
+      primes += ext_stats->ext_chains[e][n];
+
+      if (n >= opts.pool_share)
+        chains += ext_stats->ext_chains[e][n];
+    }
+
+    char cpu_time[32];
+    double hours = ext_stats->ext_time[e] / 3600000000.0;
+
+    info_msg("  %2" PRIu32 ": %" PRIu64 " / %" PRIu64 " / %" PRIu64 
+             " / %s / %.1f%s\n",
+             e,
+             ext_stats->ext_tests[e],
+             primes,
+             chains,
+             format_usec(cpu_time, ext_stats->ext_time[e]),
+             hours > 0 ? chains / hours : 0,
+             e > active ? " (pruned)" : "");
+  }
+
+  info_msg("\n");
+}
+
 /**
  * generate and print statistics
  */ 
-void print_stats(MinerArgs *stats, uint32_t n_threads) {
+void print_stats(uint32_t n_threads) {
 
   static SieveStats sieve_stats_old;
   static uint64_t   primes_old  = 0;
   static char       initialized = 0;
 
+  /* only used by the stats thread */
+  static Histogram hist[HIST_STAGES];
+
   if (!initialized) {
     memset(&sieve_stats_old, 0, sizeof(SieveStats));
     initialized = 1;
@@ -237,7 +448,6 @@ void print_stats(MinerArgs *stats, uint32_t n_threads) {
 
 
   SieveStats sieve_stats;
-  memset(&sieve_stats, 0, sizeof(SieveStats));
   uint64_t primes = 0;
 
   time_t cur_time     = time(NULL);
@@ -247,23 +457,12 @@ void print_stats(MinerArgs *stats, uint32_t n_threads) {
   strftime(date_time, 80, "[%F %T]",timeinfo);
 
   
-  /* collect the information from the different threads */
-  uint32_t i, n;
-  for (i = 0; i < n_threads; i++) {
-    
-    for (n = 0; n < MAX_CHAIN_LENGTH; n++) {
-      sieve_stats.twn[n] += stats[i].sieve.stats.twn[n];
-      sieve_stats.cc2[n] += stats[i].sieve.stats.cc2[n];
-      sieve_stats.cc1[n] += stats[i].sieve.stats.cc1[n];
-
-      if (n > 0)
-        primes += stats[i].sieve.stats.twn[n] +
-                  stats[i].sieve.stats.cc2[n] +
-                  stats[i].sieve.stats.cc1[n];
-    }
+  /* collect the information from the thread groups */
+  stats_groups_collect(&sieve_stats, opts.verbose ? hist : NULL);
 
-    sieve_stats.tests += stats[i].sieve.stats.tests;
-  }
+  uint32_t i, n;
+  for (n = 1; n < MAX_CHAIN_LENGTH; n++)
+    primes += sieve_stats.twn[n] + sieve_stats.cc2[n] + sieve_stats.cc1[n];
 
   /* calculate statistics */
   double passed_time  = (double) (cur_time - opts.start_time);
@@ -347,6 +546,60 @@ void print_stats(MinerArgs *stats, uint32_t n_threads) {
   if (opts.verbose) {
     info_msg("Tests: %d\n", sieve_stats.tests);
 
+    /* header hash mining vs. sieving and testing trade-off */
+    uint32_t hashes_per_sec = (sieve_stats.hashes - sieve_stats_old.hashes) /
+                              opts.stats_interval;
+
+    double hash_percent = (sieve_stats.hash_time - sieve_stats_old.hash_time) /
+                          (10000.0 * opts.stats_interval * n_threads);
+
+    info_msg("Hashes: %" PRIu64 " (%" PRIu32 " H/s | %.1f%% of mining time)\n",
+             sieve_stats.hashes,
+             hashes_per_sec,
+             hash_percent);
+
+    info_msg("Reconnects: %" PRIu64 " (%.1fs disconnected)\n",
+             opts.stats.reconnects,
+             get_disconnected_time() / 1000000.0);
+
+    /* share submission latency and queue depth */
+    uint64_t acked = all_shares > 0 ? all_shares : 1;
+    uint64_t sent  = opts.stats.submitted > 0 ? opts.stats.submitted : 1;
+
+    /* time from receiving new work till the miners switched to it */
+    uint64_t switches = sieve_stats.work_switches > 0 ? 
+                        sieve_stats.work_switches : 1;
+
+    info_msg("Work switch: %.1fms (max %.1fms)\n",
+             sieve_stats.switch_time / (1000.0 * switches),
+             sieve_stats.switch_time_max / 1000.0);
+
+    info_msg("Share queue: %" PRIu32 " (max %" PRIu32 ") dropped: %" PRIu64 
+             " stale dropped: %" PRIu64 " submit: %.1fms ack: %.1fms\n",
+             share_queue_depth(),
+             opts.stats.queue_depth_max,
+             __atomic_load_n(&opts.stats.dropped, __ATOMIC_RELAXED),
+             __atomic_load_n(&opts.stats.stale_dropped, __ATOMIC_RELAXED),
+             opts.stats.submit_time / (1000.0 * sent),
+             opts.stats.ack_time / (1000.0 * acked));
+
+    if (opts.proxy_port != 0)
+      info_msg("Proxy: %" PRIu32 " miners, shares: %" PRIu64 
+               " invalid: %" PRIu64 "\n",
+               __atomic_load_n(&opts.stats.proxy_miners, __ATOMIC_RELAXED),
+               __atomic_load_n(&opts.stats.proxy_shares, __ATOMIC_RELAXED),
+               __atomic_load_n(&opts.stats.proxy_invalid, __ATOMIC_RELAXED));
+
+    if (opts.cpu_budget > 0)
+      info_msg("Throttle: %" PRIu32 " of %" PRIu32 " threads parked "
+               "(other processes: %.1f cpus)\n",
+               __atomic_load_n(&throttled_threads, __ATOMIC_RELAXED),
+               n_threads,
+               throttle_other_load());
+
+    print_latencies(hist);
+    print_extensions(&sieve_stats);
+
     info_msg("1CC: ");                          
     for (n = 1; n < MAX_CHAIN_LENGTH; n++)
       if (sieve_stats.cc1[n] > 0)
@@ -376,7 +629,9 @@ void print_stats(MinerArgs *stats, uint32_t n_threads) {
     sieve_stats_old.cc1[n] = sieve_stats.cc1[n];
   }
 
-  sieve_stats_old.tests = sieve_stats.tests;
+  sieve_stats_old.tests     = sieve_stats.tests;
+  sieve_stats_old.hashes    = sieve_stats.hashes;
+  sieve_stats_old.hash_time = sieve_stats.hash_time;
   primes_old = primes;
 }
 
@@ -398,8 +653,10 @@ void print_options() {
          "  pool-pwd:                 %s\n"
          "  pool-share:               %d\n"
          "  chain-length:             %d\n"
-         "  num-threads:              %d\n"
+         "  num-threads:              %" PRIu32 "\n"
          "  miner-id:                 %d\n"
+         "  host:                     %d / %d\n"
+         "  process:                  %d / %d\n"
          "  sieve-extensions:         %d\n"
          "  sieve-primes:             %d\n"
          "  sieve-size:               %d\n"
@@ -409,7 +666,7 @@ void print_options() {
          "  min-prime-index:          %d\n"
          "  max-prime-index:          %d\n"
          "  stats-interval:           %d\n"
-         "  hash-primorial:           %d\n"
+         "  pool-timeout:             %d\n"
          "  use-first-half:           %s\n"
          "  fixed-hash-multiplier:    ",
          PROG_NAME,
@@ -422,6 +679,10 @@ void print_options() {
          opts.chain_length,
          opts.num_threads,
          opts.miner_id,
+         (int) opts.host_index,
+         (int) opts.hosts,
+         (int) opts.process_index,
+         (int) opts.processes,
          opts.sieve_extensions,
          opts.sieve_primes,
          opts.sieve_size,
@@ -431,11 +692,46 @@ void print_options() {
          opts.primes_in_primorial,
          opts.max_prime_index,
          opts.stats_interval,
-         opts.hash_primorial,
+         opts.pool_timeout,
          (opts.use_first_half ? "true" : "false"));
 
   mpz_out_str(stdout, 10, opts.mpz_fixed_hash_multiplier);
-  printf("\n\n");
+
+  printf("\n  hash-primorial:           ");
+  mpz_out_str(stdout, 10, opts.mpz_hash_primorial);
+
+  /* only every second hash is >= 2^255 */
+  printf("\n  hashes-per-round:         %.0f\n\n", 
+         2 * mpz_get_d(opts.mpz_hash_primorial));
       
   pthread_mutex_unlock(&mutex);
 }
+
+/**
+ * print the selected kernel variants (unless quiet is given)
+ */
+void print_cpu_features() {
+
+  if (opts.quiet) return;
+
+  uint32_t detected = cpu_detect_level();
+
+  /* sha256 (openssl) and the fermat test (gmp) dispatch on their own */
+  if (opts.cpu_level == detected)
+    info_msg("using the %s sieve kernels, sha256: openssl, fermat: gmp %s\n",
+             cpu_level_name(opts.cpu_level),
+             gmp_version);
+  else
+    info_msg("using the %s sieve kernels (cpu supports %s), "
+             "sha256: openssl, fermat: gmp %s\n",
+             cpu_level_name(opts.cpu_level),
+             cpu_level_name(detected),
+             gmp_version);
+
+  if (opts.verbose)
+    info_msg("using the %s segment schedule for chain length %" PRIu32 
+             " and %" PRIu32 " extensions\n",
+             sieve_segment_specialized() ? "specialized" : "generic",
+             opts.chain_length,
+             opts.sieve_extensions);
+}
@@ -42,13 +42,18 @@ void info_msg(char *format, ...);
 /**
  * generate and print statistics
  */ 
-void print_stats(MinerArgs *stats, uint32_t n_threads);
+void print_stats(uint32_t n_threads);
 
 /**
  * print miner options if verbose is given
  */
 void print_options();
 
+/**
+ * print the selected kernel variants (unless quiet is given)
+ */
+void print_cpu_features();
+
 /**
  * prints the license and exits the program
  */
@@ -0,0 +1,126 @@
+/**
+ * Implementation of the publication of new work (block headers)
+ * from the network thread to the miner threads.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include <pthread.h>
+
+#include "main.h"
+
+/**
+ * to block the threads waiting for valid work
+ * (the work slot itself is never locked)
+ */
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  work_cond  = PTHREAD_COND_INITIALIZER;
+
+/**
+ * sets the valid flag and starts a new work epoch
+ */
+static void update_work(const BlockHeader *header, char valid) {
+
+  uint32_t seq = work_slot.seq;
+
+  /* odd: readers have to wait */
+  __atomic_store_n(&work_slot.seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (header != NULL) {
+    memcpy(&work_slot.header, header, sizeof(BlockHeader));
+    work_slot.published = gettime_usec();
+  }
+  work_slot.valid = valid;
+
+  /* even again: new epoch */
+  __atomic_store_n(&work_slot.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * publishes a new block header to the miner threads
+ * (only called by the network thread)
+ */
+void publish_work(const BlockHeader *header) {
+
+  pthread_mutex_lock(&work_mutex);
+  update_work(header, 1);
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&work_mutex);
+}
+
+/**
+ * marks the current work as invalid, so that the miners will park
+ * (only called by the network thread)
+ */
+void invalidate_work() {
+  
+  /* nothing to invalidate */
+  if (!work_slot.valid) return;
+
+  pthread_mutex_lock(&work_mutex);
+  update_work(NULL, 0);
+  pthread_mutex_unlock(&work_mutex);
+}
+
+/**
+ * copies the current work into the given header
+ * returns the work epoch of the header or 0 if there is no valid work
+ */
+uint32_t read_work(BlockHeader *header, uint64_t *published) {
+
+  uint32_t seq;
+  char valid;
+
+  do {
+    
+    /* wait while the header gets written */
+    while ((seq = __atomic_load_n(&work_slot.seq, __ATOMIC_ACQUIRE)) & 1)
+      ;
+
+    memcpy(header, &work_slot.header, sizeof(BlockHeader));
+    *published = work_slot.published;
+    valid      = work_slot.valid;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  } while (__atomic_load_n(&work_slot.seq, __ATOMIC_RELAXED) != seq);
+
+  return valid ? seq >> 1 : 0;
+}
+
+/**
+ * blocks until valid work is available or the program gets closed
+ */
+void wait_for_work() {
+
+  pthread_mutex_lock(&work_mutex);
+
+  while (running && !work_slot.valid)
+    pthread_cond_wait(&work_cond, &work_mutex);
+
+  pthread_mutex_unlock(&work_mutex);
+}
+
+/**
+ * wakes up all threads waiting for work (on shutdown)
+ */
+void wake_work_waiters() {
+
+  pthread_mutex_lock(&work_mutex);
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&work_mutex);
+}
@@ -0,0 +1,99 @@
+/**
+ * Header file for the publication of new work (block headers)
+ * from the network thread to the miner threads.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __WORK_H__
+#define __WORK_H__
+
+#include <inttypes.h>
+
+#include "main.h"
+
+/**
+ * The current work is stored in a versioned slot (a seqlock).
+ *
+ * Only the network thread writes new work: it makes the sequence 
+ * number odd, copies the new header and makes it even again.
+ *
+ * The miner threads never lock anything: they copy the header and
+ * retry if the sequence number was odd or has changed meanwhile.
+ *
+ * seq / 2 is the work epoch, which is incremented with each new work,
+ * so a miner only has to compare its own epoch with the current one
+ * to notice new work (epoch 0 means no work received yet)
+ *
+ * If the work gets invalid (connection lost) the epoch is incremented
+ * too, so the miners abort the current round and park in wait_for_work()
+ * until new work gets published.
+ */
+struct WorkSlot {
+  
+  /* sequence number (odd while writing) */
+  uint32_t seq;
+
+  /* whether the header is valid work */
+  char valid;
+
+  /* time the work was published (in microseconds) */
+  uint64_t published;
+
+  /* the block header we are mining for */
+  BlockHeader header;
+
+} __attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/* the current work */
+EXTERN WorkSlot work_slot;
+
+/**
+ * returns the current work epoch
+ */
+static inline uint32_t work_epoch() {
+
+  return __atomic_load_n(&work_slot.seq, __ATOMIC_ACQUIRE) >> 1;
+}
+
+/**
+ * publishes a new block header to the miner threads
+ * (only called by the network thread)
+ */
+void publish_work(const BlockHeader *header);
+
+/**
+ * marks the current work as invalid, so that the miners will park
+ * (only called by the network thread)
+ */
+void invalidate_work();
+
+/**
+ * copies the current work into the given header
+ * returns the work epoch of the header or 0 if there is no valid work
+ */
+uint32_t read_work(BlockHeader *header, uint64_t *published);
+
+/**
+ * blocks until valid work is available or the program gets closed
+ */
+void wait_for_work();
+
+/**
+ * wakes up all threads waiting for work (on shutdown)
+ */
+void wake_work_waiters();
+
+#endif /* __WORK_H__ */